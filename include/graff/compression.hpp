@@ -0,0 +1,301 @@
+#pragma once
+
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef GRAFF_USE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef GRAFF_USE_LZ4
+#include <lz4.h>
+#endif
+
+#include <graff/encoding.hpp>
+
+namespace graff {
+
+/*!
+ * \brief Message compressions.
+ *
+ * Each is only compiled in when the library is available (GRAFF_USE_ZSTD,
+ * GRAFF_USE_LZ4), and only used once the endpoint has advertised it (see
+ * Endpoint::NegotiateCompression).
+ */
+enum class Compression { kNone, kLz4, kZstd };
+
+/*!
+ * \brief Messages shorter than this (in bytes) are not worth compressing.
+ */
+const std::size_t kCompressionThreshold = 1024;
+
+/*!
+ * \brief Largest uncompressed size (in bytes) Decompress() accepts by default.
+ */
+const std::size_t kMaxDecompressedSize = std::size_t(1) << 28;
+
+inline std::string CompressionName(Compression compression) {
+  switch (compression) {
+  case Compression::kLz4:
+    return ("lz4");
+  case Compression::kZstd:
+    return ("zstd");
+  default:
+    return ("none");
+  }
+}
+
+/*!
+ * \brief Look up a compression by name.
+ * \param [in] name The compression name, as returned by CompressionName.
+ * \param [out] compression The matching compression.
+ * \return false if the name is unknown.
+ */
+inline bool CompressionFromName(const std::string &name,
+                                Compression &compression) {
+  if (name == "none") {
+    compression = Compression::kNone;
+  } else if (name == "lz4") {
+    compression = Compression::kLz4;
+  } else if (name == "zstd") {
+    compression = Compression::kZstd;
+  } else {
+    return (false);
+  }
+  return (true);
+}
+
+/*!
+ * \brief Whether a compression was compiled in.
+ */
+inline bool CompressionAvailable(Compression compression) {
+  switch (compression) {
+  case Compression::kNone:
+    return (true);
+  case Compression::kLz4:
+#ifdef GRAFF_USE_LZ4
+    return (true);
+#else
+    return (false);
+#endif
+  case Compression::kZstd:
+#ifdef GRAFF_USE_ZSTD
+    return (true);
+#else
+    return (false);
+#endif
+  }
+  return (false);
+}
+
+/*!
+ * \brief The names of the compressions compiled in (besides "none").
+ */
+inline std::vector<std::string> AvailableCompressions(void) {
+  std::vector<std::string> names;
+  for (Compression compression : {Compression::kZstd, Compression::kLz4}) {
+    if (CompressionAvailable(compression)) {
+      names.push_back(CompressionName(compression));
+    }
+  }
+  return (names);
+}
+
+/*!
+ * \brief Compress a message body.
+ *
+ * The compressed body is the uncompressed size (4 bytes, little-endian)
+ * followed by the compressed bytes.
+ *
+ * \param [in] data Pointer to the bytes.
+ * \param [in] size Number of bytes.
+ * \param [in] compression The compression.
+ * \param [out] out The compressed body.
+ * \return false if the compression is not available, or would not make the
+ * body smaller; the body should then be sent as is.
+ */
+inline bool Compress(const char *data, std::size_t size,
+                     Compression compression, std::string &out) {
+  if (Compression::kNone == compression || size > 0x7fffffffu ||
+      !CompressionAvailable(compression)) {
+    return (false);
+  }
+  std::size_t bound = 0;
+#ifdef GRAFF_USE_ZSTD
+  if (Compression::kZstd == compression) {
+    bound = ZSTD_compressBound(size);
+  }
+#endif
+#ifdef GRAFF_USE_LZ4
+  if (Compression::kLz4 == compression) {
+    bound =
+        static_cast<std::size_t>(LZ4_compressBound(static_cast<int>(size)));
+  }
+#endif
+  out.resize(4 + bound);
+  for (int i = 0; i < 4; ++i) {
+    out[i] = static_cast<char>((size >> (8 * i)) & 0xff);
+  }
+  std::size_t compressed = 0;
+#ifdef GRAFF_USE_ZSTD
+  if (Compression::kZstd == compression) {
+    // level 3 is zstd's default, and cheap enough for the submit path
+    compressed = ZSTD_compress(&out[4], bound, data, size, 3);
+    if (ZSTD_isError(compressed)) {
+      compressed = 0;
+    }
+  }
+#endif
+#ifdef GRAFF_USE_LZ4
+  if (Compression::kLz4 == compression) {
+    const int n = LZ4_compress_default(data, &out[4], static_cast<int>(size),
+                                       static_cast<int>(bound));
+    compressed = (n > 0 ? static_cast<std::size_t>(n) : 0);
+  }
+#endif
+  if (0 == compressed || 4 + compressed >= size) {
+    out.clear();
+    return (false);
+  }
+  out.resize(4 + compressed);
+  return (true);
+}
+
+/*!
+ * \brief Decompress a message body produced by Compress().
+ * \param [in] data Pointer to the compressed body.
+ * \param [in] size Number of bytes.
+ * \param [in] compression The compression.
+ * \param [out] out The uncompressed bytes.
+ * \param [in] max_size The largest uncompressed size to accept.
+ * \throws std::runtime_error if the compression is not available, the body
+ * is malformed, or the size it claims is over max_size or more than the
+ * compressed bytes could expand to. The size is checked before allocating.
+ */
+inline void Decompress(const char *data, std::size_t size,
+                       Compression compression, std::string &out,
+                       std::size_t max_size = kMaxDecompressedSize) {
+  if (!CompressionAvailable(compression)) {
+    throw std::runtime_error("compression not available: " +
+                             CompressionName(compression));
+  }
+  if (Compression::kNone == compression) {
+    out.assign(data, size);
+    return;
+  }
+  if (size < 4) {
+    throw std::runtime_error("truncated compressed message");
+  }
+  std::size_t original = 0;
+  for (int i = 0; i < 4; ++i) {
+    original |= static_cast<std::size_t>(static_cast<unsigned char>(data[i]))
+                << (8 * i);
+  }
+  if (original > max_size) {
+    throw std::runtime_error("compressed message too large");
+  }
+#ifdef GRAFF_USE_ZSTD
+  if (Compression::kZstd == compression) {
+    const unsigned long long frame =
+        ZSTD_getFrameContentSize(data + 4, size - 4);
+    if (ZSTD_CONTENTSIZE_ERROR == frame ||
+        (ZSTD_CONTENTSIZE_UNKNOWN != frame && frame != original)) {
+      throw std::runtime_error("malformed zstd message");
+    }
+  }
+#endif
+#ifdef GRAFF_USE_LZ4
+  // LZ4 expands by at most 255:1, and takes its sizes as int.
+  if (Compression::kLz4 == compression &&
+      (original > static_cast<std::size_t>(INT_MAX) ||
+       size - 4 > static_cast<std::size_t>(INT_MAX) ||
+       original / 255 > size - 4)) {
+    throw std::runtime_error("malformed lz4 message");
+  }
+#endif
+  out.resize(original);
+  bool ok = false;
+#ifdef GRAFF_USE_ZSTD
+  if (Compression::kZstd == compression) {
+    const std::size_t n = ZSTD_decompress(&out[0], original, data + 4,
+                                          size - 4);
+    ok = (!ZSTD_isError(n) && n == original);
+  }
+#endif
+#ifdef GRAFF_USE_LZ4
+  if (Compression::kLz4 == compression) {
+    const int n = LZ4_decompress_safe(data + 4, &out[0],
+                                      static_cast<int>(size - 4),
+                                      static_cast<int>(original));
+    ok = (n >= 0 && static_cast<std::size_t>(n) == original);
+  }
+#endif
+  if (!ok) {
+    throw std::runtime_error("malformed " + CompressionName(compression) +
+                             " message");
+  }
+}
+
+/*!
+ * \struct WireFormat compression.hpp
+ * \brief How a message body is encoded, as named by the frame preceding it.
+ *
+ * The frame holds the encoding name, then "+" and the compression name if
+ * the body is compressed, or ";" and the compression name if the body is not
+ * compressed but the sender accepts compressed replies, e.g. "msgpack",
+ * "json+zstd" or "cbor;lz4". A message without the frame is plain JSON.
+ */
+struct WireFormat {
+  Encoding encoding;
+  Compression compression; /*!< of the body */
+  Compression accepted;    /*!< for the reply */
+
+  WireFormat()
+      : encoding(Encoding::kJson), compression(Compression::kNone),
+        accepted(Compression::kNone) {}
+
+  /*!
+   * \brief Whether the message needs the frame naming its format.
+   */
+  bool tagged(void) const {
+    return (Encoding::kJson != encoding ||
+            Compression::kNone != compression ||
+            Compression::kNone != accepted);
+  }
+
+  std::string Tag(void) const {
+    std::string tag = EncodingName(encoding);
+    if (Compression::kNone != compression) {
+      tag += '+' + CompressionName(compression);
+    } else if (Compression::kNone != accepted) {
+      tag += ';' + CompressionName(accepted);
+    }
+    return (tag);
+  }
+
+  /*!
+   * \brief Parse the frame naming a format.
+   * \return false if the encoding or the compression is unknown.
+   */
+  static bool Parse(const std::string &tag, WireFormat &format) {
+    format = WireFormat();
+    const std::size_t split = tag.find_first_of("+;");
+    if (!EncodingFromName(tag.substr(0, split), format.encoding)) {
+      return (false);
+    }
+    if (std::string::npos == split) {
+      return (true);
+    }
+    if (!CompressionFromName(tag.substr(split + 1), format.accepted)) {
+      return (false);
+    }
+    if ('+' == tag[split]) {
+      format.compression = format.accepted;
+    }
+    return (true);
+  }
+};
+
+} // namespace graff
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+namespace graff {
+
+/*!
+ * \brief Wire encodings for requests and replies.
+ *
+ * JSON text is always understood by the endpoint; the binary encodings are
+ * only used once the endpoint has advertised them (see Endpoint::Negotiate).
+ */
+enum class Encoding { kJson, kMsgPack, kCbor };
+
+inline std::string EncodingName(Encoding encoding) {
+  switch (encoding) {
+  case Encoding::kMsgPack:
+    return ("msgpack");
+  case Encoding::kCbor:
+    return ("cbor");
+  default:
+    return ("json");
+  }
+}
+
+/*!
+ * \brief Look up an encoding by name.
+ * \param [in] name The encoding name, as returned by EncodingName.
+ * \param [out] encoding The matching encoding.
+ * \return false if the name is unknown.
+ */
+inline bool EncodingFromName(const std::string &name, Encoding &encoding) {
+  if (name == "json") {
+    encoding = Encoding::kJson;
+  } else if (name == "msgpack") {
+    encoding = Encoding::kMsgPack;
+  } else if (name == "cbor") {
+    encoding = Encoding::kCbor;
+  } else {
+    return (false);
+  }
+  return (true);
+}
+
+/*!
+ * \brief Encode a json object.
+ * \param [in] j The object to encode.
+ * \param [in] encoding The wire encoding.
+ * \return The encoded bytes.
+ */
+inline std::string Encode(const json &j, Encoding encoding) {
+  std::string out;
+  switch (encoding) {
+  case Encoding::kMsgPack:
+    json::to_msgpack(j, out);
+    break;
+  case Encoding::kCbor:
+    json::to_cbor(j, out);
+    break;
+  default:
+    out = j.dump();
+  }
+  return (out);
+}
+
+/*!
+ * \brief Decode a json object.
+ * \param [in] data Pointer to the encoded bytes.
+ * \param [in] size Number of encoded bytes.
+ * \param [in] encoding The wire encoding.
+ * \return The decoded object; throws on malformed input.
+ */
+inline json Decode(const char *data, std::size_t size, Encoding encoding) {
+  switch (encoding) {
+  case Encoding::kMsgPack:
+    return (json::from_msgpack(data, data + size));
+  case Encoding::kCbor:
+    return (json::from_cbor(data, data + size));
+  default:
+    return (json::parse(data, data + size));
+  }
+}
+
+} // namespace graff
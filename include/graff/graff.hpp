@@ -1,10 +1,38 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include <zmq.hpp>
 
 #include "json.hpp"
 
+#include <graff/compression.hpp>
+#include <graff/encoding.hpp>
+#include <graff/kde.hpp>
+#include <graff/reader.hpp>
+#include <graff/stats.hpp>
+#include <graff/symbol.hpp>
+#include <graff/writer.hpp>
+
 using json = nlohmann::json;
 const double PI = 3.141592653589793238463;
 
@@ -25,7 +53,8 @@ void print(const json &reply) {
   }
 }
 inline bool check(const json &reply) {
-  return (reply["status"] == "OK" ? true : false);
+  auto status = reply.find("status");
+  return (status != reply.end() && *status == "OK" ? true : false);
 }
 // end: utility functions
 
@@ -39,16 +68,118 @@ namespace graff {
  */
 class Distribution {
 public:
+  virtual ~Distribution() {}
   virtual json ToJson(void) const = 0;
+  /*! \brief Stream the distribution; defaults to writing ToJson(). */
+  virtual void Write(Writer &w) const { w.Value(ToJson()); }
 };
 
 /*!
  * \class Normal graff.hpp
  * \brief A class to handle a uni- or multi-variate normal distribution.
+ *
+ * The covariance is kept in the most compact form that represents it exactly:
+ * a single variance (isotropic), the diagonal, the upper triangle (packed), or
+ * the full matrix when it is not symmetric. The same form is used on the wire,
+ * tagged with "covType", when the endpoint advertises "covForms" (see
+ * Endpoint::NegotiateCovarianceForms()); otherwise, and in ToJson(), the
+ * covariance is written as the dense matrix.
  */
 class Normal : public Distribution {
+public:
+  /*! \brief Storage form of the covariance matrix. */
+  enum class Covariance {
+    kDense,    /*!< n*n values, column-major */
+    kPacked,   /*!< n*(n+1)/2 values, upper triangle packed by columns */
+    kDiagonal, /*!< n values, the diagonal */
+    kIsotropic /*!< 1 value, shared by the whole diagonal */
+  };
+
+private:
   std::vector<double> mean_; /*!< mean vector */
-  std::vector<double> cov_;  /*!< covariance matrix, in column-major order */
+  std::vector<double> cov_;  /*!< covariance matrix, in the form of form_ */
+  Covariance form_;
+
+public:
+  /*! \brief Number of values of an n x n covariance laid out in form. */
+  static std::size_t Size(std::size_t n, Covariance form) {
+    switch (form) {
+    case Covariance::kPacked:
+      return (n * (n + 1) / 2);
+    case Covariance::kDiagonal:
+      return (n);
+    case Covariance::kIsotropic:
+      return (1);
+    default:
+      return (n * n);
+    }
+  }
+
+  /*!
+   * \brief The most compact form that holds an n x n covariance exactly.
+   * \param [in] cov The n*n covariance values, in column-major order.
+   * \param [in] n The dimension.
+   */
+  static Covariance DetectForm(const double *cov, std::size_t n) {
+    bool symmetric(true), diagonal(true), isotropic(true);
+    for (std::size_t j = 0; j < n; ++j) {
+      for (std::size_t i = 0; i < j; ++i) {
+        symmetric &= (cov[i + j * n] == cov[j + i * n]);
+        diagonal &= (0.0 == cov[i + j * n] && 0.0 == cov[j + i * n]);
+      }
+      isotropic &= (cov[j + j * n] == cov[0]);
+    }
+    if (n < 2 || !symmetric) {
+      return (Covariance::kDense); // nothing to gain
+    } else if (diagonal) {
+      return (isotropic ? Covariance::kIsotropic : Covariance::kDiagonal);
+    }
+    return (Covariance::kPacked);
+  }
+
+  /*!
+   * \brief Lay out an n x n covariance according to form.
+   * \param [in] cov The n*n covariance values, in column-major order.
+   * \param [in] n The dimension.
+   * \param [in] form The target form, which must hold cov exactly.
+   * \param [out] out Size(n, form) values.
+   */
+  static void Pack(const double *cov, std::size_t n, Covariance form,
+                   double *out) {
+    switch (form) {
+    case Covariance::kIsotropic:
+      out[0] = cov[0];
+      break;
+    case Covariance::kDiagonal:
+      for (std::size_t j = 0; j < n; ++j) {
+        out[j] = cov[j + j * n];
+      }
+      break;
+    case Covariance::kPacked:
+      for (std::size_t j = 0; j < n; ++j) {
+        for (std::size_t i = 0; i <= j; ++i) {
+          *out++ = cov[i + j * n];
+        }
+      }
+      break;
+    default:
+      std::copy(cov, cov + n * n, out);
+    }
+  }
+
+private:
+  // reduce a dense, column-major covariance to its most compact exact form
+  void Compact(void) {
+    const std::size_t n = mean_.size();
+    const Covariance form = DetectForm(cov_.data(), n);
+    if (Covariance::kDense == form) {
+      return;
+    }
+    std::vector<double> compact(Size(n, form));
+    Pack(cov_.data(), n, form, compact.data());
+    cov_.swap(compact);
+    form_ = form;
+  }
 
 public:
   /*!
@@ -56,39 +187,215 @@ public:
    * \param [in] mean Mean
    * \param [in] var Variance
    */
-  Normal(const double &mean, const double &var) : mean_({mean}), cov_({var}) {}
+  Normal(const double &mean, const double &var)
+      : mean_({mean}), cov_({var}), form_(Covariance::kDense) {}
 
   /*!
-   * \brief Constructor for a multivariate normal
+   * \brief Constructor for a multivariate normal; the covariance is stored in
+   * its most compact exact form.
    * \param [in] mean Mean vector
-   * \param [in] var Covariance matrix, in column-major order.
+   * \param [in] cov Covariance matrix, in column-major order.
    */
   Normal(const std::vector<double> &mean, const std::vector<double> &cov)
-      : mean_(mean), cov_(cov) {
-    assert(mean.size() * mean.size() == cov.size());
+      : mean_(mean), cov_(cov), form_(Covariance::kDense) {
+    if (mean.size() * mean.size() != cov.size()) {
+      throw std::invalid_argument("Normal: covariance must be n x n");
+    }
+    Compact();
   }
-  /*! \brief Encode the distribution as a JSON object.
+
+  /*!
+   * \brief Constructor for a multivariate normal with a structured covariance
+   * \param [in] mean Mean vector
+   * \param [in] cov Covariance values, laid out according to form.
+   * \param [in] form The covariance form.
+   */
+  Normal(const std::vector<double> &mean, const std::vector<double> &cov,
+         Covariance form)
+      : mean_(mean), cov_(cov), form_(form) {
+    if (cov.size() != Size(mean.size(), form)) {
+      throw std::invalid_argument(
+          "Normal: covariance size does not match form");
+    }
+  }
+
+  std::size_t dim(void) const { return (mean_.size()); }
+  const std::vector<double> &mean(void) const { return (mean_); }
+  Covariance form(void) const { return (form_); }
+  /*! \brief The covariance values, laid out according to form(). */
+  const std::vector<double> &CompactCovariance(void) const { return (cov_); }
+
+  /*!
+   * \brief Covariance entry (i, j).
+   */
+  double cov(std::size_t i, std::size_t j) const {
+    return (Entry(cov_.data(), mean_.size(), form_, i, j));
+  }
+
+  /*!
+   * \brief Entry (i, j) of an n x n covariance laid out according to form.
+   */
+  static double Entry(const double *cov, std::size_t n, Covariance form,
+                      std::size_t i, std::size_t j) {
+    switch (form) {
+    case Covariance::kPacked:
+      return (i <= j ? cov[i + j * (j + 1) / 2] : cov[j + i * (i + 1) / 2]);
+    case Covariance::kDiagonal:
+      return (i == j ? cov[i] : 0.0);
+    case Covariance::kIsotropic:
+      return (i == j ? cov[0] : 0.0);
+    default:
+      return (cov[i + j * n]);
+    }
+  }
+
+  /*!
+   * \brief The full covariance matrix, in column-major order.
+   */
+  std::vector<double> DenseCovariance(void) const {
+    const std::size_t n = mean_.size();
+    std::vector<double> dense(n * n);
+    for (std::size_t j = 0; j < n; ++j) {
+      for (std::size_t i = 0; i < n; ++i) {
+        dense[i + j * n] = cov(i, j);
+      }
+    }
+    return (dense);
+  }
+
+  static bool FormFromName(const std::string &name, Covariance &form) {
+    for (Covariance f : {Covariance::kDense, Covariance::kPacked,
+                         Covariance::kDiagonal, Covariance::kIsotropic}) {
+      if (FormName(f) == name) {
+        form = f;
+        return (true);
+      }
+    }
+    return (false);
+  }
+
+  static std::string FormName(Covariance form) {
+    switch (form) {
+    case Covariance::kPacked:
+      return ("packed");
+    case Covariance::kDiagonal:
+      return ("diagonal");
+    case Covariance::kIsotropic:
+      return ("isotropic");
+    default:
+      return ("dense");
+    }
+  }
+
+  /*! \brief Encode the distribution as a JSON object, with the dense
+   *  covariance.
    *  \return The JSON-encoded distribution object.
    */
   json ToJson(void) const override {
     json j;
     j["distType"] = "MvNormal";
     j["mean"] = mean_;
-    j["cov"] = cov_;
+    j["cov"] = (Covariance::kDense == form_ ? cov_ : DenseCovariance());
     return (j);
   }
+
+  /*! \brief Stream the distribution, with the same layout as ToJson() unless
+   *  the writer accepts covariance forms. */
+  void Write(Writer &w) const override {
+    Write(w, mean_.data(), mean_.size(), cov_, form_);
+  }
+
+  /*!
+   * \brief Stream a normal distribution given by its parts, as Write() would.
+   * \param [in] w The writer.
+   * \param [in] mean The n values of the mean.
+   * \param [in] n The dimension.
+   * \param [in] cov The covariance values, laid out according to form.
+   * \param [in] form The covariance form.
+   */
+  static void Write(Writer &w, const double *mean, std::size_t n,
+                    const std::vector<double> &cov, Covariance form) {
+    Write(w, mean, n, cov.data(), cov.size(), form);
+  }
+
+  /*!
+   * \brief Stream a normal distribution given by its parts, as Write() would.
+   * \param [in] w The writer.
+   * \param [in] mean The n values of the mean.
+   * \param [in] n The dimension.
+   * \param [in] cov The covariance values, laid out according to form.
+   * \param [in] size The number of covariance values, Size(n, form).
+   * \param [in] form The covariance form.
+   */
+  static void Write(Writer &w, const double *mean, std::size_t n,
+                    const double *cov, std::size_t size, Covariance form) {
+    const bool dense = (Covariance::kDense == form);
+    const bool tagged = (!dense && w.covariance_forms());
+    w.BeginObject(tagged ? 4 : 3);
+    w.Key("cov");
+    if (dense || tagged) {
+      w.Array(cov, size);
+    } else { // expanded, for endpoints that only read dense covariances
+      w.BeginArray(n * n);
+      for (std::size_t j = 0; j < n; ++j) {
+        for (std::size_t i = 0; i < n; ++i) {
+          w.Double(Entry(cov, n, form, i, j));
+        }
+      }
+      w.EndArray();
+    }
+    if (tagged) {
+      w.Key("covType");
+      w.String(FormName(form));
+    }
+    w.Key("distType");
+    w.String("MvNormal");
+    w.Key("mean");
+    w.Array(mean, n);
+    w.EndObject();
+  }
 };
 
 /*!
  * \class SampleWeights
  * \brief An empirical univariate distribution defined by a set of samples and
  * associated weights.
+ *
+ * Large distributions (e.g. sonar range profiles) can be reduced before they
+ * are sent, see Reduce(): the endpoint would discard the low quantile anyway,
+ * and a few hundred samples usually describe the distribution well enough.
+ * The loops over the samples are written to be auto-vectorized.
  */
 class SampleWeights : public Distribution {
   std::vector<double> samples_;
   std::vector<double> weights_;
   double quantile_;
 
+  void CheckSizes(void) const {
+    if (samples_.size() != weights_.size()) {
+      throw std::invalid_argument(
+          "SampleWeights: samples and weights differ in size");
+    }
+  }
+
+  // sum of the weights, in independent partial sums so that it vectorizes
+  double Total(void) const {
+    const double *w = weights_.data();
+    const std::size_t n = weights_.size();
+    double sum[4] = {0.0, 0.0, 0.0, 0.0};
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      sum[0] += w[i];
+      sum[1] += w[i + 1];
+      sum[2] += w[i + 2];
+      sum[3] += w[i + 3];
+    }
+    for (; i < n; ++i) {
+      sum[0] += w[i];
+    }
+    return ((sum[0] + sum[1]) + (sum[2] + sum[3]));
+  }
+
 public:
   /*! \brief
    * \param [in] samples  A vector of samples
@@ -102,6 +409,188 @@ public:
                 const std::vector<double> &weights, const double &quantile)
       : samples_(samples), weights_(weights), quantile_(quantile) {}
 
+  const std::vector<double> &samples(void) const { return (samples_); }
+  const std::vector<double> &weights(void) const { return (weights_); }
+  double quantile(void) const { return (quantile_); }
+
+  /*!
+   * \brief Scale the weights so that they sum to one.
+   * \return false, leaving the weights untouched, if their sum is not
+   * positive and finite.
+   */
+  bool Normalize(void) {
+    const double total = Total();
+    if (!(total > 0.0) || !std::isfinite(total)) {
+      return (false);
+    }
+    const double scale = 1.0 / total;
+    double *w = weights_.data();
+    const std::size_t n = weights_.size();
+    for (std::size_t i = 0; i < n; ++i) {
+      w[i] *= scale;
+    }
+    return (true);
+  }
+
+  /*!
+   * \brief Apply the quantile() floor here, rather than on the endpoint, and
+   * set quantile() to zero. As the endpoint does, the quantile of the weights
+   * (linearly interpolated between order statistics) is subtracted from every
+   * weight, clamping at zero; the samples left without weight are dropped.
+   * The quantile is found by selection (linear time), not by sorting; the
+   * kept samples stay in order.
+   * \return The number of samples kept.
+   */
+  std::size_t Trim(void) {
+    CheckSizes();
+    const std::size_t n = weights_.size();
+    if (n > 0 && quantile_ > 0.0) {
+      const double q = (quantile_ < 1.0 ? quantile_ : 1.0);
+      std::vector<double> ranked(weights_);
+      const double h = q * (n - 1);
+      const std::size_t k = static_cast<std::size_t>(h);
+      std::nth_element(ranked.begin(), ranked.begin() + k, ranked.end());
+      double threshold = ranked[k];
+      if (k + 1 < n) { // the next order statistic is the least of the rest
+        const double next =
+            *std::min_element(ranked.begin() + k + 1, ranked.end());
+        threshold += (h - k) * (next - threshold);
+      }
+      // branch-free compaction
+      double *s = samples_.data();
+      double *w = weights_.data();
+      std::size_t kept = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        const double sample = s[i], weight = w[i] - threshold;
+        s[kept] = sample;
+        w[kept] = weight;
+        kept += (weight > 0.0 ? 1 : 0);
+      }
+      samples_.resize(kept);
+      weights_.resize(kept);
+    }
+    quantile_ = 0.0;
+    return (samples_.size());
+  }
+
+  /*!
+   * \brief Order the samples, with their weights, by value (as Decimate()
+   * expects).
+   */
+  void Sort(void) {
+    CheckSizes();
+    if (std::is_sorted(samples_.begin(), samples_.end())) {
+      return;
+    }
+    std::vector<std::pair<double, double>> pairs(samples_.size());
+    for (std::size_t i = 0; i < pairs.size(); ++i) {
+      pairs[i] = std::make_pair(samples_[i], weights_[i]);
+    }
+    std::sort(pairs.begin(), pairs.end());
+    for (std::size_t i = 0; i < pairs.size(); ++i) {
+      samples_[i] = pairs[i].first;
+      weights_[i] = pairs[i].second;
+    }
+  }
+
+  /*!
+   * \brief Merge runs of consecutive samples (e.g. adjacent range bins) so
+   * that at most max_samples remain. Each run is replaced by its weighted
+   * mean, weighted by the sum of its weights, so the total weight and the
+   * weighted mean of the distribution are preserved. Runs are taken in array
+   * order, so the samples must be sorted (see Sort()) for each run to hold
+   * neighbouring values.
+   * \param [in] max_samples The sample budget; 0 for no limit.
+   */
+  void Decimate(std::size_t max_samples) {
+    CheckSizes();
+    const std::size_t n = samples_.size();
+    if (0 == max_samples || n <= max_samples) {
+      return;
+    }
+    double *s = samples_.data();
+    double *w = weights_.data();
+    // max_samples runs of (nearly) equal length; run k only overwrites
+    // samples that runs before it have consumed
+    for (std::size_t k = 0; k < max_samples; ++k) {
+      const std::size_t begin = k * n / max_samples;
+      const std::size_t end = (k + 1) * n / max_samples;
+      double weight = 0.0, moment = 0.0, sum = 0.0;
+      for (std::size_t i = begin; i < end; ++i) {
+        weight += w[i];
+        moment += w[i] * s[i];
+        sum += s[i];
+      }
+      s[k] = (weight > 0.0 ? moment / weight : sum / (end - begin));
+      w[k] = weight;
+    }
+    samples_.resize(max_samples);
+    weights_.resize(max_samples);
+  }
+
+  /*!
+   * \brief Replace the samples by draws from the distribution (systematic
+   * resampling), merging repeated draws: at most n distinct samples remain,
+   * weighted by the fraction of draws that picked them.
+   * \param [in] n The number of draws.
+   * \param [in] seed Seed of the random offset of the draws; the same seed
+   * gives the same samples.
+   * \return false, leaving the samples untouched, if the weights do not have
+   * a positive, finite sum.
+   */
+  bool Resample(std::size_t n, uint32_t seed = 0) {
+    CheckSizes();
+    const double total = Total();
+    if (0 == n || !(total > 0.0) || !std::isfinite(total)) {
+      return (false);
+    }
+    std::mt19937 rng(seed);
+    const double step = total / n;
+    double target = std::uniform_real_distribution<double>(0.0, step)(rng);
+    double cumulative = 0.0;
+    std::size_t drawn = 0, kept = 0;
+    double *s = samples_.data();
+    double *w = weights_.data();
+    // the last sample that can be drawn takes any draws lost to rounding
+    std::size_t last = samples_.size() - 1;
+    while (last > 0 && !(w[last] > 0.0)) {
+      --last;
+    }
+    for (std::size_t i = 0; i <= last && drawn < n; ++i) {
+      cumulative = (i == last ? HUGE_VAL : cumulative + w[i]);
+      std::size_t draws = 0;
+      while (target < cumulative && drawn + draws < n) {
+        ++draws;
+        target += step;
+      }
+      if (draws) {
+        s[kept] = s[i];
+        w[kept] = static_cast<double>(draws) / n;
+        ++kept;
+        drawn += draws;
+      }
+    }
+    samples_.resize(kept);
+    weights_.resize(kept);
+    return (true);
+  }
+
+  /*!
+   * \brief Shrink the distribution before it is sent: Trim(), Normalize()
+   * and, if there are more samples than the budget, Sort() and Decimate().
+   * \param [in] max_samples The sample budget; 0 for no limit.
+   * \return The number of samples left.
+   */
+  std::size_t Reduce(std::size_t max_samples = 0) {
+    Trim();
+    Normalize();
+    if (max_samples > 0 && samples_.size() > max_samples) {
+      Sort();
+      Decimate(max_samples);
+    }
+    return (samples_.size());
+  }
+
   /*! \brief Encode the distribution as a JSON object.
    *  \return The JSON-encoded distribution object.
    */
@@ -113,122 +602,1672 @@ public:
     j["quantile"] = quantile_;
     return j;
   }
+
+  /*! \brief Stream the distribution, with the same layout as ToJson(). */
+  void Write(Writer &w) const override {
+    w.BeginObject(4);
+    w.Key("distType");
+    w.String("SampleWeights");
+    w.Key("quantile");
+    w.Double(quantile_);
+    w.Key("samples");
+    w.Array(samples_);
+    w.Key("weights");
+    w.Array(weights_);
+    w.EndObject();
+  }
 };
 
-// base class - captures a generic entity/object
-class Element {
-  std::string name_;
-  std::string type_;
+/*!
+ * \brief Decode a distribution from the layout written by its ToJson().
+ * \param [in] j The JSON-encoded distribution.
+ * \return The distribution, or nullptr if its distType is unknown.
+ * \throws std::invalid_argument (or a json exception) if it is malformed.
+ */
+inline std::unique_ptr<Distribution> DistributionFromJson(const json &j) {
+  auto type = j.find("distType");
+  if (type == j.end() || !type->is_string()) {
+    throw std::invalid_argument("distribution: missing distType");
+  }
+  if ("MvNormal" == *type) {
+    Normal::Covariance form = Normal::Covariance::kDense;
+    auto form_name = j.find("covType");
+    if (form_name == j.end()) { // dense: compacted again
+      return (std::unique_ptr<Distribution>(
+          new Normal(j.at("mean").get<std::vector<double>>(),
+                     j.at("cov").get<std::vector<double>>())));
+    }
+    if (!Normal::FormFromName(form_name->get<std::string>(), form)) {
+      throw std::invalid_argument("distribution: unknown covType");
+    }
+    return (std::unique_ptr<Distribution>(
+        new Normal(j.at("mean").get<std::vector<double>>(),
+                   j.at("cov").get<std::vector<double>>(), form)));
+  } else if ("SampleWeights" == *type) {
+    return (std::unique_ptr<Distribution>(new SampleWeights(
+        j.at("samples").get<std::vector<double>>(),
+        j.at("weights").get<std::vector<double>>(),
+        j.at("quantile").get<double>())));
+  }
+  return (nullptr);
+}
 
-public:
-  Element(const std::string &name, const std::string &type)
-      : name_(name), type_(type){};
-  virtual std::string name(void) const { return (name_); }
-  virtual std::string Type(void) const { return (type_); }
-  virtual void SetName(const std::string &name) { name_ = name; }
-  virtual ~Element(){};
-  virtual json ToJson(void) const {
-    json j;
-    j["label"] = name_;
-    j["type"] = type_;
-    return (j);
-  };
+/*!
+ * \struct NoiseModel graff.hpp
+ * \brief The covariance of normal measurements, registered once (locally and
+ * with the endpoint) and shared by the measurements that reference it (see
+ * NoiseModels).
+ */
+struct NoiseModel {
+  uint32_t id;       /*!< as registered with the endpoint */
+  Normal noise;      /*!< zero mean */
+  uint64_t registry; /*!< of the NoiseModels that made it, see Writer */
+  NoiseModel(uint32_t id, Normal noise, uint64_t registry)
+      : id(id), noise(std::move(noise)), registry(registry) {}
 };
 
 /*!
- * @class Endpoint
- * @brief The main class to handle connections to the Caesar endpoint.
+ * \class Measurement graff.hpp
+ * \brief A measurement distribution, held by value.
+ *
+ * Normal and SampleWeights distributions are stored inline (a tagged union),
+ * so a factor owns its measurements without a heap object per distribution,
+ * copies them with the factor, and serializes them without virtual calls. Any
+ * other Distribution subclass is held through a shared pointer.
+ *
+ * A normal measurement can also share a registered noise model, and only hold
+ * its mean (inline, up to kModeledDim values). It is then written as a
+ * reference to the model, {"mean", "model"}, to writers that accept the
+ * references of its registry (see Writer::SetModelReferences()), and in full
+ * otherwise; the mean is left out when it is zero.
  */
-class Endpoint {
-  zmq::context_t context_;
-  zmq::socket_t socket_;
-
+class Measurement {
 public:
-  Endpoint() : context_(1), socket_(context_, ZMQ_REQ) {}
+  enum class Kind { kNormal, kSampleWeights, kOther, kModeled };
 
-  void Connect(const std::string &address) { socket_.connect(address.c_str()); }
+  /*! \brief Largest mean held inline by a measurement with a noise model. */
+  static const std::size_t kModeledDim = 6;
 
-  void Disconnect(void) {}
+private:
+  // a normal measurement with a shared noise model
+  struct Modeled {
+    std::shared_ptr<const NoiseModel> model;
+    double mean[kModeledDim];
+  };
 
-  json SendRequest(const json &request) {
-    std::string request_str = request.dump(0);
-    zmq::message_t request_msg(request_str.length()), reply_msg;
+  Kind kind_;
+  union {
+    Normal normal_;
+    SampleWeights sample_weights_;
+    Modeled modeled_;
+  };
+  std::shared_ptr<const Distribution> other_;
 
-    memcpy(request_msg.data(), request_str.c_str(), request_str.length());
-    socket_.send(request_msg);
+  void Construct(const Measurement &other) {
+    switch (other.kind_) {
+    case Kind::kNormal:
+      new (&normal_) Normal(other.normal_);
+      break;
+    case Kind::kSampleWeights:
+      new (&sample_weights_) SampleWeights(other.sample_weights_);
+      break;
+    case Kind::kModeled:
+      new (&modeled_) Modeled(other.modeled_);
+      break;
+    default:
+      other_ = other.other_;
+    }
+    kind_ = other.kind_;
+  }
 
-    json reply;
-    if (!socket_.recv(&reply_msg)) {
-      std::cerr << "Something went wrong: " << toString(reply_msg) << "\n";
+  void Construct(Measurement &&other) {
+    switch (other.kind_) {
+    case Kind::kNormal:
+      new (&normal_) Normal(std::move(other.normal_));
+      break;
+    case Kind::kSampleWeights:
+      new (&sample_weights_) SampleWeights(std::move(other.sample_weights_));
+      break;
+    case Kind::kModeled:
+      new (&modeled_) Modeled(std::move(other.modeled_));
+      break;
+    default:
+      other_ = std::move(other.other_);
+    }
+    kind_ = other.kind_;
+  }
+
+  void Destroy(void) {
+    switch (kind_) {
+    case Kind::kNormal:
+      normal_.~Normal();
+      break;
+    case Kind::kSampleWeights:
+      sample_weights_.~SampleWeights();
+      break;
+    case Kind::kModeled:
+      modeled_.~Modeled();
+      break;
+    default:
+      other_.reset();
+    }
+  }
+
+public:
+  Measurement(const Normal &normal) : kind_(Kind::kNormal), normal_(normal) {}
+  Measurement(Normal &&normal)
+      : kind_(Kind::kNormal), normal_(std::move(normal)) {}
+  Measurement(const SampleWeights &sample_weights)
+      : kind_(Kind::kSampleWeights), sample_weights_(sample_weights) {}
+  Measurement(SampleWeights &&sample_weights)
+      : kind_(Kind::kSampleWeights),
+        sample_weights_(std::move(sample_weights)) {}
+
+  /*!
+   * \brief Take over a distribution; Normal and SampleWeights are moved into
+   * the measurement.
+   */
+  explicit Measurement(std::unique_ptr<Distribution> distribution)
+      : kind_(Kind::kOther) {
+    if (!distribution) {
+      throw std::invalid_argument("Measurement: null distribution");
+    }
+    if (Normal *normal = dynamic_cast<Normal *>(distribution.get())) {
+      new (&normal_) Normal(std::move(*normal));
+      kind_ = Kind::kNormal;
+    } else if (SampleWeights *sample_weights =
+                   dynamic_cast<SampleWeights *>(distribution.get())) {
+      new (&sample_weights_) SampleWeights(std::move(*sample_weights));
+      kind_ = Kind::kSampleWeights;
     } else {
-      reply = json::parse(toString(reply_msg));
+      other_ = std::shared_ptr<const Distribution>(std::move(distribution));
     }
-    return (reply);
-  };
+  }
 
-  json Status(void) {
-    json request;
-    request["type"] = "getStatus";
-    return (SendRequest(request));
+  /*!
+   * \brief A normal measurement with a registered noise model (see
+   * NoiseModels::Share()). A mean of more than kModeledDim values is held in
+   * a Normal instead.
+   * \param [in] mean The mean.
+   * \param [in] n Its dimension, that of the model.
+   * \param [in] model The noise model.
+   */
+  Measurement(const double *mean, std::size_t n,
+              std::shared_ptr<const NoiseModel> model)
+      : kind_(Kind::kModeled) {
+    if (!model || model->noise.dim() != n) {
+      throw std::invalid_argument(
+          "Measurement: mean does not match the noise model");
+    }
+    if (n > kModeledDim) {
+      new (&normal_) Normal(std::vector<double>(mean, mean + n),
+                            model->noise.CompactCovariance(),
+                            model->noise.form());
+      kind_ = Kind::kNormal;
+      return;
+    }
+    new (&modeled_) Modeled();
+    modeled_.model = std::move(model);
+    std::copy(mean, mean + n, modeled_.mean);
+  }
+
+  /*! \brief Share a distribution of another type. */
+  explicit Measurement(std::shared_ptr<const Distribution> distribution)
+      : kind_(Kind::kOther), other_(std::move(distribution)) {
+    if (!other_) {
+      throw std::invalid_argument("Measurement: null distribution");
+    }
+  }
+
+  Measurement(const Measurement &other) { Construct(other); }
+  Measurement(Measurement &&other) noexcept { Construct(std::move(other)); }
+  Measurement &operator=(const Measurement &other) {
+    if (this != &other) {
+      // copy first: if that throws, this measurement is left untouched
+      Measurement copy(other);
+      *this = std::move(copy);
+    }
+    return (*this);
+  }
+  Measurement &operator=(Measurement &&other) noexcept {
+    if (this != &other) {
+      Destroy();
+      Construct(std::move(other));
+    }
+    return (*this);
+  }
+  ~Measurement() { Destroy(); }
+
+  Kind kind(void) const { return (kind_); }
+  /*! \brief The normal distribution, or nullptr if it is of another kind. */
+  const Normal *normal(void) const {
+    return (Kind::kNormal == kind_ ? &normal_ : nullptr);
+  }
+  /*! \brief The sample set, or nullptr if it is of another kind. */
+  const SampleWeights *sample_weights(void) const {
+    return (Kind::kSampleWeights == kind_ ? &sample_weights_ : nullptr);
+  }
+  /*! \brief The noise model, or nullptr if the measurement has none. */
+  const NoiseModel *noise_model(void) const {
+    return (Kind::kModeled == kind_ ? modeled_.model.get() : nullptr);
+  }
+  /*! \brief The mean of a measurement with a noise model, or nullptr. */
+  const double *model_mean(void) const {
+    return (Kind::kModeled == kind_ ? modeled_.mean : nullptr);
+  }
+
+  /*!
+   * \brief The distribution; a measurement with a noise model has no
+   * distribution object (see ToJson()), and throws std::logic_error.
+   */
+  const Distribution &get(void) const {
+    switch (kind_) {
+    case Kind::kNormal:
+      return (normal_);
+    case Kind::kSampleWeights:
+      return (sample_weights_);
+    case Kind::kModeled:
+      throw std::logic_error("Measurement: a modeled measurement has no "
+                             "distribution object");
+    default:
+      return (*other_);
+    }
+  }
+
+  /*! \brief The distribution, in full (noise model included). */
+  json ToJson(void) const {
+    switch (kind_) {
+    case Kind::kNormal:
+      return (normal_.Normal::ToJson());
+    case Kind::kSampleWeights:
+      return (sample_weights_.SampleWeights::ToJson());
+    case Kind::kModeled: {
+      const Normal &noise = modeled_.model->noise;
+      return (Normal(std::vector<double>(modeled_.mean,
+                                         modeled_.mean + noise.dim()),
+                     noise.CompactCovariance(), noise.form())
+                  .ToJson());
+    }
+    default:
+      return (other_->ToJson());
+    }
+  }
+
+  void Write(Writer &w) const {
+    switch (kind_) {
+    case Kind::kNormal:
+      normal_.Normal::Write(w);
+      break;
+    case Kind::kSampleWeights:
+      sample_weights_.SampleWeights::Write(w);
+      break;
+    case Kind::kModeled:
+      WriteModeled(w);
+      break;
+    default:
+      other_->Write(w);
+    }
+  }
+
+private:
+  void WriteModeled(Writer &w) const {
+    const Normal &noise = modeled_.model->noise;
+    const std::size_t n = noise.dim();
+    if (w.model_references() != modeled_.model->registry) {
+      Normal::Write(w, modeled_.mean, n, noise.CompactCovariance(),
+                    noise.form());
+      return;
+    }
+    const bool zero = std::all_of(modeled_.mean, modeled_.mean + n,
+                                  [](double x) { return (0.0 == x); });
+    w.BeginObject(zero ? 1 : 2);
+    if (!zero) {
+      w.Key("mean");
+      w.Array(modeled_.mean, n);
+    }
+    w.Key("model");
+    w.Int(modeled_.model->id);
+    w.EndObject();
   }
 };
 
-/*!
- * @class
- * @brief
- */
-class Variable : public Element {
-  // not really much in here for now...
+// base class - captures a generic entity/object
+// the label is a Symbol and the type an interned string id, so elements are
+// cheap to copy and label strings are only built for serialization
+class Element {
+protected:
+  Symbol name_;
+  uint32_t type_;
+
 public:
-  Variable(const std::string &name, const std::string &type)
-      : Element(name, type) {}
-  json ToJson(void) const {
+  Element(const std::string &name, const std::string &type)
+      : name_(name), type_(SymbolTable::Instance().Intern(type)){};
+  Element(const Symbol &name, const std::string &type)
+      : name_(name), type_(SymbolTable::Instance().Intern(type)){};
+  /*! \brief Constructor from an interned type id, see SymbolTable. */
+  Element(const Symbol &name, uint32_t type) : name_(name), type_(type){};
+  virtual std::string name(void) const { return (name_.str()); }
+  const Symbol &symbol(void) const { return (name_); }
+  virtual const std::string &Type(void) const {
+    return (SymbolTable::Instance().Lookup(type_));
+  }
+  /*! \brief The interned id of the type. */
+  uint32_t TypeId(void) const { return (type_); }
+  virtual void SetName(const std::string &name) { name_ = Symbol(name); }
+  void SetName(const Symbol &name) { name_ = name; }
+  virtual ~Element(){};
+  virtual json ToJson(void) const {
     json j;
     j["label"] = name();
-    j["variableType"] = Type();
-    j["N"] = 0;
-    j["labels"] = {""};
+    j["type"] = Type();
     return (j);
+  };
+  virtual void Write(Writer &w) const {
+    w.BeginObject(2);
+    w.Key("label");
+    name_.Write(w);
+    w.Key("type");
+    w.String(Type());
+    w.EndObject();
   }
 };
 
 /*!
- * \class
- * \brief
+ * \brief Decode a reply.
+ * \param [in] body The reply body.
+ * \param [in] tag The preceding frame naming the format of a binary or
+ * compressed reply (see WireFormat), or nullptr for a JSON reply.
+ * \return The decoded reply.
  */
-class Factor : public Element {
-  // std::string type_;
-  std::vector<std::string> variables_;
-  // a factor can take either a single distribution or one distribution per
-  // measurement axis (e.g. priorpoint2 is a 2dof normal, but a RAE comprises 3
-  // distributions )
-  std::vector<graff::Distribution *> distribution_ptrs_;
+inline json DecodeReply(const zmq::message_t &body,
+                        const zmq::message_t *tag) {
+  WireFormat format;
+  if (tag && !WireFormat::Parse(toString(*tag), format)) {
+    std::cerr << "Unknown reply format: " << toString(*tag) << "\n";
+    return (json());
+  }
+  const char *data = static_cast<const char *>(body.data());
+  if (Compression::kNone != format.compression) {
+    std::string inflated;
+    Decompress(data, body.size(), format.compression, inflated);
+    return (Decode(inflated.data(), inflated.size(), format.encoding));
+  }
+  return (Decode(data, body.size(), format.encoding));
+}
 
-  static std::string cat(const std::vector<std::string> &v) {
-    // this creates a factor label according to the caesar convention
-    // concatenates the variable names, prepending them with an 'f'
-    std::string c("f");
-    for (unsigned int i = 0; i < v.size(); ++i) {
-      c += v[i];
+/*!
+ * \brief Reads a reply payload into a typed result; returns false if the
+ * payload does not have the expected shape.
+ */
+typedef std::function<bool(Reader &)> PayloadReader;
+
+/*!
+ * \brief Read a reply, handing its payload to a typed reader instead of
+ * decoding it into a json DOM.
+ *
+ * The payload is read straight from the message buffer (after
+ * decompression, if the reply is compressed). If the reader does not accept
+ * it, e.g. the error message of an error reply, it is decoded as usual.
+ *
+ * \param [in] body The reply body.
+ * \param [in] tag The preceding frame naming the format of a binary or
+ * compressed reply (see WireFormat), or nullptr for a JSON reply.
+ * \param [in] read The payload reader; it must read exactly one value.
+ * \return The reply, without its payload if the reader accepted it.
+ */
+inline json ReadReply(const zmq::message_t &body, const zmq::message_t *tag,
+                      const PayloadReader &read) {
+  WireFormat format;
+  if (tag && !WireFormat::Parse(toString(*tag), format)) {
+    std::cerr << "Unknown reply format: " << toString(*tag) << "\n";
+    return (json());
+  }
+  const char *data = static_cast<const char *>(body.data());
+  std::size_t size = body.size();
+  std::string inflated;
+  if (Compression::kNone != format.compression) {
+    Decompress(data, size, format.compression, inflated);
+    data = inflated.data();
+    size = inflated.size();
+  }
+  Reader reader(data, size, format.encoding);
+  json reply = json::object();
+  std::string key;
+  if (reader.BeginObject()) {
+    while (reader.Next() && reader.Key(key)) {
+      if ("payload" == key) {
+        const Reader start(reader);
+        if (!read(reader) || !reader.ok()) {
+          reader = start;
+          reader.Value(reply["payload"]);
+        }
+      } else {
+        reader.Value(reply[key]);
+      }
     }
-    return (c);
   }
+  if (!reader.ok()) {
+    return (Decode(data, size, format.encoding)); // throws, as DecodeReply()
+  }
+  return (reply);
+}
 
-public:
-  Factor(const std::string &type) : Element("", type) {}
-  Factor(const std::string &type, const std::string &variable)
-      : Element("", type), variables_({variable}) {}
-  Factor(const std::string &type, const std::vector<std::string> &variables)
-      : Element("", type), variables_(variables) {}
-  /*
-  Factor(const std::string &type, const std::string variable,
-         Distribution *distribution_ptr)
-      : Element(std::string("f" + variable), type), variables_({variable}),
-        distribution_ptrs_({distribution_ptr}) {}
-  // single variable, multiple measurement distributions
-  Factor(const std::string &type, const std::string variable,
-         std::vector<Distribution *> distribution_ptrs)
-      : Element(std::string("f" + variable), type), variables_({variable}),
+/*!
+ * \brief Send a request body, preceded by the frame naming its format if it
+ * is not plain JSON.
+ * \param [in] socket The socket, past any envelope frames.
+ * \param [in] body The encoded body; moved from.
+ * \param [in] encoding Its encoding.
+ * \param [in] compression The compression to use and accept in the reply, or
+ * Compression::kNone.
+ * \param [in] threshold Bodies shorter than this are sent uncompressed.
+ * \return The number of body bytes sent.
+ */
+inline std::size_t SendBody(zmq::socket_t &socket, zmq::message_t &body,
+                            Encoding encoding, Compression compression,
+                            std::size_t threshold) {
+  WireFormat format;
+  format.encoding = encoding;
+  format.accepted = compression;
+  std::string deflated;
+  if (Compression::kNone != compression && body.size() >= threshold &&
+      Compress(static_cast<const char *>(body.data()), body.size(),
+               compression, deflated)) {
+    format.compression = compression;
+    zmq::message_t compressed_msg(deflated.size());
+    memcpy(compressed_msg.data(), deflated.data(), deflated.size());
+    body.move(&compressed_msg);
+  }
+  if (format.tagged()) {
+    const std::string tag = format.Tag();
+    zmq::message_t tag_msg(tag.size());
+    memcpy(tag_msg.data(), tag.data(), tag.size());
+    socket.send(tag_msg, ZMQ_SNDMORE);
+  }
+  const std::size_t size = body.size();
+  socket.send(body);
+  return (size);
+}
+
+/*!
+ * \brief The label the endpoint assigned to an added element, if any.
+ */
+inline std::string ReplyLabel(const json &reply) {
+  auto payload = reply.find("payload");
+  return (payload != reply.end() && payload->is_string()
+              ? payload->get<std::string>()
+              : std::string());
+}
+
+/*!
+ * \brief Check whether a Status() reply advertises an encoding.
+ */
+inline bool SupportsEncoding(const json &status, Encoding encoding) {
+  if (Encoding::kJson == encoding) {
+    return (true);
+  }
+  if (!check(status)) {
+    return (false);
+  }
+  auto payload = status.find("payload");
+  if (payload == status.end() || !payload->is_object()) {
+    return (false);
+  }
+  auto encodings = payload->find("encodings");
+  if (encodings == payload->end() || !encodings->is_array()) {
+    return (false);
+  }
+  for (const json &name : *encodings) {
+    if (name == EncodingName(encoding)) {
+      return (true);
+    }
+  }
+  return (false);
+}
+
+/*!
+ * \brief Check whether a Status() reply advertises a compression.
+ */
+inline bool SupportsCompression(const json &status, Compression compression) {
+  if (Compression::kNone == compression) {
+    return (true);
+  }
+  if (!check(status)) {
+    return (false);
+  }
+  auto payload = status.find("payload");
+  if (payload == status.end() || !payload->is_object()) {
+    return (false);
+  }
+  auto compressions = payload->find("compressions");
+  if (compressions == payload->end() || !compressions->is_array()) {
+    return (false);
+  }
+  for (const json &name : *compressions) {
+    if (name == CompressionName(compression)) {
+      return (true);
+    }
+  }
+  return (false);
+}
+
+/*!
+ * \brief Check whether a Status() reply advertises an optional feature of the
+ * protocol, e.g. "covForms", as a true flag in its payload.
+ */
+inline bool SupportsFeature(const json &status, const char *feature) {
+  if (!check(status)) {
+    return (false);
+  }
+  auto payload = status.find("payload");
+  if (payload == status.end() || !payload->is_object()) {
+    return (false);
+  }
+  auto flag = payload->find(feature);
+  return (flag != payload->end() && flag->is_boolean() &&
+          flag->get<bool>());
+}
+
+/*!
+ * \brief Build the request sent by Status(), which advertises the encodings
+ * and compressions this client understands.
+ */
+inline json StatusRequest(void) {
+  json request;
+  request["request"] = "getStatus";
+  request["payload"]["encodings"] = {EncodingName(Encoding::kJson),
+                                     EncodingName(Encoding::kMsgPack),
+                                     EncodingName(Encoding::kCbor)};
+  request["payload"]["compressions"] = AvailableCompressions();
+  return (request);
+}
+
+/*!
+ * \brief A request buffer that is handed to ZeroMQ without copying.
+ *
+ * ZeroMQ calls Release() once it is done with the message, which may be
+ * after the reply has arrived (e.g. over inproc://, while the peer still
+ * holds the request). A buffer that the owner wants to drop while ZeroMQ
+ * still holds it is orphaned instead, and deleted on release.
+ */
+struct SendBuffer {
+  enum State { kIdle, kSent, kOrphaned };
+  Writer writer;
+  std::atomic<int> state;
+
+  SendBuffer() : state(kIdle) {}
+
+  static void Release(void * /* data */, void *hint) {
+    SendBuffer *buffer = static_cast<SendBuffer *>(hint);
+    if (kOrphaned == buffer->state.exchange(kIdle)) {
+      delete buffer;
+    }
+  }
+
+  /*!
+   * \brief Whether ZeroMQ has released the buffer, so that it can be reused.
+   */
+  bool idle(void) const { return (kIdle == state.load()); }
+
+  /*!
+   * \brief Take the buffer back from ZeroMQ.
+   * \return true if the buffer is idle and owned by the caller again; false if
+   * ZeroMQ still holds it, in which case it is now orphaned.
+   */
+  bool Reclaim(void) {
+    int expected = kSent;
+    return (!state.compare_exchange_strong(expected, kOrphaned));
+  }
+};
+
+/*!
+ * @class Endpoint
+ * @brief The main class to handle connections to the Caesar endpoint.
+ *
+ * Requests are JSON text by default. Binary-encoded requests (see Negotiate)
+ * are sent as two frames, the encoding name followed by the body, and are
+ * answered in the same way. With compression (see NegotiateCompression),
+ * requests and replies above a size threshold are compressed, and the first
+ * frame also names the compression (see WireFormat).
+ *
+ * Events published by the endpoint (solve progress and estimate updates) are
+ * received on a separate SUB socket, see Subscribe(). Each event is a topic
+ * frame holding the session name, then the event body, optionally preceded
+ * by its encoding name as for replies.
+ *
+ * By default a request waits for its reply indefinitely. With SetTimeout(),
+ * a request that is not answered in time gets an ERROR reply instead, and
+ * the socket is closed and reopened (the "lazy pirate" pattern), since a REQ
+ * socket cannot send again before it has received a reply. Requests that are
+ * safe to repeat (see Idempotent()) are retried on the new socket. Read-only
+ * queries can also be hedged across replicas (see AddReplica()): if the
+ * endpoint has not answered after the hedge delay, the query is also sent to
+ * every replica, and the first reply wins.
+ */
+class Endpoint {
+  std::unique_ptr<zmq::context_t> own_context_; /*!< unless one is shared */
+  zmq::context_t *context_;
+  zmq::socket_t socket_;
+  std::vector<std::string> addresses_; /*!< to reconnect socket_ */
+  std::unique_ptr<zmq::socket_t> events_; /*!< SUB socket, once subscribed */
+  std::string topic_;
+  Encoding encoding_;
+  Compression compression_;
+  std::size_t compression_threshold_; /*!< smallest request compressed */
+  bool covariance_forms_;     /*!< see NegotiateCovarianceForms() */
+  bool batch_checked_;        /*!< whether batch_ is known, see Batches() */
+  bool batch_;
+  SendBuffer *buffer_;        /*!< reusable buffer for streamed requests */
+  std::vector<SendBuffer *> buffers_; /*!< all of them, see BeginRequest() */
+  const char *request_name_; /*!< name of the streamed request */
+  long timeout_ms_;           /*!< per attempt; -1 waits forever */
+  int retries_;               /*!< extra attempts for idempotent requests */
+  std::vector<std::string> replica_addresses_;
+  std::vector<std::unique_ptr<zmq::socket_t>> replicas_;
+  long hedge_ms_; /*!< delay before a read-only query goes to the replicas */
+  bool instrumented_;
+  std::unordered_map<std::string, RequestStats> stats_; /*!< by request */
+  RequestStats *current_; /*!< of the request in progress, if instrumented */
+  const PayloadReader *payload_reader_; /*!< of the request in progress */
+  std::chrono::steady_clock::time_point begun_; /*!< of the streamed request */
+
+  // send a request, preceded by its format if not plain JSON
+  void Send(zmq::socket_t &socket, zmq::message_t &request_msg) {
+    const std::size_t sent = SendBody(socket, request_msg, encoding_,
+                                      compression_, compression_threshold_);
+    if (current_) {
+      current_->bytes_sent += sent;
+    }
+  }
+
+  // read the reply waiting on a socket, for a request sent at a given time
+  json Receive(zmq::socket_t &socket,
+               std::chrono::steady_clock::time_point sent) {
+    typedef std::chrono::steady_clock clock;
+    zmq::message_t reply_msg, tag_msg;
+    json reply;
+    const bool received = socket.recv(&reply_msg);
+    const bool tagged = (received && reply_msg.more());
+    if (tagged) {
+      tag_msg.copy(&reply_msg);
+      socket.recv(&reply_msg);
+    }
+    const clock::time_point arrived = clock::now();
+    if (!received) {
+      std::cerr << "Something went wrong: " << toString(reply_msg) << "\n";
+    } else {
+      reply = (payload_reader_
+                   ? ReadReply(reply_msg, tagged ? &tag_msg : nullptr,
+                               *payload_reader_)
+                   : DecodeReply(reply_msg, tagged ? &tag_msg : nullptr));
+    }
+    if (current_) {
+      current_->bytes_received += reply_msg.size();
+      current_->round_trip.Record(arrived - sent);
+      current_->parse.Record(clock::now() - arrived);
+    }
+    return (reply);
+  }
+
+  // discard a socket that is waiting for a reply, and open a fresh one
+  void Reset(zmq::socket_t &socket,
+             const std::vector<std::string> &addresses) {
+    int linger = 0;
+    socket.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+    socket = zmq::socket_t(*context_, ZMQ_REQ);
+    for (const std::string &address : addresses) {
+      socket.connect(address.c_str());
+    }
+  }
+
+  // wait for the reply to a read-only query on the socket, and send the
+  // query to the replicas too once the hedge delay has passed
+  bool ReceiveHedged(const char *data, std::size_t size,
+                     std::chrono::steady_clock::time_point sent,
+                     json &reply) {
+    std::vector<zmq::pollitem_t> items(1 + replicas_.size());
+    items[0] = {static_cast<void *>(socket_), 0, ZMQ_POLLIN, 0};
+    const bool hedge = (timeout_ms_ < 0 || hedge_ms_ < timeout_ms_);
+    if (zmq::poll(&items[0], 1, hedge ? hedge_ms_ : timeout_ms_) > 0) {
+      reply = Receive(socket_, sent);
+      return (true);
+    }
+    if (!hedge) {
+      return (false);
+    }
+    for (std::size_t i = 0; i < replicas_.size(); ++i) {
+      zmq::message_t copy(size);
+      memcpy(copy.data(), data, size);
+      Send(*replicas_[i], copy);
+      items[i + 1] = {static_cast<void *>(*replicas_[i]), 0, ZMQ_POLLIN, 0};
+    }
+    std::size_t winner = items.size();
+    if (zmq::poll(&items[0], static_cast<int>(items.size()),
+                  timeout_ms_ < 0 ? -1 : timeout_ms_ - hedge_ms_) > 0) {
+      for (winner = 0; winner < items.size(); ++winner) {
+        if (items[winner].revents & ZMQ_POLLIN) {
+          break;
+        }
+      }
+    }
+    const bool received = (winner < items.size());
+    if (received) {
+      reply = Receive(0 == winner ? socket_ : *replicas_[winner - 1], sent);
+    }
+    // the others still owe a reply
+    for (std::size_t i = 0; i < replicas_.size(); ++i) {
+      if (i + 1 != winner) {
+        Reset(*replicas_[i], {replica_addresses_[i]});
+      }
+    }
+    if (received && 0 != winner) {
+      Reset(socket_, addresses_);
+    }
+    return (received);
+  }
+
+  // send a request and wait for the reply, within the timeout and retries
+  json Exchange(zmq::message_t &request_msg, const char *data,
+                std::size_t size, const std::string &name,
+                std::chrono::steady_clock::duration serialized) {
+    typedef std::chrono::steady_clock clock;
+    current_ = nullptr;
+    if (instrumented_) {
+      current_ = &stats_[name.empty() ? std::string("(unnamed)") : name];
+      ++current_->count;
+      current_->serialize.Record(serialized);
+    }
+    const bool retry = Idempotent(name);
+    const bool hedge = (!replicas_.empty() && ReadOnly(name));
+    json reply;
+    int attempt = 0;
+    bool received = false;
+    while (!received) {
+      const clock::time_point sent = clock::now();
+      if (0 == attempt) {
+        Send(socket_, request_msg);
+      } else {
+        zmq::message_t copy(size);
+        memcpy(copy.data(), data, size);
+        Send(socket_, copy);
+      }
+      if (hedge) {
+        received = ReceiveHedged(data, size, sent, reply);
+      } else {
+        zmq::pollitem_t items[] = {
+            {static_cast<void *>(socket_), 0, ZMQ_POLLIN, 0}};
+        if (timeout_ms_ < 0 || zmq::poll(items, 1, timeout_ms_) > 0) {
+          reply = Receive(socket_, sent);
+          received = true;
+        }
+      }
+      if (!received) {
+        if (current_) {
+          ++current_->timeouts;
+        }
+        Reset(socket_, addresses_);
+        if (!retry || attempt >= retries_) {
+          reply["status"] = "ERROR";
+          reply["payload"] = name + ": no reply after " +
+                             std::to_string(attempt + 1) + " attempt(s) of " +
+                             std::to_string(timeout_ms_) + " ms";
+          break;
+        }
+        ++attempt;
+      }
+    }
+    if (current_ && !check(reply)) {
+      ++current_->errors;
+    }
+    current_ = nullptr;
+    return (reply);
+  }
+
+public:
+  Endpoint()
+      : own_context_(new zmq::context_t(1)), context_(own_context_.get()),
+        socket_(*own_context_, ZMQ_REQ), encoding_(Encoding::kJson),
+        compression_(Compression::kNone),
+        compression_threshold_(kCompressionThreshold),
+        covariance_forms_(false), batch_checked_(false), batch_(false),
+        buffer_(new SendBuffer()), buffers_(1, buffer_), request_name_(""),
+        timeout_ms_(-1), retries_(0), hedge_ms_(10), instrumented_(true),
+        current_(nullptr), payload_reader_(nullptr) {}
+
+  /*!
+   * \brief Constructor sharing a ZeroMQ context, e.g. to reach an endpoint
+   * running in the same process over inproc://.
+   * \param [in] context The context; must outlive the endpoint.
+   */
+  explicit Endpoint(zmq::context_t &context)
+      : context_(&context), socket_(context, ZMQ_REQ),
+        encoding_(Encoding::kJson), compression_(Compression::kNone),
+        compression_threshold_(kCompressionThreshold),
+        covariance_forms_(false), batch_checked_(false), batch_(false),
+        buffer_(new SendBuffer()), buffers_(1, buffer_), request_name_(""),
+        timeout_ms_(-1), retries_(0), hedge_ms_(10), instrumented_(true),
+        current_(nullptr), payload_reader_(nullptr) {}
+
+  ~Endpoint() {
+    for (SendBuffer *buffer : buffers_) {
+      if (buffer->Reclaim()) {
+        delete buffer;
+      }
+    }
+  }
+
+  Endpoint(const Endpoint &) = delete;
+  Endpoint &operator=(const Endpoint &) = delete;
+
+  void Connect(const std::string &address) {
+    socket_.connect(address.c_str());
+    addresses_.push_back(address);
+  }
+
+  /*!
+   * \brief Bound the time requests wait for their reply.
+   * \param [in] timeout_ms How long each attempt waits (-1 waits forever).
+   * \param [in] retries How many more attempts idempotent requests get.
+   */
+  void SetTimeout(long timeout_ms, int retries = 0) {
+    timeout_ms_ = timeout_ms;
+    retries_ = (retries > 0 ? retries : 0);
+  }
+
+  long timeout(void) const { return (timeout_ms_); }
+  int retries(void) const { return (retries_); }
+
+  /*!
+   * \brief Add a replica of the endpoint (one serving the same sessions) to
+   * hedge read-only queries across.
+   */
+  void AddReplica(const std::string &address) {
+    replicas_.emplace_back(new zmq::socket_t(*context_, ZMQ_REQ));
+    replicas_.back()->connect(address.c_str());
+    replica_addresses_.push_back(address);
+  }
+
+  /*!
+   * \brief How long a read-only query waits for the endpoint before it is
+   * also sent to the replicas (10 ms by default).
+   */
+  void SetHedgeDelay(long delay_ms) {
+    hedge_ms_ = (delay_ms > 0 ? delay_ms : 0);
+  }
+
+  /*!
+   * \brief Whether a request only reads from the endpoint, so that it can be
+   * sent to replicas.
+   */
+  static bool ReadOnly(const std::string &request) {
+    static const char *names[] = {"getStatus",     "getEstimates",
+                                  "GetVarMAPMean", "GetVarMAPMax",
+                                  "GetVarMAPKDE",  "GetVarsMAP",
+                                  "ls",            "varQuery"};
+    for (const char *name : names) {
+      if (request == name) {
+        return (true);
+      }
+    }
+    return (false);
+  }
+
+  /*!
+   * \brief Whether a request can be sent again without changing its outcome,
+   * so that it is retried after a timeout.
+   */
+  static bool Idempotent(const std::string &request) {
+    return (ReadOnly(request) || "registerRobot" == request ||
+            "registerSession" == request);
+  }
+
+  /*!
+   * \brief Turn the per-request counters on (the default) or off.
+   */
+  void SetInstrumented(bool instrumented) { instrumented_ = instrumented; }
+
+  /*!
+   * \brief The counters of a request type, or nullptr if none was sent.
+   */
+  const RequestStats *FindStats(const std::string &request) const {
+    auto it = stats_.find(request);
+    return (it == stats_.end() ? nullptr : &it->second);
+  }
+
+  /*!
+   * \brief Snapshot of the counters of every request type sent so far, by
+   * request name: counts, bytes, and serialization, round-trip and reply
+   * parsing time histograms.
+   */
+  json Stats(void) const {
+    json j = json::object();
+    for (const auto &entry : stats_) {
+      j[entry.first] = entry.second.ToJson();
+    }
+    return (j);
+  }
+
+  void ResetStats(void) { stats_.clear(); }
+
+  void Disconnect(void) {}
+
+  /*!
+   * \brief Subscribe to the events the endpoint publishes for a session.
+   *
+   * Subscribe before requesting a solve, or its first events may be missed.
+   *
+   * \param [in] address The address of the endpoint's event publisher.
+   * \param [in] session The session name, or "" for the events of all
+   * sessions.
+   */
+  void Subscribe(const std::string &address, const std::string &session) {
+    if (!events_) {
+      events_.reset(new zmq::socket_t(*context_, ZMQ_SUB));
+    } else {
+      events_->setsockopt(ZMQ_UNSUBSCRIBE, topic_.data(), topic_.size());
+    }
+    topic_ = session;
+    events_->setsockopt(ZMQ_SUBSCRIBE, topic_.data(), topic_.size());
+    events_->connect(address.c_str());
+  }
+
+  /*!
+   * \brief Subscribe to the events of a session at the address the endpoint
+   * advertises in its status ("events"), if it publishes any.
+   * \param [in] session The session name, or "" for all sessions.
+   * \return false, without subscribing, if the endpoint advertises no event
+   * publisher; WaitForSolve() then polls for the estimates instead.
+   */
+  bool Subscribe(const std::string &session) {
+    json status = Status();
+    if (!check(status) || !status["payload"].is_object()) {
+      return (false);
+    }
+    auto address = status["payload"].find("events");
+    if (address == status["payload"].end() || !address->is_string() ||
+        address->get<std::string>().empty()) {
+      return (false);
+    }
+    Subscribe(address->get<std::string>(), session);
+    return (true);
+  }
+
+  bool Subscribed(void) const { return (static_cast<bool>(events_)); }
+
+  /*!
+   * \brief Receive the next event.
+   * \param [out] event The decoded event.
+   * \param [in] timeout_ms How long to wait for it (-1 waits forever).
+   * \return false if no event arrived in time, or if not subscribed.
+   */
+  bool NextEvent(json &event, long timeout_ms) {
+    if (!events_) {
+      return (false);
+    }
+    typedef std::chrono::steady_clock clock;
+    const clock::time_point deadline =
+        clock::now() + std::chrono::milliseconds(timeout_ms);
+    zmq::pollitem_t items[] = {
+        {static_cast<void *>(*events_), 0, ZMQ_POLLIN, 0}};
+    long remaining = timeout_ms;
+    while (zmq::poll(items, 1, remaining) > 0) {
+      std::vector<zmq::message_t> frames(1);
+      events_->recv(&frames[0]);
+      while (frames.back().more()) {
+        frames.emplace_back();
+        events_->recv(&frames.back());
+      }
+      // subscriptions match by prefix, so a topic may be another session's
+      if (frames.size() >= 2 && frames.size() <= 3 &&
+          (topic_.empty() || toString(frames[0]) == topic_)) {
+        event = DecodeReply(frames.back(),
+                            (3 == frames.size() ? &frames[1] : nullptr));
+        return (true);
+      }
+      if (timeout_ms >= 0) {
+        remaining = static_cast<long>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - clock::now())
+                .count());
+        if (remaining <= 0) {
+          break;
+        }
+      }
+    }
+    return (false);
+  }
+
+  Encoding encoding(void) const { return (encoding_); }
+
+  /*!
+   * \brief Force the wire encoding, without consulting the endpoint.
+   */
+  void SetEncoding(Encoding encoding) { encoding_ = encoding; }
+
+  /*!
+   * \brief Switch to the preferred wire encoding if the endpoint advertises
+   * it in its status, otherwise fall back to JSON.
+   * \param [in] preferred The preferred encoding.
+   * \return true if the preferred encoding is now in use.
+   */
+  bool Negotiate(Encoding preferred) {
+    encoding_ = Encoding::kJson;
+    if (SupportsEncoding(Status(), preferred)) {
+      encoding_ = preferred;
+    }
+    return (encoding_ == preferred);
+  }
+
+  Compression compression(void) const { return (compression_); }
+  std::size_t compression_threshold(void) const {
+    return (compression_threshold_);
+  }
+
+  /*!
+   * \brief Force the compression, without consulting the endpoint.
+   * \param [in] compression The compression, or Compression::kNone.
+   * \param [in] threshold Requests shorter than this (in bytes, once encoded)
+   * are sent uncompressed.
+   */
+  void SetCompression(Compression compression,
+                      std::size_t threshold = kCompressionThreshold) {
+    compression_ =
+        (CompressionAvailable(compression) ? compression : Compression::kNone);
+    compression_threshold_ = threshold;
+  }
+
+  /*!
+   * \brief Compress requests and replies (above a size threshold) if both
+   * this build and the endpoint support the preferred compression. Worth it
+   * on slow links (acoustic modems, satellite backhaul), where bandwidth
+   * costs more than the CPU time.
+   * \param [in] preferred The preferred compression.
+   * \param [in] threshold Requests shorter than this are sent uncompressed.
+   * \return true if the preferred compression is now in use.
+   */
+  bool NegotiateCompression(Compression preferred,
+                            std::size_t threshold = kCompressionThreshold) {
+    SetCompression(Compression::kNone, threshold);
+    if (CompressionAvailable(preferred) &&
+        SupportsCompression(Status(), preferred)) {
+      compression_ = preferred;
+    }
+    return (compression_ == preferred);
+  }
+
+  bool covariance_forms(void) const { return (covariance_forms_); }
+
+  /*!
+   * \brief Force whether structured covariances are sent in their compact
+   * form (see Writer::SetCovarianceForms()), without consulting the endpoint.
+   */
+  void SetCovarianceForms(bool forms) { covariance_forms_ = forms; }
+
+  /*!
+   * \brief Send structured covariances in their compact form if the endpoint
+   * advertises "covForms" in its status; otherwise they are sent dense.
+   * \return true if compact covariances are now sent.
+   */
+  bool NegotiateCovarianceForms(void) {
+    covariance_forms_ = SupportsFeature(Status(), "covForms");
+    return (covariance_forms_);
+  }
+
+  /*!
+   * \brief Whether the endpoint accepts "batch" requests, i.e. advertises
+   * "batch" in its status; asked once, when first needed. Batch::Submit()
+   * falls back to one request per element otherwise.
+   */
+  bool Batches(void) {
+    if (!batch_checked_) {
+      json status = Status();
+      batch_checked_ = check(status); // asked again if the status failed
+      batch_ = SupportsFeature(status, "batch");
+    }
+    return (batch_);
+  }
+
+  /*!
+   * \brief Force whether "batch" requests are sent, without consulting the
+   * endpoint.
+   */
+  void SetBatches(bool batches) {
+    batch_checked_ = true;
+    batch_ = batches;
+  }
+
+  json SendRequest(const json &request) {
+    typedef std::chrono::steady_clock clock;
+    auto name = request.find("request");
+    const clock::time_point begun = clock::now();
+    const std::string request_str = Encode(request, encoding_);
+    const clock::duration serialized = clock::now() - begun;
+    zmq::message_t request_msg(request_str.length());
+    memcpy(request_msg.data(), request_str.c_str(), request_str.length());
+    return (Exchange(request_msg, request_str.data(), request_str.size(),
+                     (name != request.end() && name->is_string()
+                          ? name->get<std::string>()
+                          : std::string()),
+                     serialized));
+  }
+
+  /*!
+   * \brief Send a request with a deadline of its own.
+   * \param [in] request The request.
+   * \param [in] timeout_ms How long each attempt waits (-1 waits forever).
+   */
+  json SendRequest(const json &request, long timeout_ms) {
+    const long timeout_ms_saved = timeout_ms_;
+    timeout_ms_ = timeout_ms;
+    json reply = SendRequest(request);
+    timeout_ms_ = timeout_ms_saved;
+    return (reply);
+  }
+
+  /*!
+   * \brief Send a request, and read the reply payload straight from the
+   * message into a typed result, without building a json DOM for it.
+   *
+   * \code
+   *   std::vector<double> mean;
+   *   json reply = ep.SendRequest(
+   *       request, [&mean](graff::Reader &r) { return (r.Doubles(mean)); });
+   * \endcode
+   *
+   * \param [in] request The request.
+   * \param [in] read Reads the payload (see ReadReply()).
+   * \return The reply, without its payload if read accepted it.
+   */
+  json SendRequest(const json &request, const PayloadReader &read) {
+    payload_reader_ = &read;
+    try {
+      json reply = SendRequest(request);
+      payload_reader_ = nullptr;
+      return (reply);
+    } catch (...) {
+      payload_reader_ = nullptr;
+      throw;
+    }
+  }
+
+  /*!
+   * \brief Send an already-encoded request and wait for the reply.
+   * \param [in] request_str The request, encoded with encoding().
+   * \param [in] name The request name, which decides whether it is retried
+   * or hedged; neither if empty.
+   * \return The endpoint reply as a json object.
+   */
+  json SendRaw(const std::string &request_str,
+               const std::string &name = std::string()) {
+    zmq::message_t request_msg(request_str.length());
+    memcpy(request_msg.data(), request_str.c_str(), request_str.length());
+    return (Exchange(request_msg, request_str.data(), request_str.size(),
+                     name, std::chrono::steady_clock::duration::zero()));
+  };
+
+  /*!
+   * \brief Start a streamed request: its payload is written directly into a
+   * reusable buffer, which EndRequest() hands to ZeroMQ without copying. If
+   * ZeroMQ still holds the last buffer, another one it has released is used,
+   * so that buffers keep their capacity rather than being regrown.
+   *
+   * \code
+   *   f.Write(ep.BeginRequest("addFactor"));
+   *   json reply = ep.EndRequest();
+   * \endcode
+   *
+   * \param [in] name The request name; must outlive the request.
+   * \return The writer to stream exactly one payload value into.
+   */
+  Writer &BeginRequest(const char *name) {
+    if (!buffer_->idle()) {
+      buffer_ = nullptr;
+      for (SendBuffer *buffer : buffers_) {
+        if (buffer->idle()) {
+          buffer_ = buffer;
+          break;
+        }
+      }
+      if (!buffer_) {
+        buffer_ = new SendBuffer(); // ZeroMQ still holds all the others
+        buffers_.push_back(buffer_);
+      }
+    }
+    request_name_ = name;
+    begun_ = std::chrono::steady_clock::now();
+    Writer &w = buffer_->writer;
+    w.Clear(encoding_);
+    w.SetCovarianceForms(covariance_forms_);
+    w.BeginObject(2);
+    w.Key("payload");
+    return (w);
+  }
+
+  /*!
+   * \brief Send the request started by BeginRequest() and wait for the reply.
+   * \return The endpoint reply as a json object.
+   */
+  json EndRequest(void) {
+    Writer &w = buffer_->writer;
+    w.Key("request");
+    w.String(request_name_);
+    w.EndObject();
+    buffer_->state = SendBuffer::kSent;
+    zmq::message_t request_msg(w.data(), w.size(), SendBuffer::Release,
+                               buffer_);
+    return (Exchange(request_msg, w.data(), w.size(), request_name_,
+                     std::chrono::steady_clock::now() - begun_));
+  }
+
+  /*!
+   * \brief Query the endpoint status. The request advertises the encodings
+   * this client understands, and the reply lists those of the endpoint.
+   */
+  json Status(void) { return (SendRequest(StatusRequest())); }
+};
+
+/*!
+ * @class AsyncEndpoint
+ * @brief A pipelined connection to the Caesar endpoint.
+ *
+ * Unlike Endpoint, many requests can be in flight at once. Requests are sent
+ * over a DEALER socket prefixed with an envelope frame holding a request id;
+ * the endpoint (REP or ROUTER) echoes the envelope back, which is how replies
+ * are matched to their completion callbacks. Replies are only read while
+ * Poll() or Wait() run, so these (and any future.get()) must be called from
+ * the thread that owns the endpoint.
+ *
+ * By default a request waits for its reply indefinitely. With SetTimeout(),
+ * a request that is not answered in time is completed with an ERROR reply
+ * (and a late reply is discarded), so that a lost reply or a dead endpoint
+ * cannot hold a slot forever and block the sender once max_in_flight
+ * requests are pending.
+ */
+class AsyncEndpoint {
+public:
+  typedef std::function<void(const json &)> Callback;
+
+private:
+  std::unique_ptr<zmq::context_t> own_context_; /*!< unless one is shared */
+  zmq::socket_t socket_;
+  Encoding encoding_;
+  Compression compression_;
+  std::size_t compression_threshold_; /*!< smallest request compressed */
+  bool covariance_forms_; /*!< see Endpoint::NegotiateCovarianceForms() */
+  uint64_t next_id_;
+  std::size_t max_in_flight_;
+  long timeout_ms_; /*!< per request; -1 waits forever */
+  struct Pending {
+    Callback callback;
+    std::chrono::steady_clock::time_point deadline; /*!< max() if none */
+    long timeout_ms;
+  };
+  std::unordered_map<uint64_t, Pending> pending_;
+  Writer writer_;            /*!< reusable buffer for streamed requests */
+  const char *request_name_; /*!< name of the streamed request */
+
+  // read one reply (if available) and dispatch it; returns false when there
+  // is nothing left to read
+  bool Dispatch(void) {
+    std::vector<zmq::message_t> frames(1);
+    if (!socket_.recv(&frames[0], ZMQ_DONTWAIT)) {
+      return (false);
+    }
+    while (frames.back().more()) {
+      frames.emplace_back();
+      socket_.recv(&frames.back());
+    }
+    // frames are: request id, empty delimiter, [format,] reply
+    if (frames.size() < 3 || frames.size() > 4 ||
+        frames[0].size() != sizeof(uint64_t)) {
+      std::cerr << "Discarding reply with malformed envelope\n";
+      return (true);
+    }
+    uint64_t id;
+    memcpy(&id, frames[0].data(), sizeof(id));
+    auto it = pending_.find(id);
+    if (it == pending_.end()) {
+      std::cerr << "Discarding reply to unknown request " << id << "\n";
+      return (true);
+    }
+    Callback callback = it->second.callback;
+    pending_.erase(it);
+    json reply =
+        DecodeReply(frames.back(), frames.size() == 4 ? &frames[2] : nullptr);
+    if (callback) {
+      callback(reply);
+    }
+    return (true);
+  }
+
+  // the earliest deadline of the pending requests
+  std::chrono::steady_clock::time_point Deadline(void) const {
+    std::chrono::steady_clock::time_point earliest =
+        std::chrono::steady_clock::time_point::max();
+    for (const auto &pending : pending_) {
+      earliest = std::min(earliest, pending.second.deadline);
+    }
+    return (earliest);
+  }
+
+  // complete the requests past their deadline with an ERROR reply; returns
+  // how many
+  std::size_t Expire(void) {
+    const std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    std::vector<Pending> expired;
+    for (auto it = pending_.begin(); it != pending_.end();) {
+      if (it->second.deadline <= now) {
+        expired.push_back(std::move(it->second));
+        it = pending_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    // callbacks may send more requests, so run them once pending_ is settled
+    for (const Pending &pending : expired) {
+      if (pending.callback) {
+        json reply;
+        reply["status"] = "ERROR";
+        reply["payload"] = "no reply after " +
+                           std::to_string(pending.timeout_ms) + " ms";
+        pending.callback(reply);
+      }
+    }
+    return (expired.size());
+  }
+
+public:
+  /*!
+   * \brief Constructor
+   * \param [in] max_in_flight Maximum number of outstanding requests; sending
+   * beyond it blocks until a reply arrives or a request times out.
+   */
+  AsyncEndpoint(std::size_t max_in_flight = 64)
+      : own_context_(new zmq::context_t(1)),
+        socket_(*own_context_, ZMQ_DEALER), encoding_(Encoding::kJson),
+        compression_(Compression::kNone),
+        compression_threshold_(kCompressionThreshold),
+        covariance_forms_(false), next_id_(0),
+        max_in_flight_(max_in_flight > 0 ? max_in_flight : 1),
+        timeout_ms_(-1), request_name_("") {}
+
+  /*!
+   * \brief Constructor sharing a ZeroMQ context (see Endpoint).
+   * \param [in] context The context; must outlive the endpoint.
+   * \param [in] max_in_flight Maximum number of outstanding requests.
+   */
+  AsyncEndpoint(zmq::context_t &context, std::size_t max_in_flight = 64)
+      : socket_(context, ZMQ_DEALER), encoding_(Encoding::kJson),
+        compression_(Compression::kNone),
+        compression_threshold_(kCompressionThreshold),
+        covariance_forms_(false), next_id_(0),
+        max_in_flight_(max_in_flight > 0 ? max_in_flight : 1),
+        timeout_ms_(-1), request_name_("") {}
+
+  void Connect(const std::string &address) { socket_.connect(address.c_str()); }
+
+  Encoding encoding(void) const { return (encoding_); }
+
+  /*!
+   * \brief Set the wire encoding (see Endpoint::Negotiate); only affects
+   * requests sent afterwards.
+   */
+  void SetEncoding(Encoding encoding) { encoding_ = encoding; }
+
+  Compression compression(void) const { return (compression_); }
+
+  /*!
+   * \brief Set the compression (see Endpoint::NegotiateCompression); only
+   * affects requests sent afterwards.
+   */
+  void SetCompression(Compression compression,
+                      std::size_t threshold = kCompressionThreshold) {
+    compression_ =
+        (CompressionAvailable(compression) ? compression : Compression::kNone);
+    compression_threshold_ = threshold;
+  }
+
+  bool covariance_forms(void) const { return (covariance_forms_); }
+
+  /*!
+   * \brief Set whether structured covariances are sent in their compact form
+   * (see Endpoint::NegotiateCovarianceForms()); only affects requests sent
+   * afterwards.
+   */
+  void SetCovarianceForms(bool forms) { covariance_forms_ = forms; }
+
+  std::size_t InFlight(void) const { return (pending_.size()); }
+
+  /*!
+   * \brief Bound the time requests wait for their reply (see Endpoint); only
+   * affects requests sent afterwards. Requests still queued for an endpoint
+   * that never came up are then discarded on close rather than blocking it.
+   * \param [in] timeout_ms How long each request waits (-1 waits forever).
+   */
+  void SetTimeout(long timeout_ms) {
+    timeout_ms_ = timeout_ms;
+    if (timeout_ms >= 0) {
+      int linger = 0;
+      socket_.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+    }
+  }
+  long timeout(void) const { return (timeout_ms_); }
+
+  /*!
+   * \brief Send an already-encoded request without waiting for its reply.
+   * \param [in] request_str The request, encoded with encoding().
+   * \param [in] callback Invoked with the reply from within Poll()/Wait().
+   * \return The request id.
+   */
+  uint64_t SendRaw(const std::string &request_str, Callback callback) {
+    return (Send(request_str.data(), request_str.size(), callback));
+  }
+
+  /*!
+   * \brief Start a streamed request (see Endpoint::BeginRequest). The payload
+   * is copied into the message by EndRequest(), as it may still be in flight
+   * when the buffer is reused.
+   * \param [in] name The request name; must outlive the request.
+   * \return The writer to stream exactly one payload value into.
+   */
+  Writer &BeginRequest(const char *name) {
+    request_name_ = name;
+    writer_.Clear(encoding_);
+    writer_.SetCovarianceForms(covariance_forms_);
+    writer_.BeginObject(2);
+    writer_.Key("payload");
+    return (writer_);
+  }
+
+  /*!
+   * \brief Send the request started by BeginRequest().
+   * \param [in] callback Invoked with the reply from within Poll()/Wait().
+   * \return The request id.
+   */
+  uint64_t EndRequest(Callback callback) {
+    writer_.Key("request");
+    writer_.String(request_name_);
+    writer_.EndObject();
+    return (Send(writer_.data(), writer_.size(), callback));
+  }
+
+  /*!
+   * \brief Send an encoded request without waiting for its reply.
+   * \param [in] data The request, encoded with encoding().
+   * \param [in] size The request size, in bytes.
+   * \param [in] callback Invoked with the reply from within Poll()/Wait().
+   * \return The request id.
+   */
+  uint64_t Send(const char *data, std::size_t size, Callback callback) {
+    // copy first: callbacks run while waiting may reuse the buffer
+    zmq::message_t id_msg(sizeof(uint64_t)), delimiter_msg(0),
+        request_msg(size);
+    memcpy(request_msg.data(), data, size);
+    while (pending_.size() >= max_in_flight_) {
+      Poll(-1);
+    }
+    uint64_t id = next_id_++;
+    memcpy(id_msg.data(), &id, sizeof(id));
+    socket_.send(id_msg, ZMQ_SNDMORE);
+    socket_.send(delimiter_msg, ZMQ_SNDMORE);
+    SendBody(socket_, request_msg, encoding_, compression_,
+             compression_threshold_);
+    Pending &pending = pending_[id];
+    pending.callback = callback;
+    pending.timeout_ms = timeout_ms_;
+    pending.deadline =
+        (timeout_ms_ < 0 ? std::chrono::steady_clock::time_point::max()
+                         : std::chrono::steady_clock::now() +
+                               std::chrono::milliseconds(timeout_ms_));
+    return (id);
+  }
+
+  uint64_t SendRequest(const json &request, Callback callback) {
+    return (SendRaw(Encode(request, encoding_), callback));
+  }
+
+  /*!
+   * \brief Send a request without waiting for its reply.
+   * \param [in] request The request object.
+   * \return A future holding the reply; it is fulfilled from within
+   * Poll()/Wait().
+   */
+  std::future<json> SendRequest(const json &request) {
+    std::shared_ptr<std::promise<json>> promise(new std::promise<json>());
+    SendRequest(request,
+                [promise](const json &reply) { promise->set_value(reply); });
+    return (promise->get_future());
+  }
+
+  /*!
+   * \brief Process the replies that have arrived, and the requests that have
+   * timed out (see SetTimeout()).
+   * \param [in] timeout_ms How long to wait for the first reply (-1 waits
+   * indefinitely, 0 returns immediately); never past the earliest deadline.
+   * \return The number of requests completed.
+   */
+  std::size_t Poll(long timeout_ms = 0) {
+    if (pending_.empty()) {
+      return (0);
+    }
+    const std::chrono::steady_clock::time_point deadline = Deadline();
+    if (deadline != std::chrono::steady_clock::time_point::max()) {
+      // round up, not to wake just before the deadline
+      const long left = static_cast<long>(
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              deadline - std::chrono::steady_clock::now())
+              .count() +
+          1);
+      if (timeout_ms < 0 || left < timeout_ms) {
+        timeout_ms = (left > 0 ? left : 0);
+      }
+    }
+    zmq::pollitem_t items[] = {
+        {static_cast<void *>(socket_), 0, ZMQ_POLLIN, 0}};
+    zmq::poll(items, 1, timeout_ms);
+    std::size_t count = 0;
+    while (!pending_.empty() && Dispatch()) {
+      ++count;
+    }
+    return (count + Expire());
+  }
+
+  /*!
+   * \brief Block until every outstanding request has been replied to or has
+   * timed out.
+   */
+  void Wait(void) {
+    while (!pending_.empty()) {
+      Poll(-1);
+    }
+  }
+};
+
+/*!
+ * @class
+ * @brief
+ */
+class Variable : public Element {
+  // not really much in here for now...
+public:
+  Variable(const std::string &name, const std::string &type)
+      : Element(name, type) {}
+  Variable(const Symbol &name, const std::string &type)
+      : Element(name, type) {}
+  Variable(const Symbol &name, uint32_t type) : Element(name, type) {}
+  json ToJson(void) const {
+    json j;
+    j["label"] = name();
+    j["variableType"] = Type();
+    j["N"] = 0;
+    j["labels"] = {""};
+    return (j);
+  }
+  void Write(Writer &w) const {
+    w.BeginObject(4);
+    w.Key("N");
+    w.Int(0);
+    w.Key("label");
+    name_.Write(w);
+    w.Key("labels");
+    w.BeginArray(1);
+    w.String("", 0);
+    w.EndArray();
+    w.Key("variableType");
+    w.String(Type());
+    w.EndObject();
+  }
+};
+
+/*!
+ * \class
+ * \brief
+ */
+class Factor : public Element {
+  // std::string type_;
+  std::vector<Symbol> variables_;
+  // a factor can take either a single distribution or one distribution per
+  // measurement axis (e.g. priorpoint2 is a 2dof normal, but a RAE comprises 3
+  // distributions ), owned by value
+  std::vector<Measurement> measurements_;
+
+  static std::string cat(const std::vector<Symbol> &v) {
+    // this creates a factor label according to the caesar convention
+    // concatenates the variable names, prepending them with an 'f'
+    std::string c("f");
+    for (unsigned int i = 0; i < v.size(); ++i) {
+      c += v[i].str();
+    }
+    return (c);
+  }
+
+public:
+  Factor(const std::string &type) : Element(Symbol(), type) {}
+  Factor(const std::string &type, const std::string &variable)
+      : Element(Symbol(), type), variables_({Symbol(variable)}) {}
+  Factor(const std::string &type, const std::vector<std::string> &variables)
+      : Element(Symbol(), type) {
+    variables_.reserve(variables.size());
+    for (const std::string &variable : variables) {
+      variables_.push_back(Symbol(variable));
+    }
+  }
+  Factor(const std::string &type, const Symbol &variable)
+      : Element(Symbol(), type), variables_({variable}) {}
+  Factor(const std::string &type, std::vector<Symbol> variables)
+      : Element(Symbol(), type), variables_(std::move(variables)) {}
+  Factor(uint32_t type, std::vector<Symbol> variables)
+      : Element(Symbol(), type), variables_(std::move(variables)) {}
+  /*
+  Factor(const std::string &type, const std::string variable,
+         Distribution *distribution_ptr)
+      : Element(std::string("f" + variable), type), variables_({variable}),
+        distribution_ptrs_({distribution_ptr}) {}
+  // single variable, multiple measurement distributions
+  Factor(const std::string &type, const std::string variable,
+         std::vector<Distribution *> distribution_ptrs)
+      : Element(std::string("f" + variable), type), variables_({variable}),
         distribution_ptrs_(distribution_ptrs) {}
   // multiple variables, single measurement distribution
   Factor(const std::string &type, const std::vector<std::string> variables,
@@ -242,87 +2281,1187 @@ public:
         distribution_ptrs_(distribution_ptrs) {}
   */
 
-  void push_back(const std::string &variable) {
+  void push_back(const std::string &variable) {
+    variables_.push_back(Symbol(variable));
+  }
+
+  void push_back(const Symbol &variable) { variables_.push_back(variable); }
+
+  const std::vector<Symbol> &variables(void) const { return (variables_); }
+
+  /*! \brief The label given by the caesar convention, e.g. "fx0x1". */
+  std::string DefaultLabel(void) const { return (cat(variables_)); }
+
+  /*!
+   * \brief Add a measurement, e.g. push_back(graff::Normal(0.0, 0.01)).
+   */
+  void push_back(Measurement measurement) {
+    measurements_.push_back(std::move(measurement));
+  }
+
+  void push_back(std::vector<Measurement> measurements) {
+    measurements_.reserve(measurements_.size() + measurements.size());
+    for (Measurement &measurement : measurements) {
+      measurements_.push_back(std::move(measurement));
+    }
+  }
+
+  /*!
+   * \brief Add a measurement by pointer. Normal and SampleWeights are copied;
+   * other distributions are referenced, and must outlive the factor.
+   * \deprecated Pass the distribution by value.
+   */
+  void push_back(const Distribution *distribution) {
+    const Normal *normal = dynamic_cast<const Normal *>(distribution);
+    const SampleWeights *sample_weights =
+        dynamic_cast<const SampleWeights *>(distribution);
+    if (normal) {
+      measurements_.push_back(*normal);
+    } else if (sample_weights) {
+      measurements_.push_back(*sample_weights);
+    } else {
+      measurements_.push_back(Measurement(std::shared_ptr<const Distribution>(
+          distribution, [](const Distribution *) {})));
+    }
+  }
+
+  void push_back(const std::vector<Distribution *> &distributions) {
+    for (const Distribution *distribution : distributions) {
+      push_back(distribution);
+    }
+  }
+
+  const std::vector<Measurement> &measurements(void) const {
+    return (measurements_);
+  }
+
+  virtual json ToJson(void) const {
+    json j;
+    j["factorType"] = Type();
+    // j["label"] = name(); // unneeded, as we get the label from the backend
+    j["variables"] = json::array(); // the variable labels
+    for (const Symbol &variable : variables_) {
+      j["variables"].push_back(variable.str());
+    }
+    for (const Measurement &measurement : measurements_) {
+      j["factor"]["measurement"].emplace_back(measurement.ToJson());
+    }
+    return (j);
+  }
+
+  virtual void Write(Writer &w) const {
+    const bool measured = !measurements_.empty();
+    w.BeginObject(measured ? 3 : 2);
+    if (measured) {
+      w.Key("factor");
+      w.BeginObject(1);
+      w.Key("measurement");
+      w.BeginArray(measurements_.size());
+      for (const Measurement &measurement : measurements_) {
+        measurement.Write(w);
+      }
+      w.EndArray();
+      w.EndObject();
+    }
+    w.Key("factorType");
+    w.String(Type());
+    w.Key("variables");
+    w.BeginArray(variables_.size());
+    for (const Symbol &variable : variables_) {
+      variable.Write(w);
+    }
+    w.EndArray();
+    w.EndObject();
+  }
+};
+
+/*!
+ * @class
+ * @brief
+ */
+class Robot {
+  std::string name_;
+  std::string description_;
+
+public:
+  Robot() {}
+  Robot(const std::string &name) : name_(name) {}
+  Robot(const std::string &name, const std::string &description)
+      : name_(name), description_(description) {}
+  std::string Name(void) const { return (name_); }
+  std::string Description(void) const { return (description_); }
+  json ToJson(void) const {
+    json j;
+    j["name"] = name_;
+    j["description"] = description_;
+    return (j);
+  }
+};
+
+/*!
+ * \struct Estimate graff.hpp
+ * \brief The cached estimate of a variable.
+ */
+struct Estimate {
+  std::vector<double> mean; /*!< MAP mean */
+  std::vector<double> max;  /*!< MAP max */
+  json kde;                 /*!< belief, if it was requested (else null) */
+  uint64_t version;         /*!< solve that last changed the estimate */
+  Estimate() : version(0) {}
+};
+
+/*!
+ * \brief The estimate GetVarsMAP() fetches for each variable.
+ */
+enum class EstimateField { kMean, kMax, kKde };
+
+inline std::string EstimateFieldName(EstimateField field) {
+  switch (field) {
+  case EstimateField::kMax:
+    return ("max");
+  case EstimateField::kKde:
+    return ("kde");
+  default:
+    return ("mean");
+  }
+}
+
+/*!
+ * \brief Look up an estimate field by name.
+ * \return false if the name is unknown.
+ */
+inline bool EstimateFieldFromName(const std::string &name,
+                                  EstimateField &field) {
+  for (EstimateField f :
+       {EstimateField::kMean, EstimateField::kMax, EstimateField::kKde}) {
+    if (EstimateFieldName(f) == name) {
+      field = f;
+      return (true);
+    }
+  }
+  return (false);
+}
+
+/*!
+ * \class EstimateArray graff.hpp
+ * \brief The estimates of several variables in contiguous arrays, as laid
+ * out in a "GetVarsMAP" reply payload.
+ *
+ * The payload holds the "labels", their "dims", and "offsets" into a flat
+ * "values" array (one more offset than labels): the values of variable i
+ * span [offsets[i], offsets[i + 1]). They are its mean or max (dims[i]
+ * values), or the points of its kernel density estimate, point-major; the
+ * bandwidths of the estimates then follow one another in "bandwidths".
+ * Nothing is allocated per variable, and the values of all variables can be
+ * handed to numeric code as one array.
+ */
+class EstimateArray {
+  uint64_t version_;
+  EstimateField field_;
+  std::vector<std::string> labels_;
+  std::vector<std::size_t> dims_;
+  std::vector<std::size_t> offsets_;
+  std::vector<double> values_;
+  std::vector<double> bandwidths_;
+  std::vector<std::size_t> bandwidth_offsets_;
+  std::unordered_map<Symbol, std::size_t> index_;
+
+  static bool ReadSizes(Reader &reader, std::vector<std::size_t> &sizes) {
+    uint64_t size;
+    sizes.clear();
+    reader.BeginArray();
+    while (reader.Next() && reader.Unsigned(size)) {
+      sizes.push_back(static_cast<std::size_t>(size));
+    }
+    return (reader.ok());
+  }
+
+  // check the layout read, and index the labels
+  bool Index(void) {
+    if (dims_.size() != labels_.size() ||
+        offsets_.size() != labels_.size() + 1 || offsets_[0] != 0) {
+      return (false);
+    }
+    bandwidth_offsets_.assign(1, 0);
+    for (std::size_t i = 0; i < labels_.size(); ++i) {
+      if (offsets_[i] > offsets_[i + 1]) {
+        return (false);
+      }
+      index_[Symbol(labels_[i])] = i;
+      bandwidth_offsets_.push_back(bandwidth_offsets_.back() +
+                                   (bandwidths_.empty() ? 0 : dims_[i]));
+    }
+    return (offsets_.back() == values_.size() &&
+            bandwidth_offsets_.back() == bandwidths_.size());
+  }
+
+public:
+  EstimateArray(EstimateField field = EstimateField::kMean)
+      : version_(0), field_(field), offsets_(1, 0), bandwidth_offsets_(1, 0) {}
+
+  /*!
+   * \brief Append the estimate of a variable.
+   * \param [in] label The variable label.
+   * \param [in] dim The dimension of the variable.
+   * \param [in] values The mean or max (dim values), or the kernel points
+   * (a multiple of dim values).
+   * \param [in] count Number of values.
+   * \param [in] bandwidths The kernel bandwidths (dim values), for kernel
+   * density estimates only.
+   */
+  void Append(const std::string &label, std::size_t dim, const double *values,
+              std::size_t count, const double *bandwidths = nullptr) {
+    index_[Symbol(label)] = labels_.size();
+    labels_.push_back(label);
+    dims_.push_back(dim);
+    values_.insert(values_.end(), values, values + count);
+    offsets_.push_back(values_.size());
+    if (bandwidths) {
+      bandwidths_.insert(bandwidths_.end(), bandwidths, bandwidths + dim);
+    }
+    bandwidth_offsets_.push_back(bandwidths_.size());
+  }
+
+  void SetVersion(uint64_t version) { version_ = version; }
+
+  uint64_t version(void) const { return (version_); }
+  EstimateField field(void) const { return (field_); }
+  std::size_t size(void) const { return (labels_.size()); }
+  const std::string &label(std::size_t i) const { return (labels_[i]); }
+  std::size_t dim(std::size_t i) const { return (dims_[i]); }
+
+  /*! \brief Number of values of variable i (dim(i) per kernel point). */
+  std::size_t count(std::size_t i) const {
+    return (offsets_[i + 1] - offsets_[i]);
+  }
+  const double *values(std::size_t i) const {
+    return (values_.data() + offsets_[i]);
+  }
+
+  /*! \brief The kernel bandwidths of variable i, or nullptr if none. */
+  const double *bandwidths(std::size_t i) const {
+    return (bandwidth_offsets_[i + 1] > bandwidth_offsets_[i]
+                ? bandwidths_.data() + bandwidth_offsets_[i]
+                : nullptr);
+  }
+
+  /*! \brief The values of all the variables, one after the other. */
+  const std::vector<double> &data(void) const { return (values_); }
+
+  /*!
+   * \brief The position of a variable.
+   * \return Its index, or size() if it is not in the array.
+   */
+  std::size_t Find(const std::string &label) const {
+    auto it = index_.find(Symbol(label));
+    return (it == index_.end() ? labels_.size() : it->second);
+  }
+
+  json ToJson(void) const {
+    json j;
+    j["version"] = version_;
+    j["field"] = EstimateFieldName(field_);
+    j["labels"] = labels_;
+    j["dims"] = dims_;
+    j["offsets"] = offsets_;
+    j["values"] = values_;
+    if (EstimateField::kKde == field_) {
+      j["bandwidths"] = bandwidths_;
+    }
+    return (j);
+  }
+
+  /*!
+   * \brief Read a "GetVarsMAP" reply payload.
+   * \return false if the payload is malformed.
+   */
+  bool FromJson(const json &payload) {
+    auto field = payload.find("field");
+    auto labels = payload.find("labels");
+    auto dims = payload.find("dims");
+    auto offsets = payload.find("offsets");
+    auto values = payload.find("values");
+    if (field == payload.end() || !field->is_string() ||
+        labels == payload.end() || !labels->is_array() ||
+        dims == payload.end() || !dims->is_array() ||
+        offsets == payload.end() || !offsets->is_array() ||
+        values == payload.end() || !values->is_array()) {
+      return (false);
+    }
+    *this = EstimateArray();
+    if (!EstimateFieldFromName(field->get<std::string>(), field_)) {
+      return (false);
+    }
+    version_ = payload.value("version", static_cast<uint64_t>(0));
+    labels_ = labels->get<std::vector<std::string>>();
+    dims_ = dims->get<std::vector<std::size_t>>();
+    offsets_ = offsets->get<std::vector<std::size_t>>();
+    values_ = values->get<std::vector<double>>();
+    auto bandwidths = payload.find("bandwidths");
+    if (bandwidths != payload.end() && bandwidths->is_array()) {
+      bandwidths_ = bandwidths->get<std::vector<double>>();
+    }
+    return (Index());
+  }
+
+  /*!
+   * \brief Read a "GetVarsMAP" reply payload straight from the message, see
+   * Endpoint::SendRequest(const json &, const PayloadReader &).
+   * \return false if the payload is malformed.
+   */
+  bool Read(Reader &reader) {
+    *this = EstimateArray();
+    offsets_.clear();
+    std::string key, field;
+    bool named = false;
+    if (!reader.BeginObject()) {
+      return (false);
+    }
+    while (reader.Next() && reader.Key(key)) {
+      if ("field" == key) {
+        named = (reader.String(field) &&
+                 EstimateFieldFromName(field, field_));
+      } else if ("labels" == key) {
+        reader.BeginArray();
+        while (reader.Next()) {
+          labels_.emplace_back();
+          reader.String(labels_.back());
+        }
+      } else if ("dims" == key) {
+        ReadSizes(reader, dims_);
+      } else if ("offsets" == key) {
+        ReadSizes(reader, offsets_);
+      } else if ("values" == key) {
+        reader.Doubles(values_);
+      } else if ("bandwidths" == key) {
+        reader.Doubles(bandwidths_);
+      } else if ("version" == key) {
+        reader.Unsigned(version_);
+      } else {
+        reader.Skip();
+      }
+    }
+    return (reader.ok() && named && Index());
+  }
+};
+
+/*!
+ * \class NoiseModels graff.hpp
+ * \brief The noise models of a session's normal measurements, each kept once
+ * locally and registered once with the endpoint.
+ *
+ * Identical covariances map to one NoiseModel, shared by the measurements
+ * made with it (see Share()), which then only hold their mean: a factor
+ * measured with them does not allocate its covariances, nor copy them along
+ * with the factor. Once the endpoint accepts model references (see
+ * NegotiateNoiseModels()), the models are registered with it before the
+ * factors that use them are sent (see SyncNoiseModels()), as an
+ * "addNoiseModels" request listing {"distribution", "id"}, and the factors
+ * only carry each measurement's mean and model id.
+ *
+ * Models are made from the thread that submits the session's factors.
+ */
+class NoiseModels {
+  std::vector<std::shared_ptr<const NoiseModel>> models_; /*!< id - 1 */
+  std::unordered_map<std::string, uint32_t> ids_; /*!< by covariance */
+  std::string key_;        /*!< scratch lookup key */
+  std::size_t registered_; /*!< models known to the endpoint */
+  bool enabled_;
+  uint64_t registry_; /*!< tags the models made here */
+
+  static uint64_t NextRegistry(void) {
+    static std::atomic<uint64_t> next(0);
+    return (++next);
+  }
+
+  // the bytes of a covariance: form, dimension and values
+  void Key(const Normal &normal) {
+    const uint64_t dim = normal.dim();
+    const std::vector<double> &cov = normal.CompactCovariance();
+    key_.assign(1, static_cast<char>(normal.form()));
+    key_.append(reinterpret_cast<const char *>(&dim), sizeof(dim));
+    key_.append(reinterpret_cast<const char *>(cov.data()),
+                cov.size() * sizeof(double));
+  }
+
+public:
+  NoiseModels()
+      : registered_(0), enabled_(false), registry_(NextRegistry()) {}
+
+  /*!
+   * \brief The model of the covariance of a normal distribution (its mean
+   * is ignored), made if it is new.
+   */
+  std::shared_ptr<const NoiseModel> Add(const Normal &normal) {
+    Key(normal);
+    auto it = ids_.find(key_);
+    if (it != ids_.end()) {
+      return (models_[it->second - 1]);
+    }
+    const uint32_t id = static_cast<uint32_t>(models_.size() + 1);
+    models_.push_back(std::make_shared<const NoiseModel>(
+        id,
+        Normal(std::vector<double>(normal.dim(), 0.0),
+               normal.CompactCovariance(), normal.form()),
+        registry_));
+    ids_.emplace(key_, id);
+    return (models_.back());
+  }
+
+  /*!
+   * \brief A measurement of a normal distribution that shares the model of
+   * its covariance, e.g. factor.push_back(models.Share(Normal(m, 0.01))).
+   * To avoid building a Normal per measurement, get the model once with
+   * Add() and pass it to Measurement(mean, n, model).
+   */
+  Measurement Share(const Normal &normal) {
+    return (Measurement(normal.mean().data(), normal.dim(), Add(normal)));
+  }
+
+  std::size_t size(void) const { return (models_.size()); }
+
+  /*!
+   * \brief The tag of the models made by this registry, unique in the process
+   * (copies share it, along with the ids). Writers given it (see
+   * Writer::SetModelReferences()) only reference models that carry it, and
+   * write the measurements of other registries' models in full.
+   */
+  uint64_t registry(void) const { return (registry_); }
+
+  /*! \brief The model with an id, or nullptr. */
+  std::shared_ptr<const NoiseModel> Find(uint32_t id) const {
+    return (id > 0 && id <= models_.size() ? models_[id - 1] : nullptr);
+  }
+
+  /*!
+   * \brief Whether factors are sent with model references; see
+   * NegotiateNoiseModels().
+   */
+  bool enabled(void) const { return (enabled_); }
+  void Enable(bool enabled = true) { enabled_ = enabled; }
+
+  /*! \brief Whether some models are not registered with the endpoint yet. */
+  bool pending(void) const { return (registered_ < models_.size()); }
+
+  /*!
+   * \brief Stream the payload of the "addNoiseModels" request registering
+   * the pending models.
+   * \return The number of models known to the endpoint once it is accepted
+   * (see Registered()).
+   */
+  std::size_t WritePending(Writer &w) const {
+    w.BeginArray(models_.size() - registered_);
+    for (std::size_t i = registered_; i < models_.size(); ++i) {
+      w.BeginObject(2);
+      w.Key("distribution");
+      models_[i]->noise.Write(w);
+      w.Key("id");
+      w.Int(models_[i]->id);
+      w.EndObject();
+    }
+    w.EndArray();
+    return (models_.size());
+  }
+
+  /*! \brief Record that the endpoint knows the first count models. */
+  void Registered(std::size_t count) {
+    registered_ = std::max(registered_, std::min(count, models_.size()));
+  }
+
+  /*!
+   * \brief Forget which models the endpoint knows, e.g. before sending the
+   * session to another endpoint.
+   */
+  void ResetRegistration(void) { registered_ = 0; }
+};
+
+/*!
+ * \class SessionObserver graff.hpp
+ * \brief Notified of the elements recorded in a Session, e.g. to journal
+ * them as they are added.
+ */
+class SessionObserver {
+public:
+  virtual ~SessionObserver() {}
+  virtual void VariableAdded(const Variable &variable) = 0;
+  /*! \brief The factor carries the label it was recorded under. */
+  virtual void FactorAdded(const Factor &factor) = 0;
+};
+
+/*!
+ * \class Session
+ * \brief The local copy of a session's factor graph.
+ *
+ * Variables and factors are indexed by label symbol, and each variable keeps
+ * the list of factors attached to it, so lookups and neighborhood queries do
+ * not scan the graph (nor build label strings).
+ */
+class Session {
+  std::string name_;
+  std::vector<graff::Variable> variables_;
+  std::vector<graff::Factor> factors_;
+  std::unordered_map<Symbol, std::size_t> variable_index_;
+  std::unordered_map<Symbol, std::size_t> factor_index_;
+  /*! factors attached to each variable, by position in factors_ */
+  std::vector<std::vector<std::size_t>> adjacency_;
+  /*! element counts by interned type id */
+  std::unordered_map<uint32_t, std::size_t> variable_types_;
+  std::unordered_map<uint32_t, std::size_t> factor_types_;
+  /*! estimates as of solve estimate_version_ */
+  std::unordered_map<Symbol, Estimate> estimates_;
+  uint64_t estimate_version_;
+  uint64_t pushed_version_; /*!< of the last estimates event */
+  uint64_t requested_version_; /*!< of the last requested solve */
+  bool estimates_fresh_;
+  SessionObserver *observer_;
+  NoiseModels noise_models_;
+
+  // whether entry[key] is absent or an array of numbers
+  static bool Doubles(const json &entry, const char *key) {
+    auto j = entry.find(key);
+    if (j == entry.end()) {
+      return (true);
+    }
+    if (!j->is_array()) {
+      return (false);
+    }
+    for (const json &value : *j) {
+      if (!value.is_number()) {
+        return (false);
+      }
+    }
+    return (true);
+  }
+
+  // merge the "estimates" of a payload, and get its "version"; malformed
+  // entries are skipped, as ReadEstimates() does
+  bool MergeEstimates(const json &payload, uint64_t &latest) {
+    auto version = payload.find("version");
+    auto estimates = payload.find("estimates");
+    if (version == payload.end() || !version->is_number_integer() ||
+        estimates == payload.end() || !estimates->is_array()) {
+      return (false);
+    }
+    latest = version->get<uint64_t>();
+    for (const json &entry : *estimates) {
+      if (!entry.is_object()) {
+        continue;
+      }
+      auto label = entry.find("label");
+      auto changed = entry.find("version");
+      if (label == entry.end() || !label->is_string() ||
+          label->get_ref<const std::string &>().empty() ||
+          !Doubles(entry, "mean") || !Doubles(entry, "max") ||
+          (changed != entry.end() && !changed->is_number_integer())) {
+        continue;
+      }
+      Estimate estimate;
+      auto mean = entry.find("mean");
+      auto max = entry.find("max");
+      auto kde = entry.find("kde");
+      if (mean != entry.end()) {
+        estimate.mean = mean->get<std::vector<double>>();
+      }
+      if (max != entry.end()) {
+        estimate.max = max->get<std::vector<double>>();
+      }
+      if (kde != entry.end()) {
+        estimate.kde = *kde;
+      }
+      estimate.version =
+          (changed == entry.end() ? latest : changed->get<uint64_t>());
+      estimates_[Symbol(label->get<std::string>())] = std::move(estimate);
+    }
+    return (true);
+  }
+
+  // as MergeEstimates(), straight from a reply message; nothing is merged
+  // unless the whole payload reads
+  bool ReadEstimates(Reader &reader, uint64_t &latest) {
+    std::vector<std::pair<Symbol, Estimate>> read;
+    std::vector<bool> changed; /*!< whether each read entry has a version */
+    std::string key, label;
+    bool versioned = false, listed = false;
+    latest = 0;
+    if (!reader.BeginObject()) {
+      return (false);
+    }
+    while (reader.Next() && reader.Key(key)) {
+      if ("version" == key) {
+        versioned = reader.Unsigned(latest);
+      } else if ("estimates" == key && reader.BeginArray()) {
+        listed = true;
+        while (reader.Next() && reader.BeginObject()) {
+          Estimate entry;
+          bool has_version = false;
+          label.clear();
+          while (reader.Next() && reader.Key(key)) {
+            if ("label" == key) {
+              reader.String(label);
+            } else if ("mean" == key) {
+              reader.Doubles(entry.mean);
+            } else if ("max" == key) {
+              reader.Doubles(entry.max);
+            } else if ("kde" == key) {
+              reader.Value(entry.kde);
+            } else if ("version" == key) {
+              has_version = reader.Unsigned(entry.version);
+            } else {
+              reader.Skip();
+            }
+          }
+          if (!reader.ok() || label.empty()) {
+            continue;
+          }
+          read.emplace_back(Symbol(label), std::move(entry));
+          changed.push_back(has_version);
+        }
+      } else {
+        reader.Skip();
+      }
+    }
+    if (!reader.ok() || !versioned || !listed) {
+      return (false);
+    }
+    for (std::size_t i = 0; i < read.size(); ++i) {
+      if (!changed[i]) {
+        read[i].second.version = latest;
+      }
+      estimates_[read[i].first] = std::move(read[i].second);
+    }
+    return (true);
+  }
+
+  static std::size_t Count(
+      const std::unordered_map<uint32_t, std::size_t> &counts,
+      const std::string &type) {
+    auto it = counts.find(SymbolTable::Instance().Intern(type));
+    return (it == counts.end() ? 0 : it->second);
+  }
+
+public:
+  Session()
+      : estimate_version_(0), pushed_version_(0), requested_version_(0),
+        estimates_fresh_(false), observer_(nullptr) {}
+  Session(const std::string &name)
+      : name_(name), estimate_version_(0), pushed_version_(0),
+        requested_version_(0), estimates_fresh_(false), observer_(nullptr) {}
+
+  /*!
+   * \brief Notify an observer of every element recorded from now on.
+   * \param [in] observer The observer, which must outlive the session (or be
+   * replaced), or nullptr for none.
+   */
+  void SetObserver(SessionObserver *observer) { observer_ = observer; }
+
+  /*! \brief The noise models of the session's measurements. */
+  NoiseModels &noise_models(void) { return (noise_models_); }
+  const NoiseModels &noise_models(void) const { return (noise_models_); }
+
+  /*!
+   * \brief Record a variable in the local graph.
+   * \return false (and nothing is recorded) if the label is already in use.
+   */
+  bool AddVariable(const graff::Variable &variable) {
+    if (!variable_index_.insert({variable.symbol(), variables_.size()})
+             .second) {
+      return (false);
+    }
     variables_.push_back(variable);
+    adjacency_.push_back(std::vector<std::size_t>());
+    ++variable_types_[variable.TypeId()];
+    if (observer_) {
+      observer_->VariableAdded(variable);
+    }
+    return (true);
+  };
+
+  /*!
+   * \brief Record a factor in the local graph.
+   * \param [in] factor The factor.
+   * \param [in] label The label assigned by the endpoint; if empty, the
+   * factor's own label is used, or one is derived from its variables.
+   */
+  void AddFactor(graff::Factor factor,
+                 const std::string &label = std::string()) {
+    const std::size_t position = factors_.size();
+    factors_.push_back(std::move(factor));
+    graff::Factor &added = factors_.back();
+    if (!label.empty()) {
+      added.SetName(label);
+    } else if (added.symbol().empty()) {
+      added.SetName(added.DefaultLabel());
+    }
+    if (factor_index_.count(added.symbol())) {
+      const std::string base(added.name());
+      Symbol unique(base);
+      for (int i = 1; factor_index_.count(unique); ++i) {
+        unique = Symbol(base + "_" + std::to_string(i));
+      }
+      added.SetName(unique);
+    }
+    factor_index_[added.symbol()] = position;
+    for (const Symbol &variable : added.variables()) {
+      auto it = variable_index_.find(variable);
+      if (it != variable_index_.end()) {
+        adjacency_[it->second].push_back(position);
+      }
+    }
+    ++factor_types_[added.TypeId()];
+    if (observer_) {
+      observer_->FactorAdded(added);
+    }
+  };
+
+  std::string name(void) const { return (name_); }
+
+  std::size_t NumVariables(void) const { return (variables_.size()); }
+  std::size_t NumFactors(void) const { return (factors_.size()); }
+  std::size_t NumVariables(const std::string &type) const {
+    return (Count(variable_types_, type));
+  }
+  std::size_t NumFactors(const std::string &type) const {
+    return (Count(factor_types_, type));
+  }
+
+  /*!
+   * \brief Look up a variable by label.
+   * \return The variable, or nullptr if unknown. The pointer is invalidated
+   * by the next AddVariable().
+   */
+  const graff::Variable *FindVariable(const Symbol &label) const {
+    auto it = variable_index_.find(label);
+    return (it == variable_index_.end() ? nullptr : &variables_[it->second]);
+  }
+  const graff::Variable *FindVariable(const std::string &label) const {
+    return (FindVariable(Symbol(label)));
+  }
+
+  /*!
+   * \brief Look up a factor by label.
+   * \return The factor, or nullptr if unknown. The pointer is invalidated by
+   * the next AddFactor().
+   */
+  const graff::Factor *FindFactor(const Symbol &label) const {
+    auto it = factor_index_.find(label);
+    return (it == factor_index_.end() ? nullptr : &factors_[it->second]);
+  }
+  const graff::Factor *FindFactor(const std::string &label) const {
+    return (FindFactor(Symbol(label)));
+  }
+
+  /*!
+   * \brief The factors attached to a variable.
+   * \return The factors, in insertion order; empty if the variable is
+   * unknown. Pointers are invalidated by the next AddFactor().
+   */
+  std::vector<const graff::Factor *> FactorsOf(const Symbol &variable) const {
+    std::vector<const graff::Factor *> factors;
+    auto it = variable_index_.find(variable);
+    if (it != variable_index_.end()) {
+      for (std::size_t position : adjacency_[it->second]) {
+        factors.push_back(&factors_[position]);
+      }
+    }
+    return (factors);
+  }
+  std::vector<const graff::Factor *>
+  FactorsOf(const std::string &variable) const {
+    return (FactorsOf(Symbol(variable)));
+  }
+
+  /*!
+   * \brief The variables sharing a factor with a variable.
+   * \return The neighbor labels, each listed once, in the order in which they
+   * were first connected.
+   */
+  std::vector<Symbol> Neighbors(const Symbol &variable) const {
+    std::vector<Symbol> neighbors;
+    auto it = variable_index_.find(variable);
+    if (it == variable_index_.end()) {
+      return (neighbors);
+    }
+    std::unordered_set<Symbol> seen;
+    seen.insert(variable);
+    for (std::size_t position : adjacency_[it->second]) {
+      for (const Symbol &other : factors_[position].variables()) {
+        if (seen.insert(other).second) {
+          neighbors.push_back(other);
+        }
+      }
+    }
+    return (neighbors);
+  }
+  std::vector<Symbol> Neighbors(const std::string &variable) const {
+    return (Neighbors(Symbol(variable)));
+  }
+
+  const std::vector<graff::Variable> &variables(void) const {
+    return (variables_);
+  }
+  const std::vector<graff::Factor> &factors(void) const { return (factors_); }
+
+  /*!
+   * \brief The solve version of the cached estimates (0 if none).
+   */
+  uint64_t EstimateVersion(void) const { return (estimate_version_); }
+
+  /*!
+   * \brief Whether the cached estimates reflect the latest requested solve.
+   */
+  bool EstimatesFresh(void) const { return (estimates_fresh_); }
+
+  /*!
+   * \brief Mark the cached estimates as stale, e.g. after requesting a solve.
+   * They are still available, but are no longer served in place of the
+   * endpoint's.
+   */
+  void InvalidateEstimates(void) { estimates_fresh_ = false; }
+
+  /*!
+   * \brief Record that a solve was requested: the cached estimates are stale
+   * until those of solve version (or a later one) are cached, whatever older
+   * solves complete in the meantime.
+   */
+  void SolveRequested(uint64_t version) {
+    estimates_fresh_ = false;
+    requested_version_ = std::max(requested_version_, version);
   }
 
-  void push_back(Distribution *distribution) {
-    distribution_ptrs_.push_back(distribution);
+  /*!
+   * \brief The version of the last requested solve (0 if none).
+   */
+  uint64_t RequestedVersion(void) const { return (requested_version_); }
+
+  /*!
+   * \brief Look up the cached estimate of a variable.
+   * \return The estimate, or nullptr if none is cached.
+   */
+  const Estimate *FindEstimate(const Symbol &variable) const {
+    auto it = estimates_.find(variable);
+    return (it == estimates_.end() ? nullptr : &it->second);
+  }
+  const Estimate *FindEstimate(const std::string &variable) const {
+    return (FindEstimate(Symbol(variable)));
+  }
+
+  /*!
+   * \brief Merge a "getEstimates" reply payload into the cache.
+   *
+   * The payload holds the solve "version" and the "estimates" that changed
+   * since the version the request asked for. The cache becomes fresh if the
+   * version is newer than the cached one and at least that of the requested
+   * solve (see SolveRequested()); otherwise the solve that was requested has
+   * not completed yet.
+   *
+   * \return false if the payload is malformed.
+   */
+  bool UpdateEstimates(const json &payload) {
+    uint64_t latest;
+    if (!MergeEstimates(payload, latest)) {
+      return (false);
+    }
+    if (latest > estimate_version_) {
+      estimate_version_ = latest;
+      estimates_fresh_ = (latest >= requested_version_);
+    }
+    return (true);
+  }
+
+  /*!
+   * \brief Merge a "getEstimates" reply payload into the cache, reading it
+   * straight from the reply message (see
+   * Endpoint::SendRequest(const json &, const PayloadReader &)).
+   * \return false if the payload is malformed.
+   */
+  bool UpdateEstimates(Reader &reader) {
+    uint64_t latest;
+    if (!ReadEstimates(reader, latest)) {
+      return (false);
+    }
+    if (latest > estimate_version_) {
+      estimate_version_ = latest;
+      estimates_fresh_ = (latest >= requested_version_);
+    }
+    return (true);
   }
 
-  void push_back(std::vector<Distribution *> distributions) {
-    for (Distribution *ptr : distributions) {
-      distribution_ptrs_.push_back(ptr);
+  /*!
+   * \brief Apply an event published by the endpoint (see
+   * Endpoint::Subscribe()).
+   *
+   * "solveStarted" marks the cache stale, "estimates" merges the estimate
+   * updates it carries (laid out as a "getEstimates" payload), and
+   * "solveFinished" makes the cache fresh if the estimates of that solve
+   * were pushed before it, and it is the requested solve or a later one.
+   * Other events are ignored.
+   *
+   * \return The event name, or "" if it has none.
+   */
+  std::string ApplyEvent(const json &event) {
+    auto name = event.find("event");
+    auto version = event.find("version");
+    if (name == event.end() || !name->is_string()) {
+      return (std::string());
     }
+    const std::string type = *name;
+    if ("solveStarted" == type) {
+      InvalidateEstimates();
+    } else if ("estimates" == type) {
+      MergeEstimates(event, pushed_version_);
+    } else if ("solveFinished" == type && version != event.end() &&
+               version->is_number_integer() &&
+               version->get<uint64_t>() == pushed_version_ &&
+               pushed_version_ > estimate_version_) {
+      estimate_version_ = pushed_version_;
+      estimates_fresh_ = (pushed_version_ >= requested_version_);
+    }
+    return (type);
   }
 
-  virtual json ToJson(void) const {
+  json ToJson(void) const {
     json j;
-    j["factorType"] = Type();
-    // j["label"] = name(); // unneeded, as we get the label from the backend
-    j["variables"] = variables_; // the variable labels
-    for (unsigned int i = 0; i < distribution_ptrs_.size(); ++i) {
-      j["factor"]["measurement"].emplace_back(distribution_ptrs_[i]->ToJson());
+    j["name"] = name_;
+    for (unsigned int i = 0; i < variables_.size(); ++i) {
+      j["variables"][variables_[i].name()] = variables_[i].ToJson();
+    }
+    for (unsigned int i = 0; i < factors_.size(); ++i) {
+      j["factors"][factors_[i].name()] = factors_[i].ToJson();
     }
     return (j);
   }
 };
 
-/*!
- * @class
- * @brief
+/**
+ * \brief Send model references in the session's factors if the endpoint
+ * accepts them (it advertises "noiseModels" in its status); otherwise
+ * measurements are sent in full.
+ *
+ * \param [in] ep The endpoint object.
+ * \param [in] s The session object.
+ * \return true if the factors are now sent with model references.
  */
-class Robot {
-  std::string name_;
-  std::string description_;
+inline bool NegotiateNoiseModels(Endpoint &ep, Session &s) {
+  s.noise_models().Enable(SupportsFeature(ep.Status(), "noiseModels"));
+  return (s.noise_models().enabled());
+}
 
-public:
-  Robot() {}
-  Robot(const std::string &name) : name_(name) {}
-  Robot(const std::string &name, const std::string &description)
-      : name_(name), description_(description) {}
-  std::string Name(void) const { return (name_); }
-  std::string Description(void) const { return (description_); }
-  json ToJson(void) const {
-    json j;
-    j["name"] = name_;
-    j["description"] = description_;
-    return (j);
+/**
+ * \brief Register the session's new noise models with the endpoint, if it
+ * accepts model references. AddFactor() and Batch::Submit() call it before
+ * sending factors.
+ *
+ * \param [in] ep The endpoint object.
+ * \param [in] s The session object.
+ * \return The endpoint reply, or an OK reply if there was nothing to send.
+ */
+inline json SyncNoiseModels(Endpoint &ep, Session &s) {
+  NoiseModels &models = s.noise_models();
+  json reply;
+  reply["status"] = "OK";
+  if (!models.enabled() || !models.pending()) {
+    return (reply);
   }
-};
+  const std::size_t count =
+      models.WritePending(ep.BeginRequest("addNoiseModels"));
+  reply = ep.EndRequest();
+  if (check(reply)) {
+    models.Registered(count);
+  }
+  return (reply);
+}
 
 /*!
- * \class
- * \brief
+ * \class Batch graff.hpp
+ * \brief Collects variables and factors so that they can be submitted to the
+ * endpoint in a few large requests instead of one round trip per element.
+ *
+ * Elements are sent in insertion order as "batch" requests, each carrying at
+ * most max_elements sub-requests and at most max_bytes of encoded payload (a
+ * single oversized element is still sent on its own). The endpoint replies
+ * with one entry per sub-request, in order, so a rejected element can be
+ * traced back to its position in the batch. Endpoints that do not advertise
+ * "batch" in their status (see Endpoint::Batches()) are sent one
+ * addVariable or addFactor request per element instead, with the same
+ * result.
  */
-class Session {
-  std::string name_;
+class Batch {
+  struct Entry {
+    bool is_factor;
+    std::size_t index; /*!< position in variables_ or factors_ */
+  };
+  std::vector<Entry> entries_;
   std::vector<graff::Variable> variables_;
   std::vector<graff::Factor> factors_;
-  /*
-   may want to replace variables_ with an std::map to facilitate querying, for
-   instance: Distribution GetKDEMax(endpoint, session, "x0");
-  */
+  std::size_t max_elements_;
+  std::size_t max_bytes_;
+
+  json Request(const Entry &entry) const {
+    json request;
+    if (entry.is_factor) {
+      request["request"] = "addFactor";
+      request["payload"] = factors_[entry.index].ToJson();
+    } else {
+      request["request"] = "addVariable";
+      request["payload"] = variables_[entry.index].ToJson();
+    }
+    return (request);
+  }
+
+  // stream the payload of Request(entry)
+  void WritePayload(Writer &w, const Entry &entry) const {
+    if (entry.is_factor) {
+      factors_[entry.index].Write(w);
+    } else {
+      variables_[entry.index].Write(w);
+    }
+  }
+
+  // stream the same sub-request as Request(entry)
+  void Write(Writer &w, const Entry &entry) const {
+    w.BeginObject(2);
+    w.Key("payload");
+    WritePayload(w, entry);
+    w.Key("request");
+    w.String(entry.is_factor ? "addFactor" : "addVariable");
+    w.EndObject();
+  }
+
+  // record the reply to element i in the session and in the result
+  void Record(Session &s, std::size_t i, json element_reply, bool accepted,
+              json &result) {
+    const Entry &entry = entries_[i];
+    if (accepted) {
+      if (entry.is_factor) {
+        s.AddFactor(std::move(factors_[entry.index]),
+                    ReplyLabel(element_reply));
+      } else {
+        s.AddVariable(variables_[entry.index]);
+      }
+    } else {
+      result["status"] = "ERROR";
+      result["failed"].push_back(i);
+      std::cerr << "Batch element " << i << " failed!" << std::endl;
+      std::cerr << "Request contents:\n";
+      std::cerr << Request(entry);
+      std::cerr << "\n\n" << std::endl;
+      std::cerr << "Reply contents:\n";
+      std::cerr << element_reply;
+      std::cerr << "\n\n" << std::endl;
+    }
+    result["payload"].push_back(std::move(element_reply));
+  }
 
 public:
-  Session() {}
-  Session(const std::string &name) : name_(name) {}
+  /*!
+   * \brief Constructor
+   * \param [in] max_elements Maximum number of elements per request.
+   * \param [in] max_bytes Maximum encoded size of a request, in bytes.
+   */
+  Batch(std::size_t max_elements = 1024, std::size_t max_bytes = 1 << 20)
+      : max_elements_(max_elements > 0 ? max_elements : 1),
+        max_bytes_(max_bytes) {}
+
   void AddVariable(const graff::Variable &variable) {
+    entries_.push_back({false, variables_.size()});
     variables_.push_back(variable);
-  };
-  void AddFactor(const graff::Factor &factor) { factors_.push_back(factor); };
-  std::string name(void) const { return (name_); }
+  }
 
-  json ToJson(void) {
-    json j;
-    j["name"] = name_;
-    for (unsigned int i = 0; i < variables_.size(); ++i) {
-      j["variables"][variables_[i].name()] = variables_[i].ToJson();
-    }
-    for (unsigned int i = 0; i < factors_.size(); ++i) {
-      j["factors"][factors_[i].name()] = factors_[i].ToJson();
+  void AddFactor(graff::Factor factor) {
+    entries_.push_back({true, factors_.size()});
+    factors_.push_back(std::move(factor));
+  }
+
+  std::size_t size(void) const { return (entries_.size()); }
+  bool empty(void) const { return (entries_.empty()); }
+
+  void Clear(void) {
+    entries_.clear();
+    variables_.clear();
+    factors_.clear();
+  }
+
+  /*!
+   * \brief Send all pending elements to the endpoint and clear the batch.
+   *
+   * Accepted elements are added to the session. The reply holds an overall
+   * "status", the per-element replies in insertion order under "payload", and
+   * the insertion indices of rejected elements under "failed". An error that
+   * interrupts the submission (e.g. from the transport) is not thrown: the
+   * elements recorded until then stand, and the others are reported as
+   * failed, with the error as their reply.
+   *
+   * \param [in] ep The endpoint object.
+   * \param [in] s The session object.
+   * \return The aggregated endpoint reply as a json object.
+   */
+  json Submit(Endpoint &ep, Session &s) {
+    json result;
+    result["status"] = "OK";
+    result["payload"] = json::array();
+    result["failed"] = json::array();
+
+    std::size_t recorded = 0; // elements whose reply has been recorded
+    try {
+      // measurements are sent in full if their models could not be
+      // registered
+      const uint64_t references =
+          (!entries_.empty() && check(SyncNoiseModels(ep, s)) &&
+                   s.noise_models().enabled()
+               ? s.noise_models().registry()
+               : 0);
+      if (!entries_.empty() && !ep.Batches()) {
+        // the endpoint does not take batches: one request per element
+        for (; recorded < entries_.size(); ++recorded) {
+          const Entry &entry = entries_[recorded];
+          Writer &w = ep.BeginRequest(entry.is_factor ? "addFactor"
+                                                      : "addVariable");
+          w.SetModelReferences(references);
+          WritePayload(w, entry);
+          json reply = ep.EndRequest();
+          const bool accepted = check(reply);
+          Record(s, recorded, std::move(reply), accepted, result);
+        }
+      }
+      while (recorded < entries_.size()) {
+        // pack as many sub-requests as the limits allow
+        const std::size_t begin = recorded;
+        Writer &w = ep.BeginRequest("batch");
+        w.SetModelReferences(references);
+        w.BeginArray();
+        std::size_t end = begin;
+        while (end < entries_.size() && end - begin < max_elements_) {
+          Writer::Mark mark = w.GetMark();
+          Write(w, entries_[end]);
+          if (end > begin && w.size() > max_bytes_) {
+            w.Rewind(mark);
+            break;
+          }
+          ++end;
+        }
+        w.EndArray();
+
+        json reply = ep.EndRequest();
+        bool mapped = check(reply) && reply["payload"].is_array() &&
+                      reply["payload"].size() == end - begin;
+        for (; recorded < end; ++recorded) {
+          json element_reply =
+              (mapped ? reply["payload"][recorded - begin] : reply);
+          const bool accepted = (mapped && check(element_reply));
+          Record(s, recorded, std::move(element_reply), accepted, result);
+        }
+      }
+    } catch (const std::exception &e) {
+      // the elements recorded so far stand; the others fail with the error
+      json error;
+      error["status"] = "ERROR";
+      error["payload"] = e.what();
+      for (; recorded < entries_.size(); ++recorded) {
+        Record(s, recorded, error, false, result);
+      }
     }
-    return (j);
+    Clear();
+    return (result);
   }
 };
 
@@ -334,14 +3473,15 @@ public:
  * \param [in] v The variable object.
  * \return The endpoint reply as a json object.
  */
-json AddVariable(Endpoint &ep, Session s, Variable v) {
+json AddVariable(Endpoint &ep, Session &s, const Variable &v) {
   json request, reply;
-  request["request"] = "addVariable";
-  request["payload"] = v.ToJson();
-  reply = ep.SendRequest(request);
+  v.Write(ep.BeginRequest("addVariable"));
+  reply = ep.EndRequest();
   if (check(reply)) {
     s.AddVariable(v);
   } else {
+    request["request"] = "addVariable";
+    request["payload"] = v.ToJson();
     std::cerr << "Request failed!" << std::endl;
     std::cerr << "Request contents:\n";
     std::cerr << request;
@@ -362,15 +3502,22 @@ json AddVariable(Endpoint &ep, Session s, Variable v) {
  * \param [in] f The factor object.
  * \return The endpoint reply as a json object.
  */
-json AddFactor(Endpoint &ep, Session s, Factor f) {
+json AddFactor(Endpoint &ep, Session &s, const Factor &f) {
   json request, reply;
-  request["request"] = "addFactor";
-  request["payload"] = f.ToJson();
-  // request["factor"]["factorType"] will contain the actual factor type
-  reply = ep.SendRequest(request);
+  const uint64_t references =
+      (check(SyncNoiseModels(ep, s)) && s.noise_models().enabled()
+           ? s.noise_models().registry()
+           : 0);
+  Writer &w = ep.BeginRequest("addFactor");
+  w.SetModelReferences(references);
+  f.Write(w);
+  // the payload's "factorType" will contain the actual factor type
+  reply = ep.EndRequest();
   if (check(reply)) {
-    s.AddFactor(f);
+    s.AddFactor(f, ReplyLabel(reply));
   } else {
+    request["request"] = "addFactor";
+    request["payload"] = f.ToJson();
     std::cerr << "Request failed!" << std::endl;
     std::cerr << "Request contents:\n";
     std::cerr << request;
@@ -382,16 +3529,126 @@ json AddFactor(Endpoint &ep, Session s, Factor f) {
   return (reply);
 }
 
-// TODO: revise to comply with GSG (arguments are value, const ref, or
-// pointers!)
-json RegisterRobot(Endpoint &ep, Robot robot) {
+/**
+ * \brief Add a variable to the current session's factor graph without waiting
+ * for the reply. The session is updated once the reply is processed, so it
+ * must outlive the request.
+ *
+ * \param [in] ep The pipelined endpoint object.
+ * \param [in] s The session object
+ * \param [in] v The variable object.
+ * \return A future holding the endpoint reply.
+ */
+inline std::future<json> AddVariable(AsyncEndpoint &ep, Session &s,
+                                    const Variable &v) {
+  std::shared_ptr<std::promise<json>> promise(new std::promise<json>());
+  v.Write(ep.BeginRequest("addVariable"));
+  ep.EndRequest([&s, v, promise](const json &reply) {
+    if (check(reply)) {
+      s.AddVariable(v);
+    } else {
+      json request;
+      request["request"] = "addVariable";
+      request["payload"] = v.ToJson();
+      std::cerr << "Request failed!" << std::endl;
+      std::cerr << "Request contents:\n";
+      std::cerr << request;
+      std::cerr << "\n\n" << std::endl;
+      std::cerr << "Reply contents:\n";
+      std::cerr << reply;
+      std::cerr << "\n\n" << std::endl;
+    }
+    promise->set_value(reply);
+  });
+  return (promise->get_future());
+}
+
+/**
+ * \brief Add a factor to the current session's factor graph without waiting
+ * for the reply. The session is updated once the reply is processed, so it
+ * must outlive the request.
+ *
+ * \param [in] ep The pipelined endpoint object.
+ * \param [in] s The session object
+ * \param [in] f The factor object.
+ * \return A future holding the endpoint reply.
+ */
+inline std::future<json> AddFactor(AsyncEndpoint &ep, Session &s,
+                                   const Factor &f) {
+  std::shared_ptr<std::promise<json>> promise(new std::promise<json>());
+  // no round trip here to register models: until SyncNoiseModels() has,
+  // measurements are sent in full
+  Writer &w = ep.BeginRequest("addFactor");
+  w.SetModelReferences(
+      s.noise_models().enabled() && !s.noise_models().pending()
+          ? s.noise_models().registry()
+          : 0);
+  f.Write(w);
+  ep.EndRequest([&s, f, promise](const json &reply) {
+    if (check(reply)) {
+      s.AddFactor(f, ReplyLabel(reply));
+    } else {
+      json request;
+      request["request"] = "addFactor";
+      request["payload"] = f.ToJson();
+      std::cerr << "Request failed!" << std::endl;
+      std::cerr << "Request contents:\n";
+      std::cerr << request;
+      std::cerr << "\n\n" << std::endl;
+      std::cerr << "Reply contents:\n";
+      std::cerr << reply;
+      std::cerr << "\n\n" << std::endl;
+    }
+    promise->set_value(reply);
+  });
+  return (promise->get_future());
+}
+
+/**
+ * \brief Add several variables to the current session's factor graph using
+ * as few requests as possible.
+ *
+ * \param [in] ep The endpoint object.
+ * \param [in] s The session object
+ * \param [in] variables The variable objects.
+ * \return The aggregated endpoint reply (see Batch::Submit).
+ */
+inline json AddVariables(Endpoint &ep, Session &s,
+                         const std::vector<Variable> &variables) {
+  Batch batch;
+  for (const Variable &v : variables) {
+    batch.AddVariable(v);
+  }
+  return (batch.Submit(ep, s));
+}
+
+/**
+ * \brief Add several factors to the current session's factor graph using as
+ * few requests as possible.
+ *
+ * \param [in] ep The endpoint object.
+ * \param [in] s The session object
+ * \param [in] factors The factor objects.
+ * \return The aggregated endpoint reply (see Batch::Submit).
+ */
+inline json AddFactors(Endpoint &ep, Session &s,
+                       const std::vector<Factor> &factors) {
+  Batch batch;
+  for (const Factor &f : factors) {
+    batch.AddFactor(f);
+  }
+  return (batch.Submit(ep, s));
+}
+
+json RegisterRobot(Endpoint &ep, const Robot &robot) {
   json request, reply;
   request["request"] = "registerRobot";
   request["payload"]["robot"] = robot.Name();
   return (ep.SendRequest(request));
 }
 
-json RegisterSession(Endpoint &ep, Robot robot, Session session) {
+json RegisterSession(Endpoint &ep, const Robot &robot,
+                     const Session &session) {
   json request, reply;
   request["request"] = "registerSession";
   request["payload"]["robot"] = robot.Name();
@@ -400,20 +3657,162 @@ json RegisterSession(Endpoint &ep, Robot robot, Session session) {
 }
 
 // update the local estimates
-json UpdateSession(Endpoint &ep, Session &s) {
-  json reply;
-  // TODO: implementation
+/**
+ * \brief Refresh the session's estimate cache in a single request.
+ *
+ * Only the estimates that changed since the cached solve version are
+ * transferred (all of them on the first call). While the cache is fresh,
+ * i.e. until the next RequestSolve(), GetVarMAPMean() and GetVarMAPMax()
+ * (and GetVarMAPKDE(), if kde is set) are served from it without a round
+ * trip.
+ *
+ * \param [in] ep The endpoint object.
+ * \param [in] s The session object.
+ * \param [in] kde Whether to also fetch the beliefs of the variables.
+ * \return The endpoint reply as a json object.
+ */
+json UpdateSession(Endpoint &ep, Session &s, bool kde = false) {
+  json request, reply;
+  request["request"] = "getEstimates";
+  request["payload"]["since"] = s.EstimateVersion();
+  request["payload"]["kde"] = kde;
+  bool merged = false;
+  reply = ep.SendRequest(request, [&s, &merged](Reader &reader) {
+    return (merged = s.UpdateEstimates(reader));
+  });
+  if (check(reply) && !merged) {
+    reply["status"] = "ERROR";
+  }
   return (reply);
 }
 
-json RequestSolve(Endpoint &ep, Session &s) {
+/**
+ * \brief Request a solve of the session.
+ *
+ * The session records the version of the requested solve, so that the
+ * estimates of earlier solves are not taken for its own (see
+ * Session::SolveRequested()). The version is taken from the reply if the
+ * endpoint reports it there ({"version": n}); otherwise it is the one after
+ * the endpoint's latest solve, fetched just before the request.
+ *
+ * \param [in] ep The endpoint object.
+ * \param [in] s The session object.
+ */
+inline json RequestSolve(Endpoint &ep, Session &s) {
   json request;
+  // the latest solve version only: no estimate is newer than this
+  request["request"] = "getEstimates";
+  request["payload"]["since"] = std::numeric_limits<uint64_t>::max();
+  json latest = ep.SendRequest(request);
+  uint64_t version = s.EstimateVersion() + 1;
+  if (check(latest) && latest["payload"].is_object() &&
+      latest["payload"].value("version", json()).is_number_integer()) {
+    version = latest["payload"]["version"].get<uint64_t>() + 1;
+  }
+
+  request = json();
   request["request"] = "batchSolve";
   request["payload"] = "";
-  return (ep.SendRequest(request));
+  json reply = ep.SendRequest(request);
+  if (check(reply)) {
+    if (reply["payload"].is_object() &&
+        reply["payload"].value("version", json()).is_number_integer()) {
+      version = reply["payload"]["version"].get<uint64_t>();
+    }
+    s.SolveRequested(version);
+  }
+  return (reply);
+}
+
+/**
+ * \brief Wait for the endpoint to report that a solve of the session has
+ * finished, instead of sleeping after RequestSolve().
+ *
+ * If the endpoint is subscribed to the session's events (see
+ * Endpoint::Subscribe()), which must be done before the solve is requested,
+ * the events received in the meantime, including estimate updates, are
+ * applied to the session. Otherwise the estimates are polled (see
+ * UpdateSession()) until they are available. Either way, it waits for the
+ * solve last requested with RequestSolve() (see Session::RequestedVersion()),
+ * not merely for any solve newer than the cached estimates; without one, for
+ * the next solve after them.
+ *
+ * \param [in] ep The endpoint object.
+ * \param [in] s The session object.
+ * \param [in] timeout_ms How long to wait (-1 waits forever).
+ * \param [in] poll_ms The polling period, when not subscribed.
+ * \return The "solveFinished" event (made up from the estimates version when
+ * polling), or an ERROR reply if the solve did not finish in time.
+ */
+inline json WaitForSolve(Endpoint &ep, Session &s, long timeout_ms,
+                         long poll_ms = 100) {
+  typedef std::chrono::steady_clock clock;
+  const clock::time_point deadline =
+      clock::now() + std::chrono::milliseconds(timeout_ms);
+  json event, reply;
+  long remaining = timeout_ms;
+  const uint64_t version =
+      (s.RequestedVersion() > 0 ? s.RequestedVersion()
+                                : s.EstimateVersion() + 1);
+  if (!ep.Subscribed()) {
+    while (true) {
+      reply = UpdateSession(ep, s);
+      if (check(reply) && s.EstimateVersion() >= version) {
+        event["event"] = "solveFinished";
+        event["version"] = s.EstimateVersion();
+        return (event);
+      }
+      if (timeout_ms >= 0 && clock::now() + std::chrono::milliseconds(
+                                                poll_ms) > deadline) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms));
+    }
+    reply["status"] = "ERROR";
+    reply["payload"] = "timed out polling for the solve";
+    return (reply);
+  }
+  while (ep.NextEvent(event, remaining)) {
+    // an event without a version is taken for the requested solve
+    if ("solveFinished" == s.ApplyEvent(event) &&
+        (!event.value("version", json()).is_number_integer() ||
+         event["version"].get<uint64_t>() >= version)) {
+      return (event);
+    }
+    if (timeout_ms >= 0) {
+      remaining = static_cast<long>(
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              deadline - clock::now())
+              .count());
+      if (remaining < 0) {
+        break;
+      }
+    }
+  }
+  reply["status"] = "ERROR";
+  reply["payload"] = "timed out waiting for the solve";
+  return (reply);
+}
+
+// the cached estimate of a variable, if the session cache is fresh
+inline const Estimate *FreshEstimate(const Session &s,
+                                     const std::string &variable) {
+  return (s.EstimatesFresh() ? s.FindEstimate(variable) : nullptr);
+}
+
+// a reply as the endpoint would send it
+inline json LocalReply(const json &payload) {
+  json reply;
+  reply["status"] = "OK";
+  reply["payload"] = payload;
+  return (reply);
 }
 
 json GetVarMAPKDE(Endpoint &ep, Session &s, const std::string &variable) {
+  const Estimate *estimate = FreshEstimate(s, variable);
+  if (estimate && !estimate->kde.is_null()) {
+    return (LocalReply(estimate->kde));
+  }
   json request;
   request["request"] = "GetVarMAPKDE";
   request["payload"] = variable;
@@ -421,6 +3820,10 @@ json GetVarMAPKDE(Endpoint &ep, Session &s, const std::string &variable) {
 }
 
 json GetVarMAPMax(Endpoint &ep, Session &s, const std::string &variable) {
+  const Estimate *estimate = FreshEstimate(s, variable);
+  if (estimate && !estimate->max.empty()) {
+    return (LocalReply(estimate->max));
+  }
   json request;
   request["request"] = "GetVarMAPMax";
   request["payload"] = variable;
@@ -428,12 +3831,218 @@ json GetVarMAPMax(Endpoint &ep, Session &s, const std::string &variable) {
 }
 
 json GetVarMAPMean(Endpoint &ep, Session &s, const std::string &variable) {
+  const Estimate *estimate = FreshEstimate(s, variable);
+  if (estimate && !estimate->mean.empty()) {
+    return (LocalReply(estimate->mean));
+  }
   json request;
   request["request"] = "GetVarMAPMean";
   request["payload"] = variable;
   return (ep.SendRequest(request));
 }
 
+// send a request whose payload is read into a typed result; an OK reply
+// whose payload was not accepted (and so was decoded) becomes an ERROR one
+inline json SendTyped(Endpoint &ep, const json &request,
+                      const PayloadReader &read) {
+  json reply = ep.SendRequest(request, read);
+  if (check(reply) && reply.find("payload") != reply.end()) {
+    reply["status"] = "ERROR";
+  }
+  return (reply);
+}
+
+// a typed reply served locally, as SendTyped() would return it
+inline json LocalReply(void) {
+  json reply;
+  reply["status"] = "OK";
+  return (reply);
+}
+
+// a MAP point estimate, read straight into a vector
+inline json GetVarMAPPoint(Endpoint &ep, Session &s, bool max,
+                           const std::string &variable,
+                           std::vector<double> &point) {
+  const Estimate *estimate = FreshEstimate(s, variable);
+  if (estimate && !(max ? estimate->max : estimate->mean).empty()) {
+    point = (max ? estimate->max : estimate->mean);
+    return (LocalReply());
+  }
+  json request;
+  request["request"] = (max ? "GetVarMAPMax" : "GetVarMAPMean");
+  request["payload"] = variable;
+  return (SendTyped(ep, request, [&point](Reader &reader) {
+    return (reader.Doubles(point));
+  }));
+}
+
+/**
+ * \brief Get the belief of a variable as a KDE, to evaluate it locally
+ * (see KDE).
+ * \param [in] ep The endpoint object.
+ * \param [in] s The session object; its cache is used while fresh.
+ * \param [in] variable The variable label.
+ * \param [out] kde The belief.
+ * \return The endpoint reply, without its payload if it is OK.
+ */
+inline json GetVarMAPKDE(Endpoint &ep, Session &s, const std::string &variable,
+                         KDE &kde) {
+  const Estimate *estimate = FreshEstimate(s, variable);
+  if (estimate && kde.FromJson(estimate->kde)) {
+    return (LocalReply());
+  }
+  json request;
+  request["request"] = "GetVarMAPKDE";
+  request["payload"] = variable;
+  return (SendTyped(ep, request,
+                    [&kde](Reader &reader) { return (kde.Read(reader)); }));
+}
+
+/**
+ * \brief Get the MAP max of a variable straight into a vector, without
+ * decoding the reply into a json DOM.
+ * \param [in] ep The endpoint object.
+ * \param [in] s The session object; its cache is used while fresh.
+ * \param [in] variable The variable label.
+ * \param [out] max The estimate.
+ * \return The endpoint reply, without its payload if it is OK.
+ */
+inline json GetVarMAPMax(Endpoint &ep, Session &s, const std::string &variable,
+                         std::vector<double> &max) {
+  return (GetVarMAPPoint(ep, s, true, variable, max));
+}
+
+/**
+ * \brief Get the MAP mean of a variable straight into a vector (see
+ * GetVarMAPMax(Endpoint &, Session &, const std::string &,
+ * std::vector<double> &)).
+ */
+inline json GetVarMAPMean(Endpoint &ep, Session &s, const std::string &variable,
+                          std::vector<double> &mean) {
+  return (GetVarMAPPoint(ep, s, false, variable, mean));
+}
+
+// the estimates of several variables from the session cache, if it is fresh
+// and holds all of them
+inline bool CachedEstimates(const Session &s, EstimateField field,
+                            const std::vector<std::string> &variables,
+                            EstimateArray &out) {
+  out = EstimateArray(field);
+  out.SetVersion(s.EstimateVersion());
+  for (const std::string &variable : variables) {
+    const Estimate *estimate = FreshEstimate(s, variable);
+    if (!estimate) {
+      return (false);
+    }
+    const std::vector<double> &point =
+        (EstimateField::kMax == field ? estimate->max : estimate->mean);
+    if (EstimateField::kKde != field && !point.empty()) {
+      out.Append(variable, point.size(), point.data(), point.size());
+    } else if (EstimateField::kKde == field && estimate->kde.is_object()) {
+      const std::vector<double> points = estimate->kde.value(
+          "points", std::vector<double>());
+      const std::vector<double> bandwidths = estimate->kde.value(
+          "bandwidths", std::vector<double>());
+      out.Append(variable, estimate->kde.value("dim", bandwidths.size()),
+                 points.data(), points.size(),
+                 (bandwidths.empty() ? nullptr : bandwidths.data()));
+    } else {
+      return (false);
+    }
+  }
+  return (true);
+}
+
+inline json GetVarsMAPRequest(EstimateField field,
+                              const std::vector<std::string> &variables) {
+  json request;
+  request["request"] = "GetVarsMAP";
+  request["payload"]["field"] = EstimateFieldName(field);
+  request["payload"]["labels"] = variables;
+  return (request);
+}
+
+inline json GetVarsMAPRequest(EstimateField field, const std::string &prefix) {
+  json request;
+  request["request"] = "GetVarsMAP";
+  request["payload"]["field"] = EstimateFieldName(field);
+  request["payload"]["prefix"] = prefix;
+  return (request);
+}
+
+/**
+ * \brief Get an estimate of several variables in a single request.
+ *
+ * While the session cache is fresh and holds the estimate of every variable
+ * (see UpdateSession()), the reply is built from it without a round trip.
+ *
+ * \param [in] ep The endpoint object.
+ * \param [in] s The session object.
+ * \param [in] field The estimate to get: mean, max or KDE.
+ * \param [in] variables The variable labels.
+ * \return The endpoint reply; its payload is laid out as an EstimateArray
+ * (estimates in the order of the labels), or lists the unknown labels.
+ */
+inline json GetVarsMAP(Endpoint &ep, Session &s, EstimateField field,
+                       const std::vector<std::string> &variables) {
+  EstimateArray local;
+  if (CachedEstimates(s, field, variables, local)) {
+    return (LocalReply(local.ToJson()));
+  }
+  return (ep.SendRequest(GetVarsMAPRequest(field, variables)));
+}
+
+/**
+ * \brief Get an estimate of several variables straight into an
+ * EstimateArray, without decoding the reply into a json DOM.
+ *
+ * \param [in] ep The endpoint object.
+ * \param [in] s The session object; its cache is used while fresh.
+ * \param [in] field The estimate to get: mean, max or KDE.
+ * \param [in] variables The variable labels.
+ * \param [out] out The estimates, in the order of the labels.
+ * \return The endpoint reply, without its payload if it is OK; else its
+ * payload lists the unknown labels.
+ */
+inline json GetVarsMAP(Endpoint &ep, Session &s, EstimateField field,
+                       const std::vector<std::string> &variables,
+                       EstimateArray &out) {
+  if (CachedEstimates(s, field, variables, out)) {
+    return (LocalReply());
+  }
+  return (SendTyped(ep, GetVarsMAPRequest(field, variables),
+                    [&out](Reader &reader) { return (out.Read(reader)); }));
+}
+
+/**
+ * \brief Get an estimate of every variable whose label starts with a prefix,
+ * e.g. "x" for all the poses, in a single request.
+ * \param [in] ep The endpoint object.
+ * \param [in] field The estimate to get: mean, max or KDE.
+ * \param [in] prefix The label prefix ("" for every variable).
+ * \return The endpoint reply; its payload is laid out as an EstimateArray,
+ * in label order.
+ */
+inline json GetVarsMAP(Endpoint &ep, EstimateField field,
+                       const std::string &prefix) {
+  return (ep.SendRequest(GetVarsMAPRequest(field, prefix)));
+}
+
+/**
+ * \brief Get an estimate of every variable whose label starts with a prefix
+ * straight into an EstimateArray, without decoding the reply into a json DOM.
+ * \param [in] ep The endpoint object.
+ * \param [in] field The estimate to get: mean, max or KDE.
+ * \param [in] prefix The label prefix ("" for every variable).
+ * \param [out] out The estimates, in label order.
+ * \return The endpoint reply, without its payload if it is OK.
+ */
+inline json GetVarsMAP(Endpoint &ep, EstimateField field,
+                       const std::string &prefix, EstimateArray &out) {
+  return (SendTyped(ep, GetVarsMAPRequest(field, prefix),
+                    [&out](Reader &reader) { return (out.Read(reader)); }));
+}
+
 json RequestShutdown(Endpoint &ep) {
   json request;
   request["request"] = "shutdown";
@@ -447,7 +4056,7 @@ json RequestShutdown(Endpoint &ep) {
 fulfilling them, it will simply print their contents.
  * \param [in] ep The endpoint object
  */
-json ToggleMockMode(Endpoint &ep, bool &mock = true) {
+json ToggleMockMode(Endpoint &ep, bool mock = true) {
   json request;
   request["request"] = "toggleMockServer";
   request["payload"] = mock;
@@ -488,6 +4097,69 @@ json ListFactors(Endpoint &ep) {
   return (ep.SendRequest(request));
 }
 
+/**
+ * \brief Request a page of the variable or factor labels in the current
+ * session, in label order.
+ * \param [in] ep The endpoint object.
+ * \param [in] kind "variables" or "factors".
+ * \param [in] after The cursor: the last label of the previous page, or ""
+ * for the first page.
+ * \param [in] limit The most labels to return.
+ * \param [in] prefix Only list the labels starting with it.
+ * \return The endpoint reply; its payload holds the "labels" and the cursor
+ * of the "next" page, "" after the last one.
+ */
+inline json ListPage(Endpoint &ep, const std::string &kind,
+                     const std::string &after, std::size_t limit,
+                     const std::string &prefix = std::string()) {
+  json request;
+  request["request"] = "ls";
+  request["payload"]["kind"] = kind;
+  request["payload"]["after"] = after;
+  request["payload"]["limit"] = limit;
+  request["payload"]["prefix"] = prefix;
+  return (ep.SendRequest(request));
+}
+
+/**
+ * \brief Visit the variable or factor labels in the current session, a page
+ * at a time, so that neither side holds the whole listing.
+ * \param [in] ep The endpoint object.
+ * \param [in] kind "variables" or "factors".
+ * \param [in] visit Called with each label, in label order.
+ * \param [in] prefix Only list the labels starting with it.
+ * \param [in] page The most labels per request.
+ * \return The first error reply, or an OK reply whose payload is the number
+ * of labels visited.
+ */
+inline json ForEachLabel(Endpoint &ep, const std::string &kind,
+                         const std::function<void(const std::string &)> &visit,
+                         const std::string &prefix = std::string(),
+                         std::size_t page = 1000) {
+  std::string cursor;
+  std::size_t visited = 0;
+  do {
+    json reply = ListPage(ep, kind, cursor, page, prefix);
+    if (!check(reply)) {
+      return (reply);
+    }
+    const json &payload = reply["payload"];
+    auto labels = payload.find("labels");
+    auto next = payload.find("next");
+    if (labels == payload.end() || !labels->is_array() ||
+        next == payload.end() || !next->is_string()) {
+      reply["status"] = "ERROR";
+      return (reply);
+    }
+    for (const json &label : *labels) {
+      visit(label.get<std::string>());
+      ++visited;
+    }
+    cursor = next->get<std::string>();
+  } while (!cursor.empty());
+  return (LocalReply(visited));
+}
+
 // TODO: plot commands/triggers
 
 } // namespace graff
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <graff/graff.hpp>
+
+namespace graff {
+
+/*!
+ * \class Journal journal.hpp
+ * \brief An append-only log of the elements recorded in a session, written as
+ * they are added, so that a crash loses at most the record being written.
+ *
+ * Each record is the add request sent to the endpoint, plus the label a
+ * factor was recorded under, e.g.
+ * {"label":"fx0x1","payload":{...},"request":"addFactor"}. JSON journals hold
+ * one record per line (JSON lines). Binary journals start with the line
+ * "GRAFFJ1" and a line naming the encoding, and each record is preceded by
+ * its size as a 32-bit little-endian integer.
+ *
+ * \code
+ *   graff::Journal journal("mission.jsonl");
+ *   session.SetObserver(&journal);
+ * \endcode
+ */
+class Journal : public SessionObserver {
+  std::FILE *file_;
+  Writer writer_;
+  bool flush_;
+  std::size_t records_;
+
+  void Append(void) {
+    if (Encoding::kJson == writer_.encoding()) {
+      std::fwrite(writer_.data(), 1, writer_.size(), file_);
+      std::fputc('\n', file_);
+    } else {
+      const uint32_t size = static_cast<uint32_t>(writer_.size());
+      unsigned char prefix[4];
+      for (int i = 0; i < 4; ++i) {
+        prefix[i] = static_cast<unsigned char>((size >> (8 * i)) & 0xff);
+      }
+      std::fwrite(prefix, 1, sizeof(prefix), file_);
+      std::fwrite(writer_.data(), 1, writer_.size(), file_);
+    }
+    if (flush_) {
+      std::fflush(file_);
+    }
+    ++records_;
+  }
+
+public:
+  static const char *Magic(void) { return ("GRAFFJ1\n"); }
+
+  /*!
+   * \brief Open a journal for appending, creating it if needed.
+   * \param [in] path The journal file.
+   * \param [in] encoding The record encoding; must match that of an existing
+   * journal.
+   * \param [in] flush Whether to flush every record to the operating system
+   * as it is written (so it survives a crash of the process).
+   * \throws std::runtime_error if the file cannot be opened or holds a
+   * journal in another encoding.
+   */
+  explicit Journal(const std::string &path,
+                   Encoding encoding = Encoding::kJson, bool flush = true)
+      : file_(std::fopen(path.c_str(), "ab")), writer_(encoding),
+        flush_(flush), records_(0) {
+    if (!file_) {
+      throw std::runtime_error("Journal: cannot open " + path);
+    }
+    std::fseek(file_, 0, SEEK_END);
+    if (0 == std::ftell(file_)) {
+      if (Encoding::kJson != encoding) {
+        const std::string header = Magic() + EncodingName(encoding) + "\n";
+        std::fwrite(header.data(), 1, header.size(), file_);
+        std::fflush(file_);
+      }
+      return;
+    }
+    // appending: check the encoding of the existing records
+    std::FILE *existing = std::fopen(path.c_str(), "rb");
+    char header[64] = {0};
+    const bool binary =
+        (existing && std::fgets(header, sizeof(header), existing) &&
+         0 == std::strcmp(header, Magic()));
+    Encoding found = Encoding::kJson;
+    if (binary && std::fgets(header, sizeof(header), existing)) {
+      header[std::strcspn(header, "\n")] = '\0';
+      EncodingFromName(header, found);
+    }
+    if (existing) {
+      std::fclose(existing);
+    }
+    if (found != encoding || binary != (Encoding::kJson != encoding)) {
+      std::fclose(file_);
+      throw std::runtime_error("Journal: " + path +
+                               " holds records in another encoding");
+    }
+  }
+
+  ~Journal() { std::fclose(file_); }
+
+  Journal(const Journal &) = delete;
+  Journal &operator=(const Journal &) = delete;
+
+  void VariableAdded(const Variable &variable) override {
+    writer_.Clear();
+    writer_.SetCovarianceForms(true); // read back by ReplayJournal()
+    writer_.BeginObject(2);
+    writer_.Key("payload");
+    variable.Write(writer_);
+    writer_.Key("request");
+    writer_.String("addVariable");
+    writer_.EndObject();
+    Append();
+  }
+
+  void FactorAdded(const Factor &factor) override {
+    writer_.Clear();
+    writer_.SetCovarianceForms(true);
+    writer_.BeginObject(3);
+    writer_.Key("label");
+    factor.symbol().Write(writer_);
+    writer_.Key("payload");
+    factor.Write(writer_);
+    writer_.Key("request");
+    writer_.String("addFactor");
+    writer_.EndObject();
+    Append();
+  }
+
+  /*! \brief Flush the records written so far to the operating system. */
+  void Flush(void) { std::fflush(file_); }
+
+  /*! \brief The number of records written by this object. */
+  std::size_t records(void) const { return (records_); }
+};
+
+/*!
+ * \class JournalReader journal.hpp
+ * \brief Reads back the records of a Journal, in order.
+ */
+class JournalReader {
+  std::FILE *file_;
+  Encoding encoding_;
+  std::string buffer_;
+  bool truncated_;
+
+public:
+  /*!
+   * \brief Open a journal; its encoding is detected from its header.
+   * \throws std::runtime_error if it cannot be opened.
+   */
+  explicit JournalReader(const std::string &path)
+      : file_(std::fopen(path.c_str(), "rb")), encoding_(Encoding::kJson),
+        truncated_(false) {
+    if (!file_) {
+      throw std::runtime_error("JournalReader: cannot open " + path);
+    }
+    char header[64] = {0};
+    if (std::fgets(header, sizeof(header), file_) &&
+        0 == std::strcmp(header, Journal::Magic()) &&
+        std::fgets(header, sizeof(header), file_)) {
+      header[std::strcspn(header, "\n")] = '\0';
+      if (!EncodingFromName(header, encoding_)) {
+        std::fclose(file_);
+        throw std::runtime_error("JournalReader: unknown encoding in " +
+                                 path);
+      }
+    } else {
+      std::rewind(file_); // JSON lines, no header
+    }
+  }
+
+  ~JournalReader() { std::fclose(file_); }
+
+  JournalReader(const JournalReader &) = delete;
+  JournalReader &operator=(const JournalReader &) = delete;
+
+  Encoding encoding(void) const { return (encoding_); }
+
+  /*!
+   * \brief Read the next record.
+   * \param [out] record The decoded record.
+   * \return false at the end of the journal, or at a record that was cut
+   * short (e.g. by a crash while it was written), see truncated().
+   */
+  bool Next(json &record) {
+    buffer_.clear();
+    if (Encoding::kJson == encoding_) {
+      char chunk[4096];
+      while (std::fgets(chunk, sizeof(chunk), file_)) {
+        buffer_ += chunk;
+        if ('\n' == buffer_.back()) {
+          buffer_.pop_back();
+          if (buffer_.empty()) {
+            continue; // blank line
+          }
+          break;
+        }
+      }
+      if (buffer_.empty()) {
+        return (false);
+      }
+    } else {
+      unsigned char prefix[4];
+      const std::size_t n = std::fread(prefix, 1, sizeof(prefix), file_);
+      if (0 == n) {
+        return (false);
+      }
+      uint32_t size = 0;
+      for (int i = 0; i < 4; ++i) {
+        size |= static_cast<uint32_t>(prefix[i]) << (8 * i);
+      }
+      buffer_.resize(size);
+      if (n < sizeof(prefix) ||
+          std::fread(&buffer_[0], 1, size, file_) < size) {
+        truncated_ = true;
+        return (false);
+      }
+    }
+    try {
+      record = Decode(buffer_.data(), buffer_.size(), encoding_);
+    } catch (const std::exception &) {
+      truncated_ = true;
+      return (false);
+    }
+    return (true);
+  }
+
+  /*! \brief Whether reading stopped at an incomplete record. */
+  bool truncated(void) const { return (truncated_); }
+};
+
+/*!
+ * \brief Rebuild a variable from its add request payload.
+ * \throws std::invalid_argument (or a json exception) if it is malformed.
+ */
+inline Variable VariableFromJson(const json &payload) {
+  auto label = payload.find("label");
+  auto type = payload.find("variableType");
+  if (label == payload.end() || type == payload.end()) {
+    throw std::invalid_argument("variable: missing label or variableType");
+  }
+  return (Variable(label->get<std::string>(), type->get<std::string>()));
+}
+
+/*!
+ * \brief Rebuild a factor from its add request payload.
+ * \throws std::invalid_argument (or a json exception) if it is malformed.
+ */
+inline Factor FactorFromJson(const json &payload) {
+  auto type = payload.find("factorType");
+  auto variables = payload.find("variables");
+  if (type == payload.end() || variables == payload.end()) {
+    throw std::invalid_argument("factor: missing factorType or variables");
+  }
+  Factor factor(type->get<std::string>(),
+                variables->get<std::vector<std::string>>());
+  auto measured = payload.find("factor");
+  if (measured != payload.end()) {
+    for (const json &distribution : measured->at("measurement")) {
+      std::unique_ptr<Distribution> decoded =
+          DistributionFromJson(distribution);
+      if (!decoded) {
+        throw std::invalid_argument("factor: unknown distribution " +
+                                    distribution.dump());
+      }
+      factor.push_back(Measurement(std::move(decoded)));
+    }
+  }
+  return (factor);
+}
+
+/*!
+ * \brief Rebuild a session from a journal, without contacting the endpoint.
+ * \param [in] path The journal file.
+ * \param [in] s The session to record the elements in.
+ * \return The number of records replayed.
+ * \throws std::runtime_error if the journal cannot be read, and
+ * std::invalid_argument if a record is malformed.
+ */
+inline std::size_t ReplayJournal(const std::string &path, Session &s) {
+  JournalReader reader(path);
+  json record;
+  std::size_t count = 0;
+  while (reader.Next(record)) {
+    const json &payload = record.at("payload");
+    if ("addFactor" == record.at("request")) {
+      auto label = record.find("label");
+      s.AddFactor(FactorFromJson(payload),
+                  (label == record.end() ? std::string()
+                                         : label->get<std::string>()));
+    } else {
+      s.AddVariable(VariableFromJson(payload));
+    }
+    ++count;
+  }
+  return (count);
+}
+
+/*!
+ * \brief Resubmit the elements of a journal to the endpoint, in batches.
+ *
+ * Elements accepted by the endpoint are recorded in the session, under the
+ * labels the endpoint assigns. The journal is streamed, so only one batch of
+ * elements is held in memory at a time.
+ *
+ * \param [in] path The journal file.
+ * \param [in] ep The endpoint object.
+ * \param [in] s The session object.
+ * \param [in] max_elements Maximum number of elements per request.
+ * \param [in] max_bytes Maximum encoded size of a request, in bytes.
+ * \return The overall "status", the number of records submitted as
+ * "payload", and the (record) indices of rejected elements under "failed".
+ */
+inline json ReplayJournal(const std::string &path, Endpoint &ep, Session &s,
+                          std::size_t max_elements = 1024,
+                          std::size_t max_bytes = 1 << 20) {
+  JournalReader reader(path);
+  Batch batch(max_elements, max_bytes);
+  json record, result;
+  result["status"] = "OK";
+  result["failed"] = json::array();
+  std::size_t count = 0, submitted = 0;
+  bool more = true;
+  while (more) {
+    more = reader.Next(record);
+    if (more) {
+      const json &payload = record.at("payload");
+      if ("addFactor" == record.at("request")) {
+        batch.AddFactor(FactorFromJson(payload));
+      } else {
+        batch.AddVariable(VariableFromJson(payload));
+      }
+      ++count;
+    }
+    if (batch.size() >= max_elements || (!more && !batch.empty())) {
+      json reply = batch.Submit(ep, s);
+      if (!check(reply)) {
+        result["status"] = "ERROR";
+      }
+      for (const json &index : reply["failed"]) {
+        result["failed"].push_back(submitted + index.get<std::size_t>());
+      }
+      submitted = count;
+    }
+  }
+  result["payload"] = count;
+  return (result);
+}
+
+} // namespace graff
@@ -0,0 +1,436 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <graff/encoding.hpp>
+#include <graff/reader.hpp>
+
+namespace graff {
+
+/*!
+ * \class KDE kde.hpp
+ * \brief A belief as the endpoint returns it (see GetVarMAPKDE()): a kernel
+ * density estimate with Gaussian kernels, evaluated locally.
+ *
+ * The kernel points are stored dimension-major (all the first coordinates,
+ * then all the second ones, ...) so that evaluating the kernels is a set of
+ * contiguous loops over the points, which the compiler vectorizes; batches
+ * of queries are spread over threads. The kernels share one bandwidth (a
+ * standard deviation) per dimension, and are equally weighted unless the
+ * belief carries "weights". Coordinates are treated as Euclidean, angles
+ * included.
+ *
+ * \code
+ *   graff::KDE belief;
+ *   reply = graff::GetVarMAPKDE(ep, session, "x1", belief);
+ *   if (check(reply)) {
+ *     std::vector<double> mode = belief.Mode();
+ *     graff::KDE xy = belief.Marginal({0, 1});
+ *   }
+ * \endcode
+ */
+class KDE {
+  std::size_t dim_;
+  std::size_t size_;               /*!< number of kernels */
+  std::vector<double> points_;     /*!< dim_ rows of size_ coordinates */
+  std::vector<double> bandwidths_; /*!< per dimension */
+  std::vector<double> scales_;     /*!< inverse bandwidths */
+  std::vector<double> weights_;    /*!< per kernel, summing to 1 */
+  bool weighted_;                  /*!< whether the weights were given */
+  double norm_;                    /*!< normalizes a kernel */
+
+  // kernels evaluated at once, on the stack
+  enum : std::size_t { kBlock = 64 };
+  // kernel evaluations below which a batch is not worth another thread
+  enum : std::size_t { kWorkPerThread = 1 << 16 };
+
+  // the squared Mahalanobis distances from x to kernels [begin, begin + n)
+  void Distances(const double *x, std::size_t begin, std::size_t n,
+                 double *e) const {
+    std::fill(e, e + n, 0.0);
+    for (std::size_t d = 0; d < dim_; ++d) {
+      const double *p = points_.data() + d * size_ + begin;
+      const double xd = x[d], scale = scales_[d];
+      for (std::size_t i = 0; i < n; ++i) {
+        const double z = (xd - p[i]) * scale;
+        e[i] += z * z;
+      }
+    }
+  }
+
+  // the density at x of the kernels, times their weights
+  void Kernels(const double *x, std::size_t begin, std::size_t n,
+               double *k) const {
+    Distances(x, begin, n, k);
+    const double *w = weights_.data() + begin;
+    for (std::size_t i = 0; i < n; ++i) {
+      k[i] = w[i] * std::exp(-0.5 * k[i]);
+    }
+  }
+
+  // one mean-shift step from x; returns the (unnormalized) density at x
+  double Shift(const double *x, double *next) const {
+    double k[kBlock], total = 0.0;
+    std::fill(next, next + dim_, 0.0);
+    for (std::size_t begin = 0; begin < size_; begin += kBlock) {
+      const std::size_t n = std::min<std::size_t>(kBlock, size_ - begin);
+      Kernels(x, begin, n, k);
+      for (std::size_t i = 0; i < n; ++i) {
+        total += k[i];
+      }
+      for (std::size_t d = 0; d < dim_; ++d) {
+        const double *p = points_.data() + d * size_ + begin;
+        double sum = 0.0;
+        for (std::size_t i = 0; i < n; ++i) {
+          sum += k[i] * p[i];
+        }
+        next[d] += sum;
+      }
+    }
+    if (total > 0.0) {
+      for (std::size_t d = 0; d < dim_; ++d) {
+        next[d] /= total;
+      }
+    } else {
+      std::copy(x, x + dim_, next); // too far from every kernel to move
+    }
+    return (total);
+  }
+
+  void Prepare(void) {
+    scales_.resize(dim_);
+    const double two_pi = 6.283185307179586;
+    norm_ = std::pow(two_pi, -0.5 * static_cast<double>(dim_));
+    for (std::size_t d = 0; d < dim_; ++d) {
+      scales_[d] = 1.0 / bandwidths_[d];
+      norm_ *= scales_[d];
+    }
+    if (!weighted_) {
+      weights_.assign(size_, 1.0 / static_cast<double>(size_));
+      return;
+    }
+    double total = 0.0;
+    for (double w : weights_) {
+      total += w;
+    }
+    for (double &w : weights_) {
+      w /= total;
+    }
+  }
+
+public:
+  KDE(void) : dim_(0), size_(0), weighted_(false), norm_(0.0) {}
+
+  /*!
+   * \brief Build a belief from point-major kernel points, as laid out on the
+   * wire and in EstimateArray, e.g. KDE(a.dim(i), a.values(i), a.count(i),
+   * a.bandwidths(i)). The belief is empty if they are inconsistent.
+   */
+  KDE(std::size_t dim, const double *points, std::size_t count,
+      const double *bandwidths, const double *weights = nullptr)
+      : KDE() {
+    Assign(dim, points, count, bandwidths, weights);
+  }
+
+  /*!
+   * \brief Replace the belief.
+   * \param [in] dim The dimension of the variable.
+   * \param [in] points The kernel points, one after the other.
+   * \param [in] count Number of coordinates in points (dim per kernel).
+   * \param [in] bandwidths The dim kernel bandwidths.
+   * \param [in] weights The kernel weights, or nullptr for equal weights.
+   * \return false, leaving the belief empty, if count is not a multiple of
+   * dim or a bandwidth or weight is not positive.
+   */
+  bool Assign(std::size_t dim, const double *points, std::size_t count,
+              const double *bandwidths, const double *weights = nullptr) {
+    *this = KDE();
+    if (0 == dim || 0 == count || count % dim || !bandwidths) {
+      return (false);
+    }
+    for (std::size_t d = 0; d < dim; ++d) {
+      if (!(bandwidths[d] > 0.0)) {
+        return (false);
+      }
+    }
+    const std::size_t size = count / dim;
+    for (std::size_t i = 0; weights && i < size; ++i) {
+      if (!(weights[i] > 0.0)) {
+        return (false);
+      }
+    }
+    dim_ = dim;
+    size_ = size;
+    points_.resize(count);
+    for (std::size_t i = 0; i < size_; ++i) {
+      for (std::size_t d = 0; d < dim_; ++d) {
+        points_[d * size_ + i] = points[i * dim_ + d];
+      }
+    }
+    bandwidths_.assign(bandwidths, bandwidths + dim_);
+    weighted_ = (nullptr != weights);
+    if (weighted_) {
+      weights_.assign(weights, weights + size_);
+    }
+    Prepare();
+    return (true);
+  }
+
+  std::size_t dim(void) const { return (dim_); }
+  /*! \brief Number of kernels. */
+  std::size_t size(void) const { return (size_); }
+  bool empty(void) const { return (0 == size_); }
+
+  /*! \brief Coordinate d of every kernel point (size() values). */
+  const double *coordinates(std::size_t d) const {
+    return (points_.data() + d * size_);
+  }
+  const std::vector<double> &bandwidths(void) const { return (bandwidths_); }
+  /*! \brief The kernel weights, normalized. */
+  const std::vector<double> &weights(void) const { return (weights_); }
+
+  /*!
+   * \brief The density at a point.
+   * \param [in] x dim() coordinates.
+   */
+  double Density(const double *x) const {
+    double k[kBlock], density = 0.0;
+    for (std::size_t begin = 0; begin < size_; begin += kBlock) {
+      const std::size_t n = std::min<std::size_t>(kBlock, size_ - begin);
+      Kernels(x, begin, n, k);
+      for (std::size_t i = 0; i < n; ++i) {
+        density += k[i];
+      }
+    }
+    return (norm_ * density);
+  }
+
+  double Density(const std::vector<double> &x) const {
+    return (x.size() == dim_ ? Density(x.data()) : 0.0);
+  }
+
+  /*!
+   * \brief The density at many points, spread over threads if there are
+   * enough of them.
+   * \param [in] x count points of dim() coordinates, one after the other.
+   * \param [in] count Number of points.
+   * \param [out] density count densities.
+   * \param [in] threads Most threads to use; 0 for one per core.
+   */
+  void Density(const double *x, std::size_t count, double *density,
+               unsigned threads = 0) const {
+    if (0 == threads) {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    const std::size_t work = count * size_ * std::max<std::size_t>(dim_, 1);
+    const std::size_t workers = std::min<std::size_t>(
+        {threads, count, std::max<std::size_t>(1, work / kWorkPerThread)});
+    auto range = [this, x, density](std::size_t begin, std::size_t end) {
+      for (std::size_t j = begin; j < end; ++j) {
+        density[j] = Density(x + j * dim_);
+      }
+    };
+    if (workers <= 1) {
+      range(0, count);
+      return;
+    }
+    std::vector<std::thread> pool;
+    const std::size_t chunk = (count + workers - 1) / workers;
+    for (std::size_t begin = chunk; begin < count; begin += chunk) {
+      pool.emplace_back(range, begin, std::min(count, begin + chunk));
+    }
+    range(0, chunk);
+    for (std::thread &thread : pool) {
+      thread.join();
+    }
+  }
+
+  /*! \brief The mean of the belief. */
+  std::vector<double> Mean(void) const {
+    std::vector<double> mean(dim_, 0.0);
+    for (std::size_t d = 0; d < dim_; ++d) {
+      const double *p = coordinates(d);
+      double sum = 0.0;
+      for (std::size_t i = 0; i < size_; ++i) {
+        sum += weights_[i] * p[i];
+      }
+      mean[d] = sum;
+    }
+    return (mean);
+  }
+
+  /*!
+   * \brief Climb to the local maximum of the density nearest to a point,
+   * by mean shift.
+   * \param [in] start dim() coordinates.
+   * \param [in] iterations Most mean-shift steps.
+   * \param [in] tolerance Stop once a step moves less than this many
+   * bandwidths.
+   */
+  std::vector<double> Mode(const double *start, int iterations = 100,
+                           double tolerance = 1e-6) const {
+    std::vector<double> x(start, start + dim_), next(dim_);
+    for (int it = 0; it < iterations; ++it) {
+      Shift(x.data(), next.data());
+      double step = 0.0;
+      for (std::size_t d = 0; d < dim_; ++d) {
+        step = std::max(step, std::fabs(next[d] - x[d]) * scales_[d]);
+      }
+      x.swap(next);
+      if (step < tolerance) {
+        break;
+      }
+    }
+    return (x);
+  }
+
+  /*!
+   * \brief The mode of the belief (its MAP max): the maximum reached by mean
+   * shift from the kernel point where the density is highest.
+   * \param [in] threads Most threads to use to find that point; 0 for one
+   * per core.
+   */
+  std::vector<double> Mode(unsigned threads = 0) const {
+    if (empty()) {
+      return (std::vector<double>());
+    }
+    std::vector<double> points(size_ * dim_), density(size_);
+    for (std::size_t i = 0; i < size_; ++i) {
+      for (std::size_t d = 0; d < dim_; ++d) {
+        points[i * dim_ + d] = points_[d * size_ + i];
+      }
+    }
+    Density(points.data(), size_, density.data(), threads);
+    const std::size_t best = static_cast<std::size_t>(
+        std::max_element(density.begin(), density.end()) - density.begin());
+    return (Mode(points.data() + best * dim_));
+  }
+
+  /*!
+   * \brief The marginal belief over some of the dimensions, e.g. {0, 1} for
+   * the position of a Pose2.
+   * \return The belief over those dimensions, in that order; empty if one
+   * is out of range.
+   */
+  KDE Marginal(const std::vector<std::size_t> &dims) const {
+    KDE marginal;
+    for (std::size_t d : dims) {
+      if (d >= dim_) {
+        return (marginal);
+      }
+    }
+    if (dims.empty() || empty()) {
+      return (marginal);
+    }
+    marginal.dim_ = dims.size();
+    marginal.size_ = size_;
+    marginal.points_.reserve(dims.size() * size_);
+    for (std::size_t d : dims) {
+      marginal.points_.insert(marginal.points_.end(), coordinates(d),
+                              coordinates(d) + size_);
+      marginal.bandwidths_.push_back(bandwidths_[d]);
+    }
+    marginal.weighted_ = weighted_;
+    marginal.weights_ = weights_;
+    marginal.Prepare();
+    return (marginal);
+  }
+
+  /*!
+   * \brief The belief as the endpoint sends it: {"dim", "points" (point
+   * after point), "bandwidths"} and "weights" if they were given.
+   */
+  json ToJson(void) const {
+    json j;
+    std::vector<double> points(size_ * dim_);
+    for (std::size_t i = 0; i < size_; ++i) {
+      for (std::size_t d = 0; d < dim_; ++d) {
+        points[i * dim_ + d] = points_[d * size_ + i];
+      }
+    }
+    j["dim"] = dim_;
+    j["points"] = points;
+    j["bandwidths"] = bandwidths_;
+    if (weighted_) {
+      j["weights"] = weights_;
+    }
+    return (j);
+  }
+
+  /*!
+   * \brief Load a belief as the endpoint sends it (see ToJson()).
+   * \return false, leaving the belief empty, if it is malformed.
+   */
+  bool FromJson(const json &j) {
+    *this = KDE();
+    if (!j.is_object()) {
+      return (false);
+    }
+    auto dim = j.find("dim");
+    auto points = j.find("points");
+    auto bandwidths = j.find("bandwidths");
+    auto weights = j.find("weights");
+    if (dim == j.end() || !dim->is_number_unsigned() || points == j.end() ||
+        !points->is_array() || bandwidths == j.end() ||
+        !bandwidths->is_array()) {
+      return (false);
+    }
+    try {
+      const std::vector<double> p = points->get<std::vector<double>>();
+      const std::vector<double> h = bandwidths->get<std::vector<double>>();
+      const std::vector<double> w =
+          (weights == j.end() ? std::vector<double>()
+                              : weights->get<std::vector<double>>());
+      const std::size_t d = dim->get<std::size_t>();
+      if (h.size() != d || (!w.empty() && w.size() * d != p.size())) {
+        return (false);
+      }
+      return (Assign(d, p.data(), p.size(), h.data(),
+                     (w.empty() ? nullptr : w.data())));
+    } catch (const std::exception &) {
+      return (false);
+    }
+  }
+
+  /*!
+   * \brief Read a belief straight from a reply (see
+   * Endpoint::SendRequest(const json &, const PayloadReader &)).
+   * \return false if it is malformed.
+   */
+  bool Read(Reader &reader) {
+    *this = KDE();
+    std::vector<double> points, bandwidths, weights;
+    std::string key;
+    uint64_t dim = 0;
+    if (!reader.BeginObject()) {
+      return (false);
+    }
+    while (reader.Next() && reader.Key(key)) {
+      if ("dim" == key) {
+        reader.Unsigned(dim);
+      } else if ("points" == key) {
+        reader.Doubles(points);
+      } else if ("bandwidths" == key) {
+        reader.Doubles(bandwidths);
+      } else if ("weights" == key) {
+        reader.Doubles(weights);
+      } else {
+        reader.Skip();
+      }
+    }
+    if (!reader.ok() || bandwidths.size() != dim ||
+        (!weights.empty() && weights.size() * dim != points.size())) {
+      return (false);
+    }
+    return (Assign(static_cast<std::size_t>(dim), points.data(),
+                   points.size(), bandwidths.data(),
+                   (weights.empty() ? nullptr : weights.data())));
+  }
+};
+
+} // namespace graff
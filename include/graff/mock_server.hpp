@@ -0,0 +1,559 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <zmq.hpp>
+
+#include <graff/graff.hpp>
+
+namespace graff {
+
+/*!
+ * \class MockServer mock_server.hpp
+ * \brief A local stand-in for the Caesar endpoint, for testing and
+ * benchmarking clients without a Julia back-end.
+ *
+ * It speaks the same request protocol over a ROUTER socket, so it serves both
+ * Endpoint and AsyncEndpoint, in any of the wire encodings and compressions
+ * compiled in. Measurements that reference a noise model registered with
+ * "addNoiseModels" are expanded as the factors arrive, and compact
+ * covariances ("covForms") are accepted as they are. The factor graph
+ * is only recorded (labels, types and connectivity); solves complete at once
+ * (the batchSolve reply holds the version of the solve) and estimates are
+ * synthetic, zero-mean values of the right dimension. If
+ * given an events address, it publishes the solveStarted, estimates and
+ * solveFinished events of each solve there, and advertises the address in
+ * its status.
+ */
+class MockServer {
+  struct Graph {
+    std::map<std::string, std::string> variables; /*!< label -> type */
+    std::map<std::string, json> factors;          /*!< label -> factor */
+    std::map<std::string, uint64_t> solved; /*!< label -> last solve */
+    std::map<uint64_t, json> models;        /*!< noise model id -> normal */
+    uint64_t solves;
+    Graph() : solves(0) {}
+  };
+
+  zmq::socket_t socket_;
+  std::unique_ptr<zmq::socket_t> events_; /*!< PUB socket, if any */
+  std::string events_address_;            /*!< advertised in getStatus */
+  std::map<std::string, Graph> sessions_;
+  std::string session_; /*!< name of the current session */
+  Graph *graph_;        /*!< graph of the current session */
+  std::atomic<bool> running_;
+  std::atomic<uint64_t> requests_;
+  std::atomic<uint64_t> bytes_received_;
+  std::atomic<uint64_t> bytes_sent_;
+  std::atomic<uint64_t> factors_;
+  std::size_t compression_threshold_; /*!< smallest reply compressed */
+
+  static json Reply(const std::string &status, const json &payload) {
+    json reply;
+    reply["status"] = status;
+    reply["payload"] = payload;
+    return (reply);
+  }
+
+  // number of estimated values for a variable type
+  static std::size_t Dimension(const std::string &type) {
+    if ("Pose3" == type) {
+      return (6);
+    } else if ("Pose2" == type || "Point3" == type) {
+      return (3);
+    } else if ("Point2" == type) {
+      return (2);
+    }
+    return (1);
+  }
+
+  json AddVariable(const json &payload) {
+    auto label = payload.find("label");
+    auto type = payload.find("variableType");
+    if (label == payload.end() || !label->is_string() ||
+        type == payload.end() || !type->is_string()) {
+      return (Reply("ERROR", "addVariable: missing label or variableType"));
+    }
+    const std::string name = label->get<std::string>();
+    if (!graph_->variables.insert({name, type->get<std::string>()}).second) {
+      return (Reply("ERROR", "addVariable: duplicate label " + name));
+    }
+    return (Reply("OK", *label));
+  }
+
+  json AddNoiseModels(const json &payload) {
+    if (!payload.is_array()) {
+      return (Reply("ERROR", "addNoiseModels: expected a list of models"));
+    }
+    for (const json &model : payload) {
+      auto id = model.find("id");
+      auto distribution = model.find("distribution");
+      if (id == model.end() || !id->is_number_unsigned() ||
+          distribution == model.end() || !distribution->is_object()) {
+        return (Reply("ERROR", "addNoiseModels: missing id or distribution"));
+      }
+      auto known = graph_->models.find(id->get<uint64_t>());
+      if (known != graph_->models.end() && known->second != *distribution) {
+        return (
+            Reply("ERROR", "addNoiseModels: model " + id->dump() + " changed"));
+      }
+      graph_->models[id->get<uint64_t>()] = *distribution;
+    }
+    return (Reply("OK", payload.size()));
+  }
+
+  // expand the measurements that reference a noise model; false if a model
+  // is unknown
+  bool ExpandModels(json &factor) {
+    auto measured = factor.find("factor");
+    if (measured == factor.end() || !measured->is_object() ||
+        measured->find("measurement") == measured->end()) {
+      return (true);
+    }
+    for (json &measurement : (*measured)["measurement"]) {
+      auto id = measurement.find("model");
+      if (id == measurement.end()) {
+        continue;
+      }
+      auto model = (id->is_number_unsigned()
+                        ? graph_->models.find(id->get<uint64_t>())
+                        : graph_->models.end());
+      if (model == graph_->models.end()) {
+        return (false);
+      }
+      json expanded = model->second;
+      auto mean = measurement.find("mean");
+      if (mean != measurement.end()) {
+        expanded["mean"] = *mean;
+      }
+      measurement = expanded;
+    }
+    return (true);
+  }
+
+  json AddFactor(const json &request) {
+    json payload = request;
+    if (!ExpandModels(payload)) {
+      return (Reply("ERROR", "addFactor: unknown noise model"));
+    }
+    auto variables = payload.find("variables");
+    if (variables == payload.end() || !variables->is_array() ||
+        payload.find("factorType") == payload.end()) {
+      return (Reply("ERROR", "addFactor: missing factorType or variables"));
+    }
+    // caesar convention: 'f' followed by the variable labels
+    std::string label("f");
+    for (const json &variable : *variables) {
+      if (!variable.is_string() ||
+          !graph_->variables.count(variable.get<std::string>())) {
+        return (
+            Reply("ERROR", "addFactor: unknown variable " + variable.dump()));
+      }
+      label += variable.get<std::string>();
+    }
+    std::string unique(label);
+    for (int i = 1; graph_->factors.count(unique); ++i) {
+      unique = label + "_" + std::to_string(i);
+    }
+    graph_->factors[unique] = payload;
+    ++factors_;
+    return (Reply("OK", unique));
+  }
+
+  json Estimate(const std::string &request, const json &payload) {
+    const std::string label =
+        (payload.is_string() ? payload.get<std::string>() : std::string());
+    auto variable = graph_->variables.find(label);
+    if (variable == graph_->variables.end()) {
+      return (
+          Reply("ERROR", request + ": unknown variable " + payload.dump()));
+    }
+    const std::size_t dim = Dimension(variable->second);
+    if ("GetVarMAPKDE" != request) {
+      return (Reply("OK", std::vector<double>(dim, 0.0)));
+    }
+    return (Reply("OK", Kde(dim)));
+  }
+
+  // a deterministic cloud of kernel points around the origin, point-major
+  static json Kde(std::size_t dim) {
+    const std::size_t count = 100;
+    std::vector<double> points(count * dim);
+    for (std::size_t i = 0; i < points.size(); ++i) {
+      points[i] = 0.1 * std::sin(1.0 + static_cast<double>(i));
+    }
+    json kde;
+    kde["dim"] = dim;
+    kde["points"] = points;
+    kde["bandwidths"] = std::vector<double>(dim, 0.05);
+    return (kde);
+  }
+
+  // the estimates of the variables solved after a version
+  json EstimatesSince(uint64_t since, bool kde) {
+    json estimates = json::array();
+    for (const auto &solved : graph_->solved) {
+      if (solved.second <= since) {
+        continue;
+      }
+      const std::size_t dim = Dimension(graph_->variables[solved.first]);
+      json estimate;
+      estimate["label"] = solved.first;
+      estimate["version"] = solved.second;
+      estimate["mean"] = std::vector<double>(dim, 0.0);
+      estimate["max"] = std::vector<double>(dim, 0.0);
+      if (kde) {
+        estimate["kde"] = Kde(dim);
+      }
+      estimates.push_back(estimate);
+    }
+    json result;
+    result["version"] = graph_->solves;
+    result["estimates"] = estimates;
+    return (result);
+  }
+
+  json Estimates(const json &payload) {
+    uint64_t since = 0;
+    bool kde = false;
+    if (payload.is_object()) {
+      since = payload.value("since", static_cast<uint64_t>(0));
+      kde = payload.value("kde", false);
+    }
+    return (Reply("OK", EstimatesSince(since, kde)));
+  }
+
+  // publish an event of the current session
+  void Publish(const std::string &name, json event) {
+    if (!events_) {
+      return;
+    }
+    event["event"] = name;
+    event["version"] = graph_->solves;
+    const std::string body = event.dump();
+    zmq::message_t topic(session_.size());
+    memcpy(topic.data(), session_.data(), session_.size());
+    events_->send(topic, ZMQ_SNDMORE);
+    zmq::message_t body_msg(body.size());
+    memcpy(body_msg.data(), body.data(), body.size());
+    events_->send(body_msg);
+  }
+
+  json Solve(void) {
+    // solves complete immediately, and every variable is re-estimated
+    ++graph_->solves;
+    Publish("solveStarted", json::object());
+    for (const auto &variable : graph_->variables) {
+      graph_->solved[variable.first] = graph_->solves;
+    }
+    Publish("estimates", EstimatesSince(graph_->solves - 1, false));
+    Publish("solveFinished", json::object());
+    json solve;
+    solve["version"] = graph_->solves;
+    return (Reply("OK", solve));
+  }
+
+  // the estimates of several variables, laid out as an EstimateArray
+  json EstimatesOf(const std::string &field,
+                   const std::vector<std::string> &labels) {
+    EstimateField kind = EstimateField::kMean;
+    EstimateFieldFromName(field, kind);
+    EstimateArray estimates(kind);
+    estimates.SetVersion(graph_->solves);
+    json unknown = json::array();
+    for (const std::string &label : labels) {
+      auto variable = graph_->variables.find(label);
+      if (variable == graph_->variables.end()) {
+        unknown.push_back(label);
+        continue;
+      }
+      const std::size_t dim = Dimension(variable->second);
+      if (EstimateField::kKde == estimates.field()) {
+        const json kde = Kde(dim);
+        const std::vector<double> points = kde["points"];
+        const std::vector<double> bandwidths = kde["bandwidths"];
+        estimates.Append(label, dim, points.data(), points.size(),
+                         bandwidths.data());
+      } else {
+        const std::vector<double> values(dim, 0.0);
+        estimates.Append(label, dim, values.data(), dim);
+      }
+    }
+    if (!unknown.empty()) {
+      return (Reply("ERROR", {{"unknown", unknown}}));
+    }
+    return (Reply("OK", estimates.ToJson()));
+  }
+
+  json MultipleEstimates(const json &payload) {
+    if (!payload.is_object()) {
+      return (Reply("ERROR", "GetVarsMAP: missing labels or prefix"));
+    }
+    const std::string field = payload.value("field", std::string("mean"));
+    auto labels = payload.find("labels");
+    auto prefix = payload.find("prefix");
+    std::vector<std::string> names;
+    if (labels != payload.end() && labels->is_array()) {
+      for (const json &label : *labels) {
+        names.push_back(label.is_string() ? label.get<std::string>()
+                                          : label.dump());
+      }
+    } else if (prefix != payload.end() && prefix->is_string()) {
+      const std::string start = *prefix;
+      for (auto it = graph_->variables.lower_bound(start);
+           it != graph_->variables.end() &&
+           0 == it->first.compare(0, start.size(), start);
+           ++it) {
+        names.push_back(it->first);
+      }
+    } else {
+      return (Reply("ERROR", "GetVarsMAP: missing labels or prefix"));
+    }
+    return (EstimatesOf(field, names));
+  }
+
+  // a page of the labels of a map, after a cursor and with a prefix
+  template <typename Map>
+  static json Page(const Map &map, const std::string &after,
+                   std::size_t limit, const std::string &prefix) {
+    json labels = json::array();
+    auto it =
+        (after.empty() ? map.lower_bound(prefix) : map.upper_bound(after));
+    auto matches = [&](void) {
+      return (it != map.end() &&
+              0 == it->first.compare(0, prefix.size(), prefix));
+    };
+    for (; matches() && (0 == limit || labels.size() < limit); ++it) {
+      labels.push_back(it->first);
+    }
+    json page;
+    page["labels"] = labels;
+    page["next"] = (matches() && !labels.empty() ? labels.back() : json(""));
+    return (page);
+  }
+
+  json List(const json &payload) {
+    if (payload.is_object()) {
+      // paginated: {"kind", "after", "limit", "prefix"}
+      const std::string after = payload.value("after", std::string());
+      const std::size_t limit =
+          payload.value("limit", static_cast<std::size_t>(0));
+      const std::string prefix = payload.value("prefix", std::string());
+      if ("factors" == payload.value("kind", std::string())) {
+        return (Reply("OK", Page(graph_->factors, after, limit, prefix)));
+      }
+      return (Reply("OK", Page(graph_->variables, after, limit, prefix)));
+    }
+    json labels = json::array();
+    if ("factors" == payload) {
+      for (const auto &factor : graph_->factors) {
+        labels.push_back(factor.first);
+      }
+    } else {
+      for (const auto &variable : graph_->variables) {
+        labels.push_back(variable.first);
+      }
+    }
+    return (Reply("OK", labels));
+  }
+
+public:
+  /*!
+   * \brief Constructor; binds the server socket.
+   * \param [in] context The ZeroMQ context (shared with in-process clients
+   * when binding to an inproc:// address).
+   * \param [in] address The address to bind to, e.g. "tcp://127.0.0.1:5555".
+   * \param [in] events_address The address to publish events on, or "" for
+   * none.
+   */
+  MockServer(zmq::context_t &context, const std::string &address,
+             const std::string &events_address = std::string())
+      : socket_(context, ZMQ_ROUTER), graph_(&sessions_[""]), running_(true),
+        requests_(0), bytes_received_(0), bytes_sent_(0), factors_(0),
+        compression_threshold_(kCompressionThreshold) {
+    int linger = 0;
+    socket_.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+    socket_.bind(address.c_str());
+    if (!events_address.empty()) {
+      events_.reset(new zmq::socket_t(context, ZMQ_PUB));
+      events_->setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+      events_->bind(events_address.c_str());
+      events_address_ = events_address;
+    }
+  }
+
+  /*!
+   * \brief Handle a decoded request.
+   * \param [in] request The request object.
+   * \return The reply object.
+   */
+  json Handle(const json &request) {
+    auto name_it = request.find("request");
+    if (name_it == request.end() || !name_it->is_string()) {
+      return (Reply("ERROR", "missing request name"));
+    }
+    const std::string name = *name_it;
+    auto payload_it = request.find("payload");
+    const json payload = (payload_it == request.end() ? json() : *payload_it);
+
+    if ("addVariable" == name) {
+      return (AddVariable(payload));
+    } else if ("addFactor" == name) {
+      return (AddFactor(payload));
+    } else if ("addNoiseModels" == name) {
+      return (AddNoiseModels(payload));
+    } else if ("batch" == name) {
+      json replies = json::array();
+      if (payload.is_array()) {
+        for (const json &sub_request : payload) {
+          replies.push_back(Handle(sub_request));
+        }
+      }
+      return (Reply("OK", replies));
+    } else if ("getStatus" == name) {
+      json status;
+      status["server"] = "graff mock server";
+      status["encodings"] = {EncodingName(Encoding::kJson),
+                             EncodingName(Encoding::kMsgPack),
+                             EncodingName(Encoding::kCbor)};
+      status["compressions"] = AvailableCompressions();
+      status["noiseModels"] = true;
+      status["covForms"] = true;
+      status["batch"] = true;
+      if (events_) {
+        status["events"] = events_address_;
+      }
+      return (Reply("OK", status));
+    } else if ("registerSession" == name) {
+      auto session = payload.find("session");
+      session_ = (session != payload.end() && session->is_string()
+                      ? session->get<std::string>()
+                      : std::string());
+      graph_ = &sessions_[session_];
+      return (Reply("OK", ""));
+    } else if ("batchSolve" == name) {
+      return (Solve());
+    } else if ("getEstimates" == name) {
+      return (Estimates(payload));
+    } else if ("GetVarMAPMean" == name || "GetVarMAPMax" == name ||
+               "GetVarMAPKDE" == name) {
+      return (Estimate(name, payload));
+    } else if ("GetVarsMAP" == name) {
+      return (MultipleEstimates(payload));
+    } else if ("ls" == name) {
+      return (List(payload));
+    } else if ("shutdown" == name) {
+      running_ = false;
+      return (Reply("OK", ""));
+    } else if ("registerRobot" == name || "toggleMockServer" == name ||
+               "varQuery" == name) {
+      return (Reply("OK", ""));
+    }
+    return (Reply("ERROR", "unknown request " + name));
+  }
+
+  /*!
+   * \brief Serve the messages that arrive within a timeout.
+   * \param [in] timeout_ms How long to wait for a message.
+   * \return The number of messages served.
+   */
+  std::size_t Poll(long timeout_ms) {
+    zmq::pollitem_t items[] = {
+        {static_cast<void *>(socket_), 0, ZMQ_POLLIN, 0}};
+    zmq::poll(items, 1, timeout_ms);
+    std::size_t count = 0;
+    while (true) {
+      std::vector<zmq::message_t> frames(1);
+      if (!socket_.recv(&frames[0], ZMQ_DONTWAIT)) {
+        break;
+      }
+      while (frames.back().more()) {
+        frames.emplace_back();
+        socket_.recv(&frames.back());
+      }
+      // envelope (peer identity, request ids) up to the empty delimiter,
+      // then the optional format (see WireFormat) and the body
+      std::size_t delimiter = 0;
+      while (delimiter < frames.size() && frames[delimiter].size() > 0) {
+        ++delimiter;
+      }
+      const std::size_t tail = frames.size() - delimiter - 1;
+      if (delimiter == frames.size() || tail < 1 || tail > 2) {
+        continue; // not a request we can answer
+      }
+      const zmq::message_t &body = frames.back();
+      const zmq::message_t *tag =
+          (2 == tail ? &frames[delimiter + 1] : nullptr);
+      WireFormat format;
+      json reply;
+      if (tag && !WireFormat::Parse(toString(*tag), format)) {
+        reply = Reply("ERROR", "unknown format " + toString(*tag));
+        format = WireFormat();
+      } else {
+        try {
+          std::string inflated;
+          const char *data = static_cast<const char *>(body.data());
+          std::size_t size = body.size();
+          if (Compression::kNone != format.compression) {
+            Decompress(data, size, format.compression, inflated);
+            data = inflated.data();
+            size = inflated.size();
+          }
+          reply = Handle(Decode(data, size, format.encoding));
+        } catch (const std::exception &e) {
+          reply =
+              Reply("ERROR", std::string("malformed request: ") + e.what());
+        }
+      }
+      ++requests_;
+      bytes_received_ += body.size();
+
+      for (std::size_t i = 0; i <= delimiter; ++i) {
+        zmq::message_t frame(frames[i].size());
+        memcpy(frame.data(), frames[i].data(), frames[i].size());
+        socket_.send(frame, ZMQ_SNDMORE);
+      }
+      const std::string reply_str = Encode(reply, format.encoding);
+      zmq::message_t reply_msg(reply_str.size());
+      memcpy(reply_msg.data(), reply_str.data(), reply_str.size());
+      bytes_sent_ += SendBody(socket_, reply_msg, format.encoding,
+                              format.accepted, compression_threshold_);
+      ++count;
+    }
+    return (count);
+  }
+
+  /*!
+   * \brief Serve requests until a "shutdown" request or Stop().
+   */
+  void Run(void) {
+    while (running_) {
+      Poll(100);
+    }
+  }
+
+  /*!
+   * \brief Make Run() return; may be called from any thread.
+   */
+  void Stop(void) { running_ = false; }
+
+  /*!
+   * \brief Replies shorter than this (in bytes) are sent uncompressed, even
+   * to clients that accept compression.
+   */
+  void SetCompressionThreshold(std::size_t threshold) {
+    compression_threshold_ = threshold;
+  }
+
+  uint64_t requests(void) const { return (requests_); }
+  uint64_t bytes_received(void) const { return (bytes_received_); }
+  uint64_t bytes_sent(void) const { return (bytes_sent_); }
+  uint64_t factors(void) const { return (factors_); }
+};
+
+} // namespace graff
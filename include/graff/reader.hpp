@@ -0,0 +1,883 @@
+#pragma once
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <graff/encoding.hpp>
+
+namespace graff {
+
+/*!
+ * \class Reader reader.hpp
+ * \brief A pull parser that reads values straight from an encoded message,
+ * in any of the wire encodings, without building a json DOM.
+ *
+ * It is the counterpart of Writer: the caller walks the message and reads
+ * the values it expects into typed variables (and skips the others).
+ * Strings that need no unescaping are returned in place, so nothing is
+ * copied out of the message buffer. Reading a value of an unexpected type,
+ * or a malformed message, fails the reader: every later read returns false,
+ * and ok() tells whether the message was read as expected. A Reader is a
+ * small value, and a copy of it is a position to come back to.
+ *
+ * \code
+ *   graff::Reader r(data, size, graff::Encoding::kMsgPack);
+ *   std::string key;
+ *   std::vector<double> mean;
+ *   r.BeginObject();
+ *   while (r.Next() && r.Key(key)) {
+ *     if ("mean" == key) {
+ *       r.Doubles(mean);
+ *     } else {
+ *       r.Skip();
+ *     }
+ *   }
+ * \endcode
+ */
+class Reader {
+public:
+  /*! \brief The type of the next value, see Peek(). */
+  enum class Type {
+    kNull,
+    kBool,
+    kNumber,
+    kString,
+    kArray,
+    kObject,
+    kInvalid /*!< malformed, or past the end */
+  };
+
+private:
+  struct Level {
+    bool object;
+    bool indefinite;    /*!< CBOR: closed by a break byte */
+    bool first;         /*!< JSON: no entry read yet */
+    uint64_t remaining; /*!< binary: entries left, a key and value being one */
+  };
+  static const int kMaxDepth = 32;
+
+  // a number as it was encoded
+  struct Number {
+    enum { kSigned, kUnsigned, kFloat } kind;
+    int64_t i;
+    uint64_t u;
+    double d;
+  };
+
+  const char *data_;
+  std::size_t size_;
+  std::size_t pos_;
+  Encoding encoding_;
+  Level levels_[kMaxDepth];
+  int depth_;
+  bool ok_;
+  std::string scratch_; /*!< holds a string that had to be unescaped */
+
+  bool Fail(void) {
+    ok_ = false;
+    return (false);
+  }
+
+  uint8_t At(std::size_t pos) const {
+    return (static_cast<uint8_t>(data_[pos]));
+  }
+
+  void SkipSpace(void) {
+    while (pos_ < size_ && (' ' == data_[pos_] || '\n' == data_[pos_] ||
+                            '\r' == data_[pos_] || '\t' == data_[pos_])) {
+      ++pos_;
+    }
+  }
+
+  bool BigEndian(int bytes, uint64_t &value) {
+    if (size_ - pos_ < static_cast<std::size_t>(bytes)) {
+      return (Fail());
+    }
+    value = 0;
+    for (int i = 0; i < bytes; ++i) {
+      value = (value << 8) | At(pos_++);
+    }
+    return (true);
+  }
+
+  // the argument of a CBOR header whose initial byte has been read
+  bool CborArgument(uint8_t info, uint64_t &n) {
+    if (info < 24) {
+      n = info;
+      return (true);
+    } else if (info < 28) {
+      return (BigEndian(1 << (info - 24), n));
+    }
+    return (Fail());
+  }
+
+  // CBOR tags only annotate the value that follows them
+  void SkipCborTags(void) {
+    uint64_t tag;
+    while (ok_ && pos_ < size_ && 6 == (At(pos_) >> 5)) {
+      const uint8_t info = At(pos_++) & 0x1f;
+      CborArgument(info, tag);
+    }
+  }
+
+  // a JSON literal (null, true, false)
+  bool Literal(const char *word) {
+    const std::size_t n = std::strlen(word);
+    if (size_ - pos_ < n || 0 != std::memcmp(data_ + pos_, word, n)) {
+      return (Fail());
+    }
+    pos_ += n;
+    return (true);
+  }
+
+  static double Half(uint16_t h) {
+    const int exponent = (h >> 10) & 0x1f;
+    const double mantissa = h & 0x3ff;
+    double value =
+        (0 == exponent ? std::ldexp(mantissa, -24)
+                       : (31 == exponent
+                              ? (0 == mantissa ? HUGE_VAL : NAN)
+                              : std::ldexp(mantissa + 1024, exponent - 25)));
+    return ((h & 0x8000) ? -value : value);
+  }
+
+  static double Float(uint64_t bits, int bytes) {
+    if (4 == bytes) {
+      const uint32_t b = static_cast<uint32_t>(bits);
+      float f;
+      std::memcpy(&f, &b, sizeof(f));
+      return (f);
+    }
+    double d;
+    std::memcpy(&d, &bits, sizeof(d));
+    return (d);
+  }
+
+  bool JsonNumber(Number &number) {
+    char token[64];
+    std::size_t n = 0;
+    bool real = false;
+    while (pos_ < size_ && n + 1 < sizeof(token)) {
+      const char c = data_[pos_];
+      if ('.' == c || 'e' == c || 'E' == c) {
+        real = true;
+      } else if (!('-' == c || '+' == c || (c >= '0' && c <= '9'))) {
+        break;
+      }
+      token[n++] = c;
+      ++pos_;
+    }
+    token[n] = '\0';
+    char *end = nullptr;
+    errno = 0;
+    if (real) {
+      number.kind = Number::kFloat;
+      number.d = std::strtod(token, &end);
+    } else if ('-' == token[0]) {
+      number.kind = Number::kSigned;
+      number.i = std::strtoll(token, &end, 10);
+    } else {
+      number.kind = Number::kUnsigned;
+      number.u = std::strtoull(token, &end, 10);
+    }
+    if (0 == n || end != token + n || (!real && ERANGE == errno)) {
+      return (Fail());
+    }
+    return (true);
+  }
+
+  bool MsgPackNumber(Number &number) {
+    const uint8_t b = At(pos_++);
+    uint64_t bits;
+    if (b < 0x80) {
+      number.kind = Number::kUnsigned;
+      number.u = b;
+    } else if (b >= 0xe0) {
+      number.kind = Number::kSigned;
+      number.i = static_cast<int8_t>(b);
+    } else if (0xca == b || 0xcb == b) {
+      const int bytes = (0xca == b ? 4 : 8);
+      if (!BigEndian(bytes, bits)) {
+        return (false);
+      }
+      number.kind = Number::kFloat;
+      number.d = Float(bits, bytes);
+    } else if (b >= 0xcc && b <= 0xcf) {
+      if (!BigEndian(1 << (b - 0xcc), bits)) {
+        return (false);
+      }
+      number.kind = Number::kUnsigned;
+      number.u = bits;
+    } else if (b >= 0xd0 && b <= 0xd3) {
+      const int bytes = 1 << (b - 0xd0);
+      if (!BigEndian(bytes, bits)) {
+        return (false);
+      }
+      // sign-extend
+      const int shift = 64 - 8 * bytes;
+      number.kind = Number::kSigned;
+      number.i = static_cast<int64_t>(bits << shift) >> shift;
+    } else {
+      return (Fail());
+    }
+    return (true);
+  }
+
+  bool CborNumber(Number &number) {
+    const uint8_t b = At(pos_++);
+    const uint8_t major = b >> 5, info = b & 0x1f;
+    uint64_t n;
+    if (0 == major || 1 == major) {
+      if (!CborArgument(info, n)) {
+        return (false);
+      }
+      if (0 == major) {
+        number.kind = Number::kUnsigned;
+        number.u = n;
+      } else {
+        number.kind = Number::kSigned;
+        number.i = -1 - static_cast<int64_t>(n);
+      }
+    } else if (0xf9 == b) {
+      if (!BigEndian(2, n)) {
+        return (false);
+      }
+      number.kind = Number::kFloat;
+      number.d = Half(static_cast<uint16_t>(n));
+    } else if (0xfa == b || 0xfb == b) {
+      const int bytes = (0xfa == b ? 4 : 8);
+      if (!BigEndian(bytes, n)) {
+        return (false);
+      }
+      number.kind = Number::kFloat;
+      number.d = Float(n, bytes);
+    } else {
+      return (Fail());
+    }
+    return (true);
+  }
+
+  bool ReadNumber(Number &number) {
+    if (Type::kNumber != Peek()) {
+      return (Fail());
+    }
+    switch (encoding_) {
+    case Encoding::kMsgPack:
+      return (MsgPackNumber(number));
+    case Encoding::kCbor:
+      return (CborNumber(number));
+    default:
+      return (JsonNumber(number));
+    }
+  }
+
+  // append the UTF-8 encoding of a code point
+  void PutUtf8(uint32_t c) {
+    if (c < 0x80) {
+      scratch_ += static_cast<char>(c);
+    } else if (c < 0x800) {
+      scratch_ += static_cast<char>(0xc0 | (c >> 6));
+      scratch_ += static_cast<char>(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+      scratch_ += static_cast<char>(0xe0 | (c >> 12));
+      scratch_ += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+      scratch_ += static_cast<char>(0x80 | (c & 0x3f));
+    } else {
+      scratch_ += static_cast<char>(0xf0 | (c >> 18));
+      scratch_ += static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+      scratch_ += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+      scratch_ += static_cast<char>(0x80 | (c & 0x3f));
+    }
+  }
+
+  bool Hex4(uint32_t &c) {
+    if (size_ - pos_ < 4) {
+      return (Fail());
+    }
+    c = 0;
+    for (int i = 0; i < 4; ++i) {
+      const char h = data_[pos_++];
+      c <<= 4;
+      if (h >= '0' && h <= '9') {
+        c |= h - '0';
+      } else if (h >= 'a' && h <= 'f') {
+        c |= h - 'a' + 10;
+      } else if (h >= 'A' && h <= 'F') {
+        c |= h - 'A' + 10;
+      } else {
+        return (Fail());
+      }
+    }
+    return (true);
+  }
+
+  bool JsonString(const char *&s, std::size_t &n) {
+    const std::size_t begin = ++pos_; // past the quote
+    while (pos_ < size_ && '"' != data_[pos_] && '\\' != data_[pos_]) {
+      ++pos_;
+    }
+    if (pos_ < size_ && '"' == data_[pos_]) {
+      s = data_ + begin;
+      n = pos_++ - begin;
+      return (true);
+    }
+    // unescape into the scratch buffer
+    scratch_.assign(data_ + begin, pos_ - begin);
+    while (pos_ < size_ && '"' != data_[pos_]) {
+      const char c = data_[pos_++];
+      if ('\\' != c) {
+        scratch_ += c;
+        continue;
+      }
+      if (pos_ == size_) {
+        return (Fail());
+      }
+      const char e = data_[pos_++];
+      uint32_t code;
+      switch (e) {
+      case 'n':
+        scratch_ += '\n';
+        break;
+      case 't':
+        scratch_ += '\t';
+        break;
+      case 'r':
+        scratch_ += '\r';
+        break;
+      case 'b':
+        scratch_ += '\b';
+        break;
+      case 'f':
+        scratch_ += '\f';
+        break;
+      case 'u':
+        if (!Hex4(code)) {
+          return (false);
+        }
+        if (code >= 0xd800 && code < 0xdc00) {
+          // a surrogate pair
+          uint32_t low;
+          if (size_ - pos_ < 2 || '\\' != data_[pos_] ||
+              'u' != data_[pos_ + 1]) {
+            return (Fail());
+          }
+          pos_ += 2;
+          if (!Hex4(low) || low < 0xdc00 || low >= 0xe000) {
+            return (Fail());
+          }
+          code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+        }
+        PutUtf8(code);
+        break;
+      default:
+        scratch_ += e; // \" \\ \/
+      }
+    }
+    if (pos_ == size_) {
+      return (Fail());
+    }
+    ++pos_;
+    s = scratch_.data();
+    n = scratch_.size();
+    return (true);
+  }
+
+  bool MsgPackString(const char *&s, std::size_t &n) {
+    const uint8_t b = At(pos_++);
+    uint64_t length;
+    if (b >= 0xa0 && b <= 0xbf) {
+      length = b & 0x1f;
+    } else if (b >= 0xd9 && b <= 0xdb) {
+      if (!BigEndian(1 << (b - 0xd9), length)) {
+        return (false);
+      }
+    } else {
+      return (Fail());
+    }
+    if (size_ - pos_ < length) {
+      return (Fail());
+    }
+    s = data_ + pos_;
+    n = static_cast<std::size_t>(length);
+    pos_ += n;
+    return (true);
+  }
+
+  bool CborString(const char *&s, std::size_t &n) {
+    const uint8_t b = At(pos_++);
+    uint64_t length;
+    if (0x7f == b) {
+      // indefinite length: definite chunks up to a break
+      scratch_.clear();
+      while (pos_ < size_ && 0xff != At(pos_)) {
+        const char *chunk;
+        std::size_t chunk_size;
+        if (3 != (At(pos_) >> 5) || 0x7f == At(pos_) ||
+            !CborString(chunk, chunk_size)) {
+          return (Fail());
+        }
+        scratch_.append(chunk, chunk_size);
+      }
+      if (pos_ == size_) {
+        return (Fail());
+      }
+      ++pos_;
+      s = scratch_.data();
+      n = scratch_.size();
+      return (true);
+    }
+    if (3 != (b >> 5) || !CborArgument(b & 0x1f, length)) {
+      return (Fail());
+    }
+    if (size_ - pos_ < length) {
+      return (Fail());
+    }
+    s = data_ + pos_;
+    n = static_cast<std::size_t>(length);
+    pos_ += n;
+    return (true);
+  }
+
+  bool Open(bool object) {
+    if ((object ? Type::kObject : Type::kArray) != Peek()) {
+      return (Fail());
+    }
+    if (depth_ == kMaxDepth) {
+      return (Fail());
+    }
+    Level &level = levels_[depth_];
+    level.object = object;
+    level.indefinite = false;
+    level.first = true;
+    level.remaining = 0;
+    const uint8_t b = At(pos_++);
+    switch (encoding_) {
+    case Encoding::kMsgPack:
+      if (b < 0xa0) {
+        level.remaining = b & 0x0f;
+      } else if (!BigEndian((0xdc == b || 0xde == b) ? 2 : 4,
+                            level.remaining)) {
+        return (false);
+      }
+      break;
+    case Encoding::kCbor:
+      if (31 == (b & 0x1f)) {
+        level.indefinite = true;
+      } else if (!CborArgument(b & 0x1f, level.remaining)) {
+        return (false);
+      }
+      break;
+    default:
+      break;
+    }
+    ++depth_;
+    return (true);
+  }
+
+public:
+  Reader(const char *data, std::size_t size,
+         Encoding encoding = Encoding::kJson)
+      : data_(data), size_(size), pos_(0), encoding_(encoding), depth_(0),
+        ok_(true) {}
+
+  Encoding encoding(void) const { return (encoding_); }
+
+  /*! \brief Whether everything so far was read as expected. */
+  bool ok(void) const { return (ok_); }
+
+  /*! \brief The offset of the next value in the message. */
+  std::size_t position(void) const { return (pos_); }
+
+  /*!
+   * \brief The type of the next value, without reading it.
+   */
+  Type Peek(void) {
+    if (!ok_) {
+      return (Type::kInvalid);
+    }
+    if (Encoding::kJson == encoding_) {
+      SkipSpace();
+    } else if (Encoding::kCbor == encoding_) {
+      SkipCborTags();
+    }
+    if (pos_ >= size_) {
+      return (Type::kInvalid);
+    }
+    const uint8_t b = At(pos_);
+    switch (encoding_) {
+    case Encoding::kMsgPack:
+      if (b < 0x80 || b >= 0xe0 || (b >= 0xca && b <= 0xd3)) {
+        return (Type::kNumber);
+      } else if (b < 0x90 || 0xde == b || 0xdf == b) {
+        return (Type::kObject);
+      } else if (b < 0xa0 || 0xdc == b || 0xdd == b) {
+        return (Type::kArray);
+      } else if (b < 0xc0 || (b >= 0xd9 && b <= 0xdb)) {
+        return (Type::kString);
+      } else if (0xc0 == b) {
+        return (Type::kNull);
+      } else if (0xc2 == b || 0xc3 == b) {
+        return (Type::kBool);
+      }
+      return (Type::kInvalid);
+    case Encoding::kCbor:
+      switch (b >> 5) {
+      case 0:
+      case 1:
+        return (Type::kNumber);
+      case 3:
+        return (Type::kString);
+      case 4:
+        return (Type::kArray);
+      case 5:
+        return (Type::kObject);
+      case 7:
+        if (0xf4 == b || 0xf5 == b) {
+          return (Type::kBool);
+        } else if (0xf6 == b || 0xf7 == b) {
+          return (Type::kNull);
+        } else if (b >= 0xf9 && b <= 0xfb) {
+          return (Type::kNumber);
+        }
+        return (Type::kInvalid);
+      default:
+        return (Type::kInvalid); // byte strings are not used
+      }
+    default:
+      switch (b) {
+      case 'n':
+        return (Type::kNull);
+      case 't':
+      case 'f':
+        return (Type::kBool);
+      case '"':
+        return (Type::kString);
+      case '[':
+        return (Type::kArray);
+      case '{':
+        return (Type::kObject);
+      default:
+        return ('-' == b || (b >= '0' && b <= '9') ? Type::kNumber
+                                                  : Type::kInvalid);
+      }
+    }
+  }
+
+  bool BeginObject(void) { return (Open(true)); }
+  bool BeginArray(void) { return (Open(false)); }
+
+  /*!
+   * \brief Move to the next entry of the innermost object or array.
+   * \return true if there is one (for an object, read its Key() and then
+   * its value), false at the end of the container, which is then closed.
+   */
+  bool Next(void) {
+    if (!ok_ || 0 == depth_) {
+      return (Fail());
+    }
+    Level &level = levels_[depth_ - 1];
+    if (Encoding::kJson == encoding_) {
+      SkipSpace();
+      if (pos_ == size_) {
+        return (Fail());
+      }
+      if ((level.object ? '}' : ']') == data_[pos_]) {
+        ++pos_;
+        --depth_;
+        return (false);
+      }
+      if (!level.first) {
+        if (',' != data_[pos_]) {
+          return (Fail());
+        }
+        ++pos_;
+      }
+      level.first = false;
+      return (true);
+    }
+    if (level.indefinite) {
+      if (pos_ == size_) {
+        return (Fail());
+      }
+      if (0xff == At(pos_)) {
+        ++pos_;
+        --depth_;
+        return (false);
+      }
+      return (true);
+    }
+    if (0 == level.remaining) {
+      --depth_;
+      return (false);
+    }
+    --level.remaining;
+    return (true);
+  }
+
+  /*!
+   * \brief Read a string, in place if possible.
+   * \param [out] s Its first character; valid until the next read.
+   * \param [out] n Its length.
+   */
+  bool String(const char *&s, std::size_t &n) {
+    if (Type::kString != Peek()) {
+      return (Fail());
+    }
+    switch (encoding_) {
+    case Encoding::kMsgPack:
+      return (MsgPackString(s, n));
+    case Encoding::kCbor:
+      return (CborString(s, n));
+    default:
+      return (JsonString(s, n));
+    }
+  }
+
+  bool String(std::string &s) {
+    const char *chars;
+    std::size_t n;
+    if (!String(chars, n)) {
+      return (false);
+    }
+    s.assign(chars, n);
+    return (true);
+  }
+
+  /*!
+   * \brief Read the key of an object entry, after Next().
+   */
+  bool Key(const char *&s, std::size_t &n) {
+    if (0 == depth_ || !levels_[depth_ - 1].object || !String(s, n)) {
+      return (Fail());
+    }
+    if (Encoding::kJson == encoding_) {
+      SkipSpace();
+      if (pos_ == size_ || ':' != data_[pos_]) {
+        return (Fail());
+      }
+      ++pos_;
+    }
+    return (true);
+  }
+
+  bool Key(std::string &key) {
+    const char *chars;
+    std::size_t n;
+    if (!Key(chars, n)) {
+      return (false);
+    }
+    key.assign(chars, n);
+    return (true);
+  }
+
+  bool Null(void) {
+    if (Type::kNull != Peek()) {
+      return (Fail());
+    }
+    if (Encoding::kJson == encoding_) {
+      return (Literal("null"));
+    }
+    ++pos_;
+    return (true);
+  }
+
+  bool Bool(bool &value) {
+    if (Type::kBool != Peek()) {
+      return (Fail());
+    }
+    const uint8_t b = At(pos_);
+    if (Encoding::kJson == encoding_) {
+      value = ('t' == b);
+      return (Literal(value ? "true" : "false"));
+    }
+    value = (0xc3 == b || 0xf5 == b);
+    ++pos_;
+    return (true);
+  }
+
+  /*! \brief Read any number as a double. */
+  bool Double(double &value) {
+    Number number;
+    if (!ReadNumber(number)) {
+      return (false);
+    }
+    value = (Number::kFloat == number.kind
+                 ? number.d
+                 : (Number::kSigned == number.kind
+                        ? static_cast<double>(number.i)
+                        : static_cast<double>(number.u)));
+    return (true);
+  }
+
+  /*! \brief Read a non-negative integer. */
+  bool Unsigned(uint64_t &value) {
+    Number number;
+    if (!ReadNumber(number)) {
+      return (false);
+    }
+    if (Number::kUnsigned == number.kind) {
+      value = number.u;
+    } else if (Number::kSigned == number.kind && number.i >= 0) {
+      value = static_cast<uint64_t>(number.i);
+    } else {
+      return (Fail());
+    }
+    return (true);
+  }
+
+  /*! \brief Read an integer. */
+  bool Integer(int64_t &value) {
+    Number number;
+    if (!ReadNumber(number)) {
+      return (false);
+    }
+    if (Number::kSigned == number.kind) {
+      value = number.i;
+    } else if (Number::kUnsigned == number.kind &&
+               number.u <= static_cast<uint64_t>(INT64_MAX)) {
+      value = static_cast<int64_t>(number.u);
+    } else {
+      return (Fail());
+    }
+    return (true);
+  }
+
+  /*!
+   * \brief Read an array of numbers.
+   * \param [out] values The numbers; its capacity is reused.
+   */
+  bool Doubles(std::vector<double> &values) {
+    values.clear();
+    if (!BeginArray()) {
+      return (false);
+    }
+    // a count cannot exceed the bytes left, whatever the message claims
+    const uint64_t count = levels_[depth_ - 1].remaining;
+    values.reserve(static_cast<std::size_t>(
+        count < size_ - pos_ ? count : size_ - pos_));
+    double value;
+    while (Next()) {
+      if (!Double(value)) {
+        return (false);
+      }
+      values.push_back(value);
+    }
+    return (ok_);
+  }
+
+  /*!
+   * \brief Skip entries of the innermost object up to a key.
+   * \return true if the key was found (its value is next), false if the
+   * object ended without it.
+   */
+  bool Find(const char *key) {
+    const std::size_t length = std::strlen(key);
+    const char *s;
+    std::size_t n;
+    while (Next()) {
+      if (!Key(s, n)) {
+        return (false);
+      }
+      if (n == length && 0 == std::memcmp(s, key, n)) {
+        return (true);
+      }
+      Skip();
+    }
+    return (false);
+  }
+
+  /*! \brief Skip the next value. */
+  bool Skip(void) {
+    const char *s;
+    std::size_t n;
+    bool b;
+    Number number;
+    switch (Peek()) {
+    case Type::kNull:
+      return (Null());
+    case Type::kBool:
+      return (Bool(b));
+    case Type::kNumber:
+      return (ReadNumber(number));
+    case Type::kString:
+      return (String(s, n));
+    case Type::kArray:
+      BeginArray();
+      while (Next()) {
+        Skip();
+      }
+      return (ok_);
+    case Type::kObject:
+      BeginObject();
+      while (Next() && Key(s, n)) {
+        Skip();
+      }
+      return (ok_);
+    default:
+      return (Fail());
+    }
+  }
+
+  /*!
+   * \brief Read the next value into a json DOM, e.g. for the parts of a
+   * message without a typed reader.
+   */
+  bool Value(json &j) {
+    std::string key;
+    bool b;
+    Number number;
+    switch (Peek()) {
+    case Type::kNull:
+      j = nullptr;
+      return (Null());
+    case Type::kBool:
+      if (!Bool(b)) {
+        return (false);
+      }
+      j = b;
+      return (true);
+    case Type::kNumber:
+      if (!ReadNumber(number)) {
+        return (false);
+      }
+      if (Number::kFloat == number.kind) {
+        j = number.d;
+      } else if (Number::kSigned == number.kind) {
+        j = number.i;
+      } else {
+        j = number.u;
+      }
+      return (true);
+    case Type::kString:
+      if (!String(key)) {
+        return (false);
+      }
+      j = key;
+      return (true);
+    case Type::kArray:
+      j = json::array();
+      BeginArray();
+      while (Next()) {
+        j.push_back(json());
+        Value(j.back());
+      }
+      return (ok_);
+    case Type::kObject:
+      j = json::object();
+      BeginObject();
+      while (Next() && Key(key)) {
+        Value(j[key]);
+      }
+      return (ok_);
+    default:
+      return (Fail());
+    }
+  }
+};
+
+} // namespace graff
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <graff/graff.hpp>
+
+namespace graff {
+
+/*!
+ * \class Router router.hpp
+ * \brief Spreads the sessions of a fleet over several endpoint backends (e.g.
+ * several Caesar processes).
+ *
+ * Each (robot, session) pair is routed to one backend, chosen by rendezvous
+ * hashing of the pair over the backend addresses: the choice is stable
+ * across processes and restarts, sessions are spread evenly, and adding a
+ * backend only moves the sessions that land on it. A pair can also be pinned
+ * to a backend with Assign().
+ *
+ * Every routed session gets its own Endpoint (and socket) to its backend.
+ * Since requests do not name their session (a backend works on the session
+ * registered last), requests are sent under a Lease, which holds the backend
+ * for the session and registers the session again if another one used the
+ * backend in between. Sessions on different backends thus run in parallel,
+ * and sessions sharing a backend take turns.
+ *
+ * \code
+ *   graff::Router router;
+ *   router.AddBackend("tcp://10.0.0.1:5555", "tcp://10.0.0.1:5556");
+ *   router.AddBackend("tcp://10.0.0.2:5555", "tcp://10.0.0.2:5556");
+ *   graff::RegisterRobot(router, robot);
+ *   graff::RegisterSession(router, robot, session);
+ *   {
+ *     graff::Router::Lease lease = router.Acquire(robot, session);
+ *     graff::AddVariable(lease.endpoint(), session, pose);
+ *   }
+ * \endcode
+ */
+class Router {
+  // a backend, and the session it is working on
+  struct Host {
+    std::string address;
+    std::string events; /*!< event publisher address, or "" */
+    std::mutex mutex;   /*!< held by the lease on the backend */
+    std::string active; /*!< Key() of the session registered last */
+  };
+  struct Entry {
+    std::size_t backend;
+    std::unique_ptr<Endpoint> ep; /*!< connected on first use */
+  };
+
+  std::unique_ptr<zmq::context_t> own_context_; /*!< unless one is shared */
+  zmq::context_t *context_;
+  std::vector<std::unique_ptr<Host>> backends_;
+  std::map<std::string, Entry> routes_; /*!< by Key() */
+  std::mutex mutex_;                    /*!< guards backends_ and routes_ */
+
+  static std::string Key(const Robot &robot, const Session &session) {
+    return (robot.Name() + '\0' + session.name());
+  }
+
+  // 64-bit FNV-1a, continued from h
+  static uint64_t Hash(const std::string &s,
+                       uint64_t h = 14695981039346656037ULL) {
+    for (unsigned char c : s) {
+      h = (h ^ c) * 1099511628211ULL;
+    }
+    return (h);
+  }
+
+  // the backend with the highest weight for the key
+  std::size_t Pick(const std::string &key) const {
+    std::size_t best = 0;
+    uint64_t best_weight = 0;
+    for (std::size_t i = 0; i < backends_.size(); ++i) {
+      uint64_t weight = Hash(backends_[i]->address, Hash(key));
+      // final mix, so that nearby keys spread out
+      weight ^= weight >> 33;
+      weight *= 0xff51afd7ed558ccdULL;
+      weight ^= weight >> 33;
+      if (0 == i || weight > best_weight) {
+        best = i;
+        best_weight = weight;
+      }
+    }
+    return (best);
+  }
+
+  Entry &Find(const std::string &key) {
+    if (backends_.empty()) {
+      throw std::logic_error("Router: no backends");
+    }
+    auto it = routes_.find(key);
+    if (it == routes_.end()) {
+      Entry route = {Pick(key), nullptr};
+      it = routes_.insert(std::make_pair(key, std::move(route))).first;
+    }
+    return (it->second);
+  }
+
+  // the endpoint of a session and its backend, connecting it if needed
+  std::pair<Endpoint *, Host *> Connect(const Robot &robot,
+                                        const Session &session) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry &route = Find(Key(robot, session));
+    Host &backend = *backends_[route.backend];
+    if (!route.ep) {
+      route.ep.reset(new Endpoint(*context_));
+      route.ep->Connect(backend.address);
+      if (!backend.events.empty()) {
+        route.ep->Subscribe(backend.events, session.name());
+      }
+    }
+    return (std::make_pair(route.ep.get(), &backend));
+  }
+
+public:
+  /*!
+   * \class Lease
+   * \brief Exclusive use of a session's backend, for as long as it lives.
+   */
+  class Lease {
+    std::unique_lock<std::mutex> lock_;
+    Endpoint *ep_;
+
+  public:
+    Lease(std::unique_lock<std::mutex> lock, Endpoint &ep)
+        : lock_(std::move(lock)), ep_(&ep) {}
+    Endpoint &endpoint(void) const { return (*ep_); }
+  };
+
+  Router()
+      : own_context_(new zmq::context_t(1)), context_(own_context_.get()) {}
+
+  /*!
+   * \brief Constructor sharing a ZeroMQ context.
+   * \param [in] context The context; must outlive the router.
+   */
+  explicit Router(zmq::context_t &context) : context_(&context) {}
+
+  Router(const Router &) = delete;
+  Router &operator=(const Router &) = delete;
+
+  /*!
+   * \brief Add a backend. Sessions already routed stay where they are.
+   * \param [in] address The address of its request socket.
+   * \param [in] events The address of its event publisher, if any; routed
+   * endpoints subscribe to their session's events there.
+   * \return The index of the backend.
+   */
+  std::size_t AddBackend(const std::string &address,
+                         const std::string &events = std::string()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    backends_.push_back(std::unique_ptr<Host>(new Host()));
+    backends_.back()->address = address;
+    backends_.back()->events = events;
+    return (backends_.size() - 1);
+  }
+
+  std::size_t NumBackends(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (backends_.size());
+  }
+
+  std::string BackendAddress(std::size_t backend) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (backends_.at(backend)->address);
+  }
+
+  /*!
+   * \brief Pin a session to a backend.
+   * \throws std::out_of_range for an unknown backend, std::logic_error if
+   * the session is already connected to another backend.
+   */
+  void Assign(const Robot &robot, const Session &session,
+              std::size_t backend) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (backend >= backends_.size()) {
+      throw std::out_of_range("Router: backend index");
+    }
+    Entry &route = Find(Key(robot, session));
+    if (route.ep && route.backend != backend) {
+      throw std::logic_error("Router: session already routed");
+    }
+    route.backend = backend;
+  }
+
+  /*!
+   * \brief The backend a session is (or will be) routed to.
+   */
+  std::size_t Backend(const Robot &robot, const Session &session) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (Find(Key(robot, session)).backend);
+  }
+
+  /*!
+   * \brief Register a session with its backend, and make it the backend's
+   * current session.
+   * \return The endpoint reply.
+   */
+  json Register(const Robot &robot, const Session &session) {
+    std::pair<Endpoint *, Host *> route = Connect(robot, session);
+    std::lock_guard<std::mutex> lock(route.second->mutex);
+    json reply = RegisterSession(*route.first, robot, session);
+    route.second->active = (check(reply) ? Key(robot, session) : "");
+    return (reply);
+  }
+
+  /*!
+   * \brief Wait for the session's backend, and make the session current on
+   * it (registering it again if another session was current).
+   * \throws std::runtime_error if the session cannot be registered.
+   */
+  Lease Acquire(const Robot &robot, const Session &session) {
+    std::pair<Endpoint *, Host *> route = Connect(robot, session);
+    std::unique_lock<std::mutex> lock(route.second->mutex);
+    const std::string key = Key(robot, session);
+    if (route.second->active != key) {
+      json reply = RegisterSession(*route.first, robot, session);
+      if (!check(reply)) {
+        route.second->active.clear();
+        throw std::runtime_error("Router: cannot register session " +
+                                 session.name() + ": " + reply.dump());
+      }
+      route.second->active = key;
+    }
+    return (Lease(std::move(lock), *route.first));
+  }
+
+  /*!
+   * \brief The endpoint of a session, e.g. to wait for its events. Requests
+   * sent on it directly bypass the lease; the reference stays valid for the
+   * lifetime of the router.
+   */
+  Endpoint &Route(const Robot &robot, const Session &session) {
+    return (*Connect(robot, session).first);
+  }
+
+  /*!
+   * \brief Send a request to every backend, each over a connection of its
+   * own, e.g. to register a robot or to shut the backends down.
+   * \return The replies, by backend index.
+   */
+  std::vector<json> Broadcast(const json &request) {
+    std::vector<Host *> backends;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const std::unique_ptr<Host> &backend : backends_) {
+        backends.push_back(backend.get());
+      }
+    }
+    std::vector<json> replies;
+    for (Host *backend : backends) {
+      std::lock_guard<std::mutex> lock(backend->mutex);
+      Endpoint ep(*context_);
+      ep.Connect(backend->address);
+      replies.push_back(ep.SendRequest(request));
+    }
+    return (replies);
+  }
+};
+
+/*!
+ * \brief Register a robot with every backend of a router, so that its
+ * sessions can be routed to any of them.
+ * \return OK if every backend accepted it, otherwise the first error reply.
+ */
+inline json RegisterRobot(Router &router, const Robot &robot) {
+  json request;
+  request["request"] = "registerRobot";
+  request["payload"]["robot"] = robot.Name();
+  json result;
+  result["status"] = "OK";
+  for (const json &reply : router.Broadcast(request)) {
+    if (!check(reply)) {
+      return (reply);
+    }
+  }
+  return (result);
+}
+
+/*!
+ * \brief Register a session with the backend it is routed to.
+ */
+inline json RegisterSession(Router &router, const Robot &robot,
+                            const Session &session) {
+  return (router.Register(robot, session));
+}
+
+} // namespace graff
@@ -0,0 +1,570 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <graff/graff.hpp>
+
+namespace graff {
+
+/*!
+ * \class Snapshot snapshot.hpp
+ * \brief A compact binary image of a Session, opened by memory-mapping it.
+ *
+ * The file holds fixed-layout tables of variables, factors, factor variables
+ * and distributions, a string table (labels that are not packed symbols,
+ * type names, and the session name), and one contiguous blob of doubles with
+ * the measurement parameters. Opening a snapshot only maps the file and
+ * checks the tables: their bounds, the cross-references between them, and
+ * that each distribution holds as many values as its kind and dimension call
+ * for. Variables and factors can then be iterated in place, and only
+ * materialized (see Load()) when needed.
+ *
+ * Labels are stored as in Symbol: packed symbols as their key, and other
+ * labels as a string id with the top bit set. All values are in the byte
+ * order of the writer, which must match that of the reader.
+ *
+ * \code
+ *   graff::Snapshot::Write(session, "dive.snap");
+ *   graff::Snapshot snapshot("dive.snap");
+ *   for (std::size_t i = 0; i < snapshot.NumFactors(); ++i) {
+ *     std::cout << snapshot.GetFactor(i).Type() << "\n";
+ *   }
+ * \endcode
+ */
+class Snapshot {
+public:
+  struct Header {
+    char magic[8];       /*!< "GRAFFSS1" */
+    uint32_t byte_order; /*!< 0x01020304, as written */
+    uint32_t name;       /*!< string id of the session name */
+    uint64_t num_variables, variables;
+    uint64_t num_factors, factors;
+    uint64_t num_factor_variables, factor_variables; /*!< labels */
+    uint64_t num_distributions, distributions;
+    uint64_t num_values, values; /*!< doubles */
+    uint64_t num_strings, strings;
+    uint64_t string_data_size, string_data; /*!< NUL-terminated strings */
+  };
+
+  struct VariableRecord {
+    uint64_t label;
+    uint32_t type; /*!< string id */
+    uint32_t reserved;
+  };
+
+  struct FactorRecord {
+    uint64_t label;
+    uint32_t type; /*!< string id */
+    uint32_t num_variables;
+    uint64_t variables; /*!< first entry in the factor variables */
+    uint32_t num_distributions;
+    uint32_t reserved;
+    uint64_t distributions; /*!< first entry in the distributions */
+  };
+
+  /*! \brief Kinds of distribution records. */
+  enum Kind {
+    kNormal = 0,        /*!< values: mean, then covariance (of form) */
+    kSampleWeights = 1, /*!< values: samples, weights, then quantile */
+    kJson = 2           /*!< values: none, dim: string id of its JSON */
+  };
+
+  struct DistributionRecord {
+    uint32_t kind;
+    uint32_t form; /*!< Normal::Covariance, for normals */
+    uint64_t dim;  /*!< dimension, or number of samples */
+    uint64_t values;
+    uint64_t num_values;
+  };
+
+  struct StringRecord {
+    uint64_t offset; /*!< in the string data */
+    uint64_t size;   /*!< excluding the terminating NUL */
+  };
+
+  static const char *Magic(void) { return ("GRAFFSS1"); }
+  static const uint64_t kStringLabel = 1ULL << 63;
+
+  /*!
+   * \class DistributionView
+   * \brief A distribution record, read in place.
+   */
+  class DistributionView {
+    const Snapshot *snapshot_;
+    const DistributionRecord *record_;
+
+  public:
+    DistributionView(const Snapshot *snapshot,
+                     const DistributionRecord *record)
+        : snapshot_(snapshot), record_(record) {}
+    Kind kind(void) const { return (static_cast<Kind>(record_->kind)); }
+    std::size_t dim(void) const { return (record_->dim); }
+    /*! \brief The parameters, in the layout of kind(). */
+    const double *values(void) const {
+      return (snapshot_->values_ + record_->values);
+    }
+    std::size_t num_values(void) const { return (record_->num_values); }
+
+    /*!
+     * \brief Decode the distribution.
+     * \throws std::invalid_argument if a JSON record holds an unknown
+     * distribution.
+     */
+    Measurement ToMeasurement(void) const {
+      const double *v = values();
+      const std::size_t n = record_->dim;
+      switch (kind()) {
+      case kNormal:
+        return (Normal(std::vector<double>(v, v + n),
+                       std::vector<double>(v + n, v + num_values()),
+                       static_cast<Normal::Covariance>(record_->form)));
+      case kSampleWeights:
+        return (SampleWeights(std::vector<double>(v, v + n),
+                              std::vector<double>(v + n, v + 2 * n),
+                              v[2 * n]));
+      default:
+        return (Measurement(DistributionFromJson(json::parse(
+            snapshot_->String(static_cast<uint32_t>(record_->dim))))));
+      }
+    }
+  };
+
+  /*!
+   * \class VariableView
+   * \brief A variable record, read in place.
+   */
+  class VariableView {
+    const Snapshot *snapshot_;
+    const VariableRecord *record_;
+
+  public:
+    VariableView(const Snapshot *snapshot, const VariableRecord *record)
+        : snapshot_(snapshot), record_(record) {}
+    std::string name(void) const { return (snapshot_->Label(record_->label)); }
+    Symbol symbol(void) const { return (snapshot_->ToSymbol(record_->label)); }
+    const char *Type(void) const { return (snapshot_->String(record_->type)); }
+    graff::Variable ToVariable(void) const {
+      return (graff::Variable(symbol(), Type()));
+    }
+  };
+
+  /*!
+   * \class FactorView
+   * \brief A factor record, read in place.
+   */
+  class FactorView {
+    const Snapshot *snapshot_;
+    const FactorRecord *record_;
+
+  public:
+    FactorView(const Snapshot *snapshot, const FactorRecord *record)
+        : snapshot_(snapshot), record_(record) {}
+    std::string name(void) const { return (snapshot_->Label(record_->label)); }
+    Symbol symbol(void) const { return (snapshot_->ToSymbol(record_->label)); }
+    const char *Type(void) const { return (snapshot_->String(record_->type)); }
+    std::size_t NumVariables(void) const { return (record_->num_variables); }
+    std::string VariableName(std::size_t i) const {
+      return (snapshot_->Label(snapshot_->factor_variables_[Check(i)]));
+    }
+    Symbol VariableSymbol(std::size_t i) const {
+      return (snapshot_->ToSymbol(snapshot_->factor_variables_[Check(i)]));
+    }
+    std::size_t NumDistributions(void) const {
+      return (record_->num_distributions);
+    }
+    DistributionView GetDistribution(std::size_t i) const {
+      if (i >= record_->num_distributions) {
+        throw std::out_of_range("Snapshot: distribution index");
+      }
+      return (DistributionView(snapshot_, snapshot_->distributions_ +
+                                              record_->distributions + i));
+    }
+
+    /*! \brief Decode the factor. */
+    graff::Factor ToFactor(void) const {
+      std::vector<Symbol> variables;
+      variables.reserve(NumVariables());
+      for (std::size_t i = 0; i < NumVariables(); ++i) {
+        variables.push_back(VariableSymbol(i));
+      }
+      graff::Factor factor(Type(), std::move(variables));
+      factor.SetName(symbol());
+      for (std::size_t i = 0; i < NumDistributions(); ++i) {
+        factor.push_back(GetDistribution(i).ToMeasurement());
+      }
+      return (factor);
+    }
+
+  private:
+    std::size_t Check(std::size_t i) const {
+      if (i >= record_->num_variables) {
+        throw std::out_of_range("Snapshot: variable index");
+      }
+      return (record_->variables + i);
+    }
+  };
+
+private:
+  void *map_;
+  std::size_t size_;
+  const Header *header_;
+  const VariableRecord *variables_;
+  const FactorRecord *factors_;
+  const uint64_t *factor_variables_;
+  const DistributionRecord *distributions_;
+  const double *values_;
+  const StringRecord *strings_;
+  const char *string_data_;
+
+  // a section of count records, checked to lie within the file
+  template <typename T> const T *Section(uint64_t offset, uint64_t count) {
+    if (offset % 8 || offset > size_ ||
+        count > (size_ - offset) / sizeof(T)) {
+      throw std::runtime_error("Snapshot: corrupt table");
+    }
+    return (reinterpret_cast<const T *>(static_cast<const char *>(map_) +
+                                        offset));
+  }
+
+  void Close(void) {
+    if (map_) {
+      munmap(map_, size_);
+      map_ = nullptr;
+    }
+  }
+
+  // the string id and label encoding of the writer
+  class Strings {
+    std::unordered_map<std::string, uint32_t> ids_;
+
+  public:
+    std::vector<StringRecord> records;
+    std::string data;
+
+    uint32_t Id(const std::string &s) {
+      auto it = ids_.find(s);
+      if (it != ids_.end()) {
+        return (it->second);
+      }
+      const uint32_t id = static_cast<uint32_t>(records.size());
+      StringRecord record = {data.size(), s.size()};
+      records.push_back(record);
+      data.append(s.c_str(), s.size() + 1);
+      ids_[s] = id;
+      return (id);
+    }
+
+    uint64_t Label(const Symbol &symbol) {
+      return (symbol.interned() ? kStringLabel | Id(symbol.str())
+                                : symbol.key());
+    }
+  };
+
+  static uint64_t Align(uint64_t offset) { return ((offset + 7) & ~7ULL); }
+
+  // whether [first, first + count) lies within [0, total), without overflow
+  static bool Within(uint64_t first, uint64_t count, uint64_t total) {
+    return (first <= total && count <= total - first);
+  }
+
+  // whether the values of a distribution record match its kind and dim
+  bool Consistent(const DistributionRecord &d) const {
+    switch (d.kind) {
+    case kNormal:
+      return (d.form <= static_cast<uint32_t>(Normal::Covariance::kIsotropic) &&
+              d.dim <= d.num_values && d.dim < (1ULL << 32) &&
+              d.num_values - d.dim ==
+                  Normal::Size(d.dim,
+                               static_cast<Normal::Covariance>(d.form)));
+    case kSampleWeights: // samples, weights and the quantile
+      return (1 == d.num_values % 2 && d.dim == d.num_values / 2);
+    case kJson:
+      return (d.dim < header_->num_strings);
+    default:
+      return (false);
+    }
+  }
+
+public:
+  /*!
+   * \brief Map a snapshot.
+   * \throws std::runtime_error if it cannot be mapped or is not a valid
+   * snapshot.
+   */
+  explicit Snapshot(const std::string &path) : map_(nullptr), size_(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      throw std::runtime_error("Snapshot: cannot open " + path);
+    }
+    size_ = static_cast<std::size_t>(st.st_size);
+    if (size_ >= sizeof(Header)) {
+      map_ = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (!map_ || MAP_FAILED == map_) {
+      map_ = nullptr;
+      throw std::runtime_error("Snapshot: cannot map " + path);
+    }
+    header_ = static_cast<const Header *>(map_);
+    try {
+      if (0 != std::memcmp(header_->magic, Magic(), 8) ||
+          0x01020304 != header_->byte_order) {
+        throw std::runtime_error("Snapshot: " + path +
+                                 " is not a snapshot in this byte order");
+      }
+      variables_ = Section<VariableRecord>(header_->variables,
+                                           header_->num_variables);
+      factors_ = Section<FactorRecord>(header_->factors, header_->num_factors);
+      factor_variables_ = Section<uint64_t>(header_->factor_variables,
+                                            header_->num_factor_variables);
+      distributions_ = Section<DistributionRecord>(
+          header_->distributions, header_->num_distributions);
+      values_ = Section<double>(header_->values, header_->num_values);
+      strings_ = Section<StringRecord>(header_->strings, header_->num_strings);
+      string_data_ =
+          Section<char>(header_->string_data, header_->string_data_size);
+      // cross-references are checked once, so views need not
+      for (uint64_t i = 0; i < header_->num_factors; ++i) {
+        const FactorRecord &f = factors_[i];
+        if (!Within(f.variables, f.num_variables,
+                    header_->num_factor_variables) ||
+            !Within(f.distributions, f.num_distributions,
+                    header_->num_distributions)) {
+          throw std::runtime_error("Snapshot: corrupt factor table");
+        }
+      }
+      for (uint64_t i = 0; i < header_->num_distributions; ++i) {
+        const DistributionRecord &d = distributions_[i];
+        if (!Within(d.values, d.num_values, header_->num_values) ||
+            !Consistent(d)) {
+          throw std::runtime_error("Snapshot: corrupt distribution table");
+        }
+      }
+      for (uint64_t i = 0; i < header_->num_strings; ++i) {
+        if (!Within(strings_[i].offset, strings_[i].size,
+                    header_->string_data_size) ||
+            strings_[i].offset + strings_[i].size ==
+                header_->string_data_size ||
+            '\0' != string_data_[strings_[i].offset + strings_[i].size]) {
+          throw std::runtime_error("Snapshot: corrupt string table");
+        }
+      }
+    } catch (...) {
+      Close();
+      throw;
+    }
+  }
+
+  ~Snapshot() { Close(); }
+
+  Snapshot(const Snapshot &) = delete;
+  Snapshot &operator=(const Snapshot &) = delete;
+
+  std::string name(void) const { return (String(header_->name)); }
+  std::size_t NumVariables(void) const { return (header_->num_variables); }
+  std::size_t NumFactors(void) const { return (header_->num_factors); }
+
+  VariableView GetVariable(std::size_t i) const {
+    if (i >= header_->num_variables) {
+      throw std::out_of_range("Snapshot: variable index");
+    }
+    return (VariableView(this, variables_ + i));
+  }
+
+  FactorView GetFactor(std::size_t i) const {
+    if (i >= header_->num_factors) {
+      throw std::out_of_range("Snapshot: factor index");
+    }
+    return (FactorView(this, factors_ + i));
+  }
+
+  /*! \brief A string of the string table, in place. */
+  const char *String(uint32_t id) const {
+    if (id >= header_->num_strings) {
+      throw std::out_of_range("Snapshot: string id");
+    }
+    return (string_data_ + strings_[id].offset);
+  }
+
+  /*! \brief The text of a stored label. */
+  std::string Label(uint64_t label) const {
+    return (label & kStringLabel
+                ? std::string(String(static_cast<uint32_t>(label)))
+                : Symbol::FromKey(label).str());
+  }
+
+  /*! \brief The symbol of a stored label, in this process. */
+  Symbol ToSymbol(uint64_t label) const {
+    return (label & kStringLabel
+                ? Symbol(std::string(String(static_cast<uint32_t>(label))))
+                : Symbol::FromKey(label));
+  }
+
+  /*!
+   * \brief Materialize the snapshot into a session: its variables, then its
+   * factors, under their recorded labels.
+   */
+  void Load(Session &s) const {
+    for (std::size_t i = 0; i < NumVariables(); ++i) {
+      s.AddVariable(GetVariable(i).ToVariable());
+    }
+    for (std::size_t i = 0; i < NumFactors(); ++i) {
+      const FactorView factor = GetFactor(i);
+      s.AddFactor(factor.ToFactor(), factor.name());
+    }
+  }
+
+  /*!
+   * \brief Write a snapshot of a session.
+   * \throws std::runtime_error if the file cannot be written.
+   */
+  static void Write(const Session &s, const std::string &path) {
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, Magic(), 8);
+    header.byte_order = 0x01020304;
+
+    Strings strings;
+    header.name = strings.Id(s.name());
+    std::vector<VariableRecord> variables;
+    variables.reserve(s.NumVariables());
+    for (const graff::Variable &v : s.variables()) {
+      VariableRecord record = {strings.Label(v.symbol()),
+                               strings.Id(v.Type()), 0};
+      variables.push_back(record);
+    }
+    std::vector<FactorRecord> factors;
+    std::vector<uint64_t> factor_variables;
+    std::vector<DistributionRecord> distributions;
+    std::vector<double> values;
+    factors.reserve(s.NumFactors());
+    for (const graff::Factor &f : s.factors()) {
+      FactorRecord record = {strings.Label(f.symbol()),
+                             strings.Id(f.Type()),
+                             static_cast<uint32_t>(f.variables().size()),
+                             factor_variables.size(),
+                             static_cast<uint32_t>(f.measurements().size()),
+                             0,
+                             distributions.size()};
+      factors.push_back(record);
+      for (const Symbol &variable : f.variables()) {
+        factor_variables.push_back(strings.Label(variable));
+      }
+      for (const Measurement &m : f.measurements()) {
+        DistributionRecord dr = {kJson, 0, 0, values.size(), 0};
+        if (const Normal *normal = m.normal()) {
+          dr.kind = kNormal;
+          dr.form = static_cast<uint32_t>(normal->form());
+          dr.dim = normal->dim();
+          values.insert(values.end(), normal->mean().begin(),
+                        normal->mean().end());
+          values.insert(values.end(), normal->CompactCovariance().begin(),
+                        normal->CompactCovariance().end());
+        } else if (const NoiseModel *model = m.noise_model()) {
+          // stored in full: a snapshot does not depend on the registry
+          dr.kind = kNormal;
+          dr.form = static_cast<uint32_t>(model->noise.form());
+          dr.dim = model->noise.dim();
+          values.insert(values.end(), m.model_mean(),
+                        m.model_mean() + dr.dim);
+          values.insert(values.end(),
+                        model->noise.CompactCovariance().begin(),
+                        model->noise.CompactCovariance().end());
+        } else if (const SampleWeights *sw = m.sample_weights()) {
+          if (sw->samples().size() != sw->weights().size()) {
+            throw std::runtime_error("Snapshot: samples without weights");
+          }
+          dr.kind = kSampleWeights;
+          dr.dim = sw->samples().size();
+          values.insert(values.end(), sw->samples().begin(),
+                        sw->samples().end());
+          values.insert(values.end(), sw->weights().begin(),
+                        sw->weights().end());
+          values.push_back(sw->quantile());
+        } else {
+          dr.dim = strings.Id(m.ToJson().dump());
+        }
+        dr.num_values = values.size() - dr.values;
+        distributions.push_back(dr);
+      }
+    }
+
+    // lay the sections out after the header, each 8-byte aligned
+    uint64_t offset = sizeof(Header);
+    header.num_variables = variables.size();
+    header.variables = offset;
+    offset += variables.size() * sizeof(VariableRecord);
+    header.num_factors = factors.size();
+    header.factors = offset;
+    offset += factors.size() * sizeof(FactorRecord);
+    header.num_factor_variables = factor_variables.size();
+    header.factor_variables = offset;
+    offset += factor_variables.size() * sizeof(uint64_t);
+    header.num_distributions = distributions.size();
+    header.distributions = offset;
+    offset += distributions.size() * sizeof(DistributionRecord);
+    header.num_values = values.size();
+    header.values = offset;
+    offset += values.size() * sizeof(double);
+    header.num_strings = strings.records.size();
+    header.strings = offset;
+    offset += strings.records.size() * sizeof(StringRecord);
+    header.string_data_size = Align(strings.data.size());
+    header.string_data = offset;
+    strings.data.resize(header.string_data_size, '\0');
+
+    std::FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+      throw std::runtime_error("Snapshot: cannot write " + path);
+    }
+    bool ok = (1 == std::fwrite(&header, sizeof(header), 1, file));
+    ok &= (variables.size() == std::fwrite(variables.data(),
+                                           sizeof(VariableRecord),
+                                           variables.size(), file));
+    ok &= (factors.size() ==
+           std::fwrite(factors.data(), sizeof(FactorRecord), factors.size(),
+                       file));
+    ok &= (factor_variables.size() ==
+           std::fwrite(factor_variables.data(), sizeof(uint64_t),
+                       factor_variables.size(), file));
+    ok &= (distributions.size() ==
+           std::fwrite(distributions.data(), sizeof(DistributionRecord),
+                       distributions.size(), file));
+    ok &= (values.size() == std::fwrite(values.data(), sizeof(double),
+                                        values.size(), file));
+    ok &= (strings.records.size() ==
+           std::fwrite(strings.records.data(), sizeof(StringRecord),
+                       strings.records.size(), file));
+    ok &= (strings.data.size() == std::fwrite(strings.data.data(), 1,
+                                              strings.data.size(), file));
+    ok &= (0 == std::fclose(file));
+    if (!ok) {
+      throw std::runtime_error("Snapshot: cannot write " + path);
+    }
+  }
+};
+
+static_assert(sizeof(Snapshot::Header) == 128, "snapshot header layout");
+static_assert(sizeof(Snapshot::VariableRecord) == 16, "variable layout");
+static_assert(sizeof(Snapshot::FactorRecord) == 40, "factor layout");
+static_assert(sizeof(Snapshot::DistributionRecord) == 32,
+              "distribution layout");
+static_assert(sizeof(Snapshot::StringRecord) == 16, "string layout");
+
+} // namespace graff
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <graff/graff.hpp>
+
+namespace graff {
+
+/*!
+ * \brief Element-wise atan2 over arrays: angle[i] = atan2(y[i], x[i]).
+ *
+ * The loop body has no branches (the octant is reduced with selects, and the
+ * arctangent of the reduced ratio is a rational approximation, as in Cephes)
+ * so that the compiler can vectorize it, which it cannot do with std::atan2.
+ * GCC needs -fno-trapping-math to if-convert the selects; being header-only,
+ * the library cannot set it, so consumers that want the vectorized loop must
+ * compile with it themselves (as the sonar benchmark does). The result is
+ * within 2 ulp of std::atan2, signed zeros included.
+ *
+ * \param [in] y The ordinates.
+ * \param [in] x The abscissae.
+ * \param [in] n Number of elements.
+ * \param [out] angle The angles, in radians.
+ */
+inline void Atan2(const double *y, const double *x, std::size_t n,
+                  double *angle) {
+  const double P0 = -8.750608600031904122785e-1;
+  const double P1 = -1.615753718733365076637e1;
+  const double P2 = -7.500855792314704667340e1;
+  const double P3 = -1.228866684490136173410e2;
+  const double P4 = -6.485021904942025371773e1;
+  const double Q0 = 2.485846490142306297962e1;
+  const double Q1 = 1.650270098316988542046e2;
+  const double Q2 = 4.328810604912902668951e2;
+  const double Q3 = 4.853903996359136964868e2;
+  const double Q4 = 1.945506571482613964425e2;
+  for (std::size_t i = 0; i < n; ++i) {
+    // reduce to atan(t), t = lo / hi in [0, 1]; the origin maps to 0
+    const double ax = std::fabs(x[i]), ay = std::fabs(y[i]);
+    const bool steep = (ay > ax);
+    const double hi = (steep ? ay : ax), lo = (steep ? ax : ay);
+    const double t = (hi > 0.0 ? lo / hi : 0.0);
+    // above 0.66, atan(t) = pi/4 + atan((t - 1) / (t + 1))
+    const bool shifted = (t > 0.66);
+    const double r = (shifted ? (t - 1.0) / (t + 1.0) : t);
+    const double z = r * r;
+    const double p = (((P0 * z + P1) * z + P2) * z + P3) * z + P4;
+    const double q = ((((z + Q0) * z + Q1) * z + Q2) * z + Q3) * z + Q4;
+    double a = r + r * (z * p / q) + (shifted ? 0.25 * PI : 0.0);
+    a = (steep ? 0.5 * PI - a : a);
+    // std::signbit() would stop the vectorizer, copysign() does not
+    a = (std::copysign(1.0, x[i]) < 0.0 ? PI - a : a);
+    angle[i] = std::copysign(a, y[i]);
+  }
+}
+
+/*!
+ * \class SonarScan sonar.hpp
+ * \brief Turns the returns of a multibeam ping into RangeAzimuthElevation
+ * factors, a whole ping at a time.
+ *
+ * The returns are given as a contiguous array of Cartesian points in the
+ * sensor frame; they are converted to range, azimuth (about z, from x) and
+ * elevation (from the xy plane) by loops over the whole ping that the
+ * compiler can vectorize when the consumer compiles with -fno-math-errno and
+ * -fno-trapping-math (see Atan2()), and the buffers are reused from one ping
+ * to the next.
+ * AddTo() then emits one Point3 variable and one factor per return, with the
+ * same noise model throughout, into a batch; given the session's
+ * NoiseModels, the factors share it rather than each holding a copy.
+ *
+ * \code
+ *   graff::SonarScan scan;
+ *   graff::SonarScan::Noise noise = {0.01, 0.0001, 0.0001};
+ *   scan.Convert(xyz.data(), xyz.size() / 3);
+ *   scan.AddTo(batch, graff::Symbol('x', ping), 'p', ping, noise);
+ *   reply = batch.Submit(ep, session);
+ * \endcode
+ */
+class SonarScan {
+public:
+  /*!
+   * \struct Noise
+   * \brief The noise model of a sonar: variances of each measurement axis.
+   */
+  struct Noise {
+    double range;     /*!< m^2 */
+    double azimuth;   /*!< rad^2 */
+    double elevation; /*!< rad^2 */
+  };
+
+private:
+  std::vector<double> x_, y_, z_; /*!< deinterleaved returns */
+  std::vector<double> horizontal_;
+  std::vector<double> range_, azimuth_, elevation_;
+
+  void Resize(std::size_t n) {
+    horizontal_.resize(n);
+    range_.resize(n);
+    azimuth_.resize(n);
+    elevation_.resize(n);
+  }
+
+public:
+  /*!
+   * \brief Convert returns given as separate coordinate arrays.
+   * \param [in] x, y, z The coordinates of the returns, in the sensor frame.
+   * \param [in] n Number of returns.
+   * \return n
+   */
+  std::size_t Convert(const double *x, const double *y, const double *z,
+                      std::size_t n) {
+    Resize(n);
+    double *h = horizontal_.data();
+    double *r = range_.data();
+    for (std::size_t i = 0; i < n; ++i) {
+      const double xy = x[i] * x[i] + y[i] * y[i];
+      h[i] = std::sqrt(xy);
+      r[i] = std::sqrt(xy + z[i] * z[i]);
+    }
+    Atan2(y, x, n, azimuth_.data());
+    Atan2(z, h, n, elevation_.data());
+    return (n);
+  }
+
+  /*!
+   * \brief Convert returns given as interleaved points.
+   * \param [in] xyz The returns, as x, y, z triplets in the sensor frame.
+   * \param [in] n Number of returns (xyz holds 3n values).
+   * \return n
+   */
+  std::size_t Convert(const double *xyz, std::size_t n) {
+    x_.resize(n);
+    y_.resize(n);
+    z_.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      x_[i] = xyz[3 * i];
+      y_[i] = xyz[3 * i + 1];
+      z_[i] = xyz[3 * i + 2];
+    }
+    return (Convert(x_.data(), y_.data(), z_.data(), n));
+  }
+
+  /*! \brief Number of returns of the last converted ping. */
+  std::size_t size(void) const { return (range_.size()); }
+  const std::vector<double> &range(void) const { return (range_); }
+  const std::vector<double> &azimuth(void) const { return (azimuth_); }
+  const std::vector<double> &elevation(void) const { return (elevation_); }
+
+  /*!
+   * \brief Add the last converted ping to a batch: for return k, a Point3
+   * variable labelled Symbol(point, scan, k), and a RangeAzimuthElevation
+   * factor between it and the pose.
+   * \param [in,out] batch The batch; the ping's elements are appended in
+   * order, so that it can be submitted as a unit.
+   * \param [in] pose The pose the ping was taken from.
+   * \param [in] point The letter of the point labels, e.g. 'p'.
+   * \param [in] scan The first index of the point labels, e.g. the pose index.
+   * \param [in] noise The noise model of every return.
+   */
+  void AddTo(Batch &batch, const Symbol &pose, char point, uint64_t scan,
+             const Noise &noise) const {
+    const std::string point_type("Point3");
+    const std::string factor_type("RangeAzimuthElevation");
+    for (std::size_t k = 0; k < range_.size(); ++k) {
+      const Symbol label(point, scan, k);
+      batch.AddVariable(Variable(label, point_type));
+      Factor factor(factor_type, std::vector<Symbol>{pose, label});
+      factor.push_back(Normal(range_[k], noise.range));
+      factor.push_back(Normal(azimuth_[k], noise.azimuth));
+      factor.push_back(Normal(elevation_[k], noise.elevation));
+      batch.AddFactor(std::move(factor));
+    }
+  }
+
+  /*!
+   * \brief As AddTo() above, with measurements that share the noise models
+   * of the session (see NoiseModels) instead of each holding its variances.
+   * \param [in,out] models The session's noise models, e.g.
+   * session.noise_models().
+   */
+  void AddTo(Batch &batch, const Symbol &pose, char point, uint64_t scan,
+             const Noise &noise, NoiseModels &models) const {
+    const std::string point_type("Point3");
+    const std::string factor_type("RangeAzimuthElevation");
+    const std::shared_ptr<const NoiseModel> range_model =
+        models.Add(Normal(0.0, noise.range));
+    const std::shared_ptr<const NoiseModel> azimuth_model =
+        models.Add(Normal(0.0, noise.azimuth));
+    const std::shared_ptr<const NoiseModel> elevation_model =
+        models.Add(Normal(0.0, noise.elevation));
+    for (std::size_t k = 0; k < range_.size(); ++k) {
+      const Symbol label(point, scan, k);
+      batch.AddVariable(Variable(label, point_type));
+      Factor factor(factor_type, std::vector<Symbol>{pose, label});
+      factor.push_back(Measurement(&range_[k], 1, range_model));
+      factor.push_back(Measurement(&azimuth_[k], 1, azimuth_model));
+      factor.push_back(Measurement(&elevation_[k], 1, elevation_model));
+      batch.AddFactor(std::move(factor));
+    }
+  }
+};
+
+} // namespace graff
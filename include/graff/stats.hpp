@@ -0,0 +1,146 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+namespace graff {
+
+/*!
+ * \class Histogram stats.hpp
+ * \brief A fixed-size histogram of durations, in power-of-two nanosecond
+ * buckets (bucket i counts durations in [2^(i-1), 2^i) ns).
+ *
+ * Recording is a few integer operations and never allocates; quantiles are
+ * estimated to within a factor of two, which is enough to tell where the
+ * time goes.
+ */
+class Histogram {
+public:
+  static const int kBuckets = 64;
+
+private:
+  uint64_t buckets_[kBuckets];
+  uint64_t count_;
+  uint64_t sum_ns_;
+  uint64_t max_ns_;
+
+  static int Bucket(uint64_t ns) {
+    int bucket = 0;
+    while (ns && bucket < kBuckets - 1) {
+      ns >>= 1;
+      ++bucket;
+    }
+    return (bucket);
+  }
+
+public:
+  Histogram() { Clear(); }
+
+  void Clear(void) {
+    for (int i = 0; i < kBuckets; ++i) {
+      buckets_[i] = 0;
+    }
+    count_ = sum_ns_ = max_ns_ = 0;
+  }
+
+  void Record(uint64_t ns) {
+    ++buckets_[Bucket(ns)];
+    ++count_;
+    sum_ns_ += ns;
+    max_ns_ = (ns > max_ns_ ? ns : max_ns_);
+  }
+
+  void Record(std::chrono::steady_clock::duration d) {
+    Record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()));
+  }
+
+  uint64_t count(void) const { return (count_); }
+  uint64_t sum_ns(void) const { return (sum_ns_); }
+  uint64_t max_ns(void) const { return (max_ns_); }
+  double mean_ns(void) const {
+    return (count_ ? static_cast<double>(sum_ns_) / count_ : 0.0);
+  }
+
+  /*!
+   * \brief Estimate a quantile.
+   * \param [in] q The quantile, in [0, 1].
+   * \return The upper bound of the bucket holding it, in nanoseconds (capped
+   * by the largest recorded duration).
+   */
+  uint64_t Quantile(double q) const {
+    if (0 == count_) {
+      return (0);
+    }
+    const double rank = q * static_cast<double>(count_);
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+      seen += buckets_[i];
+      if (buckets_[i] && static_cast<double>(seen) >= rank) {
+        const uint64_t bound = (0 == i ? 0 : (i >= 63 ? ~0ULL : 1ULL << i));
+        return (bound < max_ns_ ? bound : max_ns_);
+      }
+    }
+    return (max_ns_);
+  }
+
+  /*!
+   * \brief Summary statistics, in microseconds, and the non-empty buckets as
+   * [upper bound in ns, count] pairs.
+   */
+  json ToJson(void) const {
+    json j;
+    j["count"] = count_;
+    j["mean_us"] = mean_ns() * 1e-3;
+    j["p50_us"] = Quantile(0.5) * 1e-3;
+    j["p90_us"] = Quantile(0.9) * 1e-3;
+    j["p99_us"] = Quantile(0.99) * 1e-3;
+    j["max_us"] = max_ns_ * 1e-3;
+    j["buckets"] = json::array();
+    for (int i = 0; i < kBuckets; ++i) {
+      if (buckets_[i]) {
+        j["buckets"].push_back(
+            {(0 == i ? 0 : (i >= 63 ? ~0ULL : 1ULL << i)), buckets_[i]});
+      }
+    }
+    return (j);
+  }
+};
+
+/*!
+ * \struct RequestStats stats.hpp
+ * \brief Counters for one request type (the "request" field of a request).
+ */
+struct RequestStats {
+  uint64_t count;          /*!< requests sent */
+  uint64_t errors;         /*!< replies whose status is not OK */
+  uint64_t timeouts;       /*!< attempts that got no reply in time */
+  uint64_t bytes_sent;     /*!< encoded requests, including retries */
+  uint64_t bytes_received; /*!< encoded replies */
+  Histogram serialize;     /*!< encoding (or streaming) the request */
+  Histogram round_trip;    /*!< from sending to receiving the reply */
+  Histogram parse;         /*!< decoding the reply */
+
+  RequestStats()
+      : count(0), errors(0), timeouts(0), bytes_sent(0), bytes_received(0) {}
+
+  json ToJson(void) const {
+    json j;
+    j["count"] = count;
+    j["errors"] = errors;
+    j["timeouts"] = timeouts;
+    j["bytes_sent"] = bytes_sent;
+    j["bytes_received"] = bytes_received;
+    j["serialize"] = serialize.ToJson();
+    j["round_trip"] = round_trip.ToJson();
+    j["parse"] = parse.ToJson();
+    return (j);
+  }
+};
+
+} // namespace graff
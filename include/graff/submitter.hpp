@@ -0,0 +1,309 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include <graff/graff.hpp>
+
+namespace graff {
+
+/*!
+ * \class Submitter submitter.hpp
+ * \brief Lets any number of threads submit elements to the endpoint without
+ * waiting for it.
+ *
+ * Variables and factors are pushed onto a lock-free multi-producer,
+ * single-consumer queue. A background I/O thread, which has exclusive use of
+ * the endpoint (ZeroMQ sockets are not thread-safe), drains the queue and
+ * sends what it finds as batches (see Batch), recording accepted elements in
+ * the session. Elements pushed by one thread are sent in the order they were
+ * pushed; elements pushed by different threads are sent in the order their
+ * pushes completed, so a factor may refer to a variable pushed by another
+ * thread once that push has returned.
+ *
+ * The queue holds at most capacity elements. When it is full, AddVariable()
+ * and AddFactor() either return false at once (Overflow::kReject) or wait
+ * for room (Overflow::kBlock); producers never wait for the network itself.
+ *
+ * The endpoint and the session must not be used by other threads until the
+ * submitter is stopped (or destroyed).
+ *
+ * \code
+ *   graff::Submitter submitter(ep, session);
+ *   // on any thread
+ *   submitter.AddFactor(std::move(range_measurement));
+ *   // later
+ *   submitter.Flush();
+ * \endcode
+ */
+class Submitter {
+public:
+  enum class Overflow {
+    kReject, /*!< drop the element and return false */
+    kBlock   /*!< wait until the I/O thread makes room */
+  };
+
+private:
+  // a queued element; factors and variables share one queue so that their
+  // relative order is kept, but each node only holds its own element
+  struct Node {
+    std::atomic<Node *> next;
+    bool is_factor;
+
+    explicit Node(bool factor) : next(nullptr), is_factor(factor) {}
+  };
+  struct VariableNode : Node {
+    Variable variable;
+
+    explicit VariableNode(Variable v) : Node(false), variable(std::move(v)) {}
+  };
+  struct FactorNode : Node {
+    Factor factor;
+
+    explicit FactorNode(Factor f) : Node(true), factor(std::move(f)) {}
+  };
+
+  Endpoint &ep_;
+  Session &session_;
+  const std::size_t capacity_;
+  const Overflow overflow_;
+  const std::size_t max_elements_;
+  const std::chrono::milliseconds linger_;
+  Batch batch_;
+
+  // intrusive MPSC queue (D. Vyukov): producers swap themselves in at head_,
+  // the consumer pops from tail_; stub_ keeps the queue from ever being empty
+  Node stub_;
+  std::atomic<Node *> head_;
+  Node *tail_;
+
+  std::atomic<std::size_t> pending_; /*!< pushed and not yet submitted */
+  std::atomic<bool> idle_;           /*!< the I/O thread is waiting */
+  std::atomic<bool> stop_;
+  std::mutex mutex_;
+  std::condition_variable wake_;    /*!< wakes the I/O thread */
+  std::condition_variable drained_; /*!< signals pending_ went down */
+
+  std::atomic<uint64_t> submitted_;
+  std::atomic<uint64_t> rejected_;
+  std::atomic<uint64_t> failed_;
+  std::atomic<uint64_t> requests_;
+  std::thread thread_;
+
+  void Enqueue(Node *node) {
+    Node *prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // take the oldest element, or nullptr if there is none (or the newest push
+  // is still in progress)
+  Node *Dequeue(void) {
+    Node *tail = tail_;
+    Node *next = tail->next.load(std::memory_order_acquire);
+    if (&stub_ == tail) {
+      if (!next) {
+        return (nullptr);
+      }
+      tail_ = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next) {
+      tail_ = next;
+      return (tail);
+    }
+    if (tail != head_.load(std::memory_order_acquire)) {
+      return (nullptr);
+    }
+    stub_.next.store(nullptr, std::memory_order_relaxed);
+    Enqueue(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+      tail_ = next;
+      return (tail);
+    }
+    return (nullptr);
+  }
+
+  // reserve room for one element, according to the overflow policy
+  bool Reserve(void) {
+    std::size_t pending = pending_.load();
+    while (true) {
+      if (pending < capacity_) {
+        if (pending_.compare_exchange_weak(pending, pending + 1)) {
+          // checked after the reservation, so that the I/O thread either
+          // sees it or this sees the stop
+          if (!stop_.load()) {
+            return (true);
+          }
+          --pending_;
+          ++rejected_;
+          return (false);
+        }
+      } else if (Overflow::kReject == overflow_ || stop_.load()) {
+        ++rejected_;
+        return (false);
+      } else {
+        std::unique_lock<std::mutex> lock(mutex_);
+        drained_.wait_for(lock, linger_);
+        pending = pending_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool Push(Node *node) {
+    Enqueue(node);
+    if (idle_.load(std::memory_order_acquire)) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      wake_.notify_one();
+    }
+    return (true);
+  }
+
+  // move up to max_elements_ queued elements into the batch
+  std::size_t Drain(void) {
+    std::size_t n = 0;
+    while (n < max_elements_) {
+      Node *node = Dequeue();
+      if (!node) {
+        break;
+      }
+      if (node->is_factor) {
+        FactorNode *factor = static_cast<FactorNode *>(node);
+        batch_.AddFactor(std::move(factor->factor));
+        delete factor;
+      } else {
+        VariableNode *variable = static_cast<VariableNode *>(node);
+        batch_.AddVariable(std::move(variable->variable));
+        delete variable;
+      }
+      ++n;
+    }
+    return (n);
+  }
+
+  void Run(void) {
+    while (true) {
+      std::size_t n = Drain();
+      if (0 == n) {
+        if (stop_.load() && 0 == pending_.load()) {
+          return;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.store(true, std::memory_order_release);
+        // a push may have landed between Drain() and idle_ being set, so
+        // never sleep for longer than the linger time
+        wake_.wait_for(lock, linger_);
+        idle_.store(false, std::memory_order_release);
+        continue;
+      }
+      // errors are reported per element, so "failed" excludes the elements
+      // that were recorded in the session before one occurred
+      json reply = batch_.Submit(ep_, session_);
+      ++requests_;
+      failed_ += reply["failed"].size();
+      submitted_ += n;
+      pending_.fetch_sub(n);
+      std::lock_guard<std::mutex> lock(mutex_);
+      drained_.notify_all();
+    }
+  }
+
+public:
+  /*!
+   * \brief Start the I/O thread.
+   * \param [in] ep The endpoint, used only by the I/O thread from now on.
+   * \param [in] s The session accepted elements are recorded in.
+   * \param [in] capacity Maximum number of queued elements.
+   * \param [in] overflow What to do when the queue is full.
+   * \param [in] max_elements Maximum number of elements per request.
+   * \param [in] linger_ms How long the idle I/O thread sleeps between checks
+   * of the queue, at most.
+   */
+  Submitter(Endpoint &ep, Session &s, std::size_t capacity = 1 << 16,
+            Overflow overflow = Overflow::kReject,
+            std::size_t max_elements = 1024, long linger_ms = 1)
+      : ep_(ep), session_(s), capacity_(capacity > 0 ? capacity : 1),
+        overflow_(overflow), max_elements_(max_elements > 0 ? max_elements : 1),
+        linger_(linger_ms > 0 ? linger_ms : 1), batch_(max_elements_),
+        stub_(false), head_(&stub_), tail_(&stub_), pending_(0), idle_(false),
+        stop_(false), submitted_(0), rejected_(0), failed_(0), requests_(0) {
+    thread_ = std::thread(&Submitter::Run, this);
+  }
+
+  /*! \brief Stop, after sending everything queued so far. */
+  ~Submitter() { Stop(); }
+
+  Submitter(const Submitter &) = delete;
+  Submitter &operator=(const Submitter &) = delete;
+
+  /*!
+   * \brief Queue a variable; may be called from any thread.
+   * \return false if the queue is full (with Overflow::kReject) or the
+   * submitter is stopped.
+   */
+  bool AddVariable(Variable variable) {
+    if (!Reserve()) {
+      return (false);
+    }
+    return (Push(new VariableNode(std::move(variable))));
+  }
+
+  /*!
+   * \brief Queue a factor; may be called from any thread.
+   * \return false if the queue is full (with Overflow::kReject) or the
+   * submitter is stopped.
+   */
+  bool AddFactor(Factor factor) {
+    if (!Reserve()) {
+      return (false);
+    }
+    return (Push(new FactorNode(std::move(factor))));
+  }
+
+  /*!
+   * \brief Wait until every element queued so far has been answered by the
+   * endpoint.
+   */
+  void Flush(void) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    wake_.notify_one();
+    while (0 != pending_.load()) {
+      drained_.wait_for(lock, linger_);
+    }
+  }
+
+  /*!
+   * \brief Send everything queued so far, then stop the I/O thread. Further
+   * elements are rejected. The endpoint and session can be used again once
+   * this returns.
+   */
+  void Stop(void) {
+    stop_.store(true);
+    if (thread_.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wake_.notify_one();
+      }
+      thread_.join();
+    }
+  }
+
+  /*! \brief Number of elements queued and not yet answered. */
+  std::size_t pending(void) const { return (pending_.load()); }
+  /*! \brief Number of elements sent to the endpoint. */
+  uint64_t submitted(void) const { return (submitted_.load()); }
+  /*! \brief Number of elements the endpoint rejected (or never received). */
+  uint64_t failed(void) const { return (failed_.load()); }
+  /*! \brief Number of elements turned away because the queue was full. */
+  uint64_t rejected(void) const { return (rejected_.load()); }
+  /*! \brief Number of batches sent (see Batch::Submit). */
+  uint64_t requests(void) const { return (requests_.load()); }
+};
+
+} // namespace graff
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+#include <graff/writer.hpp>
+
+namespace graff {
+
+/*!
+ * \class SymbolTable symbol.hpp
+ * \brief Process-wide table of interned strings (labels that are not of the
+ * char-plus-index form, and type names).
+ *
+ * Interned strings are never removed, so references returned by Lookup()
+ * stay valid for the lifetime of the process. The table is thread-safe:
+ * Intern() takes a lock, but Lookup(), which serialization calls for every
+ * element, does not. The strings are kept in chunks of doubling size that
+ * are never moved, and each new string is published with the table size.
+ */
+class SymbolTable {
+  static const uint32_t kFirstChunk = 64; /*!< strings in the first chunk */
+  static const int kChunks = 27;          /*!< enough for every uint32_t id */
+
+  std::mutex mutex_;
+  std::atomic<std::string *> chunks_[kChunks];
+  std::atomic<uint32_t> size_;
+  std::unordered_map<std::string, uint32_t> ids_;
+
+  // chunk k holds kFirstChunk * 2^k strings, from id kFirstChunk * (2^k - 1)
+  static void Locate(uint32_t id, int &chunk, uint32_t &offset) {
+    uint32_t i = id / kFirstChunk + 1;
+    chunk = 0;
+    while (i > 1) {
+      i >>= 1;
+      ++chunk;
+    }
+    offset = id - kFirstChunk * ((1u << chunk) - 1);
+  }
+
+  SymbolTable() : size_(0) {
+    for (std::atomic<std::string *> &chunk : chunks_) {
+      chunk.store(nullptr, std::memory_order_relaxed);
+    }
+    Intern(""); // the empty string is id 0
+  }
+
+  ~SymbolTable() {
+    for (std::atomic<std::string *> &chunk : chunks_) {
+      delete[] chunk.load(std::memory_order_relaxed);
+    }
+  }
+
+public:
+  static SymbolTable &Instance(void) {
+    static SymbolTable table;
+    return (table);
+  }
+
+  SymbolTable(const SymbolTable &) = delete;
+  SymbolTable &operator=(const SymbolTable &) = delete;
+
+  /*!
+   * \brief Intern a string.
+   * \return Its id; equal strings get equal ids.
+   */
+  uint32_t Intern(const std::string &s) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = ids_.find(s);
+    if (it != ids_.end()) {
+      return (it->second);
+    }
+    const uint32_t id = size_.load(std::memory_order_relaxed);
+    int chunk;
+    uint32_t offset;
+    Locate(id, chunk, offset);
+    std::string *strings = chunks_[chunk].load(std::memory_order_relaxed);
+    if (!strings) {
+      strings = new std::string[kFirstChunk << chunk];
+      chunks_[chunk].store(strings, std::memory_order_release);
+    }
+    strings[offset] = s;
+    ids_[s] = id;
+    size_.store(id + 1, std::memory_order_release); // publishes the string
+    return (id);
+  }
+
+  /*!
+   * \brief The string interned under an id; lock-free.
+   */
+  const std::string &Lookup(uint32_t id) const {
+    // synchronizes with the Intern() that published the id
+    size_.load(std::memory_order_acquire);
+    int chunk;
+    uint32_t offset;
+    Locate(id, chunk, offset);
+    return (chunks_[chunk].load(std::memory_order_acquire)[offset]);
+  }
+
+  std::size_t size(void) const {
+    return (size_.load(std::memory_order_acquire));
+  }
+};
+
+/*!
+ * \class Symbol symbol.hpp
+ * \brief A compact 64-bit key for a variable or factor label.
+ *
+ * Labels made of one letter and an index (e.g. "x17", as in iSAM or GTSAM),
+ * or of one letter and two indices (e.g. "p12_60" for landmark 60 seen from
+ * pose 12), are packed directly into the key as long as the indices fit; any
+ * other label is interned in the SymbolTable. Either way the key is hashed
+ * and compared as an integer, and the label string is only produced when it
+ * is needed, e.g. for serialization (which does not allocate).
+ */
+class Symbol {
+  static const uint64_t kInterned = 1ULL << 63;
+  static const uint64_t kPair = 1ULL << 62;
+  static const uint64_t kIndexMask = (1ULL << 48) - 1;
+  static const uint64_t kPairMask = (1ULL << 24) - 1;
+
+  uint64_t key_;
+
+  // parse a canonical (no leading zeros) decimal index from s[begin, end)
+  static bool ParseIndex(const std::string &s, std::size_t begin,
+                         std::size_t end, uint64_t max, uint64_t &index) {
+    if (begin == end || end - begin > 15 ||
+        ('0' == s[begin] && end - begin > 1)) {
+      return (false);
+    }
+    index = 0;
+    for (std::size_t i = begin; i < end; ++i) {
+      if (!std::isdigit(static_cast<unsigned char>(s[i]))) {
+        return (false);
+      }
+      index = index * 10 + static_cast<uint64_t>(s[i] - '0');
+    }
+    return (index <= max);
+  }
+
+  // format the label of a packed symbol, returns its length
+  int Format(char (&buffer)[48]) const {
+    if (key_ & kPair) {
+      return (std::snprintf(buffer, sizeof(buffer), "%c%llu_%llu", chr(),
+                            static_cast<unsigned long long>(index()),
+                            static_cast<unsigned long long>(subindex())));
+    }
+    return (std::snprintf(buffer, sizeof(buffer), "%c%llu", chr(),
+                          static_cast<unsigned long long>(index())));
+  }
+
+  static bool Packable(char c) {
+    return (0 != std::isalpha(static_cast<unsigned char>(c)));
+  }
+
+  // the key of a label that cannot be packed
+  static uint64_t InternedKey(const std::string &label) {
+    return (kInterned | SymbolTable::Instance().Intern(label));
+  }
+
+  const std::string &Interned(void) const {
+    return (SymbolTable::Instance().Lookup(
+        static_cast<uint32_t>(key_ & 0xffffffff)));
+  }
+
+public:
+  /*! \brief The empty label. */
+  Symbol() : key_(kInterned) {}
+
+  /*!
+   * \brief A char-plus-index symbol, e.g. Symbol('x', 17) for "x17". It is
+   * packed if c is a letter and the index is below 2^48, and its label is
+   * interned otherwise, so that it always equals Symbol(str()).
+   */
+  Symbol(char c, uint64_t index)
+      : key_(Packable(c) && index <= kIndexMask
+                 ? (static_cast<uint64_t>(static_cast<unsigned char>(c))
+                    << 48) |
+                       index
+                 : InternedKey(std::string(1, c) + std::to_string(index))) {}
+
+  /*!
+   * \brief A char-plus-two-indices symbol, e.g. Symbol('p', 12, 60) for
+   * "p12_60". It is packed if c is a letter and both indices are below 2^24,
+   * and its label is interned otherwise.
+   */
+  Symbol(char c, uint64_t index, uint64_t subindex)
+      : key_(Packable(c) && index <= kPairMask && subindex <= kPairMask
+                 ? kPair |
+                       (static_cast<uint64_t>(static_cast<unsigned char>(c))
+                        << 48) |
+                       (index << 24) | subindex
+                 : InternedKey(std::string(1, c) + std::to_string(index) +
+                               "_" + std::to_string(subindex))) {}
+
+  /*!
+   * \brief The symbol for a label.
+   */
+  explicit Symbol(const std::string &label) {
+    const std::size_t split = label.find('_');
+    uint64_t first, second;
+    const bool letter = (label.size() >= 2 && Packable(label[0]));
+    if (letter && std::string::npos == split &&
+        ParseIndex(label, 1, label.size(), kIndexMask, first)) {
+      key_ = Symbol(label[0], first).key_;
+    } else if (letter && std::string::npos != split &&
+               ParseIndex(label, 1, split, kPairMask, first) &&
+               ParseIndex(label, split + 1, label.size(), kPairMask, second)) {
+      key_ = Symbol(label[0], first, second).key_;
+    } else {
+      key_ = InternedKey(label);
+    }
+  }
+
+  /*!
+   * \brief The symbol with a given key(). Interned keys are only meaningful
+   * in the process that interned them.
+   */
+  static Symbol FromKey(uint64_t key) {
+    Symbol symbol;
+    symbol.key_ = key;
+    return (symbol);
+  }
+
+  uint64_t key(void) const { return (key_); }
+  bool interned(void) const { return (0 != (key_ & kInterned)); }
+  bool empty(void) const { return (kInterned == key_); }
+  char chr(void) const { return (static_cast<char>((key_ >> 48) & 0xff)); }
+  /*! \brief The (first) index of a packed symbol. */
+  uint64_t index(void) const {
+    return ((key_ & kPair) ? (key_ >> 24) & kPairMask : key_ & kIndexMask);
+  }
+  /*! \brief The second index of a two-index symbol, 0 otherwise. */
+  uint64_t subindex(void) const {
+    return ((key_ & kPair) ? key_ & kPairMask : 0);
+  }
+
+  /*!
+   * \brief The label.
+   */
+  std::string str(void) const {
+    if (interned()) {
+      return (Interned());
+    }
+    char buffer[48];
+    return (std::string(buffer, Format(buffer)));
+  }
+
+  /*!
+   * \brief Write the label as a string value.
+   */
+  void Write(Writer &w) const {
+    if (interned()) {
+      w.String(Interned());
+      return;
+    }
+    char buffer[48];
+    const int n = Format(buffer);
+    w.String(buffer, n);
+  }
+
+  bool operator==(const Symbol &other) const { return (key_ == other.key_); }
+  bool operator!=(const Symbol &other) const { return (key_ != other.key_); }
+  bool operator<(const Symbol &other) const { return (key_ < other.key_); }
+};
+
+inline std::ostream &operator<<(std::ostream &os, const Symbol &symbol) {
+  return (os << symbol.str());
+}
+
+} // namespace graff
+
+namespace std {
+template <> struct hash<graff::Symbol> {
+  std::size_t operator()(const graff::Symbol &symbol) const {
+    return (std::hash<uint64_t>()(symbol.key()));
+  }
+};
+} // namespace std
@@ -0,0 +1,332 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <graff/graff.hpp>
+
+namespace graff {
+
+/*
+ * Variable types: the type name, and the dimension of the variable.
+ */
+struct Pose2 {
+  static constexpr const char *Name(void) { return ("Pose2"); }
+  enum : std::size_t { kDim = 3 };
+};
+struct Pose3 {
+  static constexpr const char *Name(void) { return ("Pose3"); }
+  enum : std::size_t { kDim = 6 };
+};
+struct Point2 {
+  static constexpr const char *Name(void) { return ("Point2"); }
+  enum : std::size_t { kDim = 2 };
+};
+struct Point3 {
+  static constexpr const char *Name(void) { return ("Point3"); }
+  enum : std::size_t { kDim = 3 };
+};
+
+/*!
+ * \brief The interned id of a variable or factor type, looked up once per
+ * type.
+ */
+template <typename T> uint32_t InternedType(void) {
+  static const uint32_t id = SymbolTable::Instance().Intern(T::Name());
+  return (id);
+}
+
+/*!
+ * \class FixedNormal typed.hpp
+ * \brief A normal distribution of a dimension known at compile time, held in
+ * fixed-size arrays.
+ *
+ * It is sent in the same form as the equivalent Normal, i.e. with the
+ * covariance in its most compact exact form. Note that an array initializer
+ * with too many values does not compile, but one with too few is padded with
+ * zeros.
+ */
+template <std::size_t N> class FixedNormal {
+  static_assert(N > 0, "FixedNormal: the dimension must be positive");
+
+  std::array<double, N> mean_;
+  std::array<double, N * N> cov_; /*!< column-major */
+
+public:
+  FixedNormal() : mean_(), cov_() {}
+
+  /*!
+   * \brief Constructor for a univariate normal.
+   */
+  template <std::size_t M = N, typename = typename std::enable_if<1 == M>::type>
+  FixedNormal(double mean, double var) : mean_(), cov_() {
+    mean_[0] = mean;
+    cov_[0] = var;
+  }
+
+  /*!
+   * \brief Constructor.
+   * \param [in] mean Mean vector
+   * \param [in] cov Covariance matrix, in column-major order.
+   */
+  FixedNormal(const std::array<double, N> &mean,
+              const std::array<double, N * N> &cov)
+      : mean_(mean), cov_(cov) {}
+
+  static FixedNormal Diagonal(const std::array<double, N> &mean,
+                              const std::array<double, N> &var) {
+    FixedNormal normal;
+    normal.mean_ = mean;
+    for (std::size_t i = 0; i < N; ++i) {
+      normal.cov_[i + i * N] = var[i];
+    }
+    return (normal);
+  }
+
+  static FixedNormal Isotropic(const std::array<double, N> &mean, double var) {
+    FixedNormal normal;
+    normal.mean_ = mean;
+    for (std::size_t i = 0; i < N; ++i) {
+      normal.cov_[i + i * N] = var;
+    }
+    return (normal);
+  }
+
+  static constexpr std::size_t dim(void) { return (N); }
+  const std::array<double, N> &mean(void) const { return (mean_); }
+  double cov(std::size_t i, std::size_t j) const { return (cov_[i + j * N]); }
+
+  /*!
+   * \brief The compact form of the covariance, as Normal would choose it.
+   */
+  Normal::Covariance form(void) const {
+    return (Normal::DetectForm(cov_.data(), N));
+  }
+
+  Normal ToNormal(void) const {
+    return (Normal(std::vector<double>(mean_.begin(), mean_.end()),
+                   std::vector<double>(cov_.begin(), cov_.end())));
+  }
+
+  json ToJson(void) const { return (ToNormal().ToJson()); }
+
+  /*! \brief Stream the distribution, as Normal::Write() would. */
+  void Write(Writer &w) const {
+    const Normal::Covariance compact =
+        (w.covariance_forms() ? form() : Normal::Covariance::kDense);
+    std::array<double, N * N> packed;
+    const double *cov = cov_.data();
+    if (Normal::Covariance::kDense != compact) {
+      Normal::Pack(cov, N, compact, packed.data());
+      cov = packed.data();
+    }
+    Normal::Write(w, mean_.data(), N, cov, Normal::Size(N, compact), compact);
+  }
+};
+
+/*!
+ * \class TypedVariable typed.hpp
+ * \brief A variable whose type is known at compile time, e.g.
+ * TypedVariable<Pose3>.
+ *
+ * It converts to a Variable (without allocating) wherever one is expected,
+ * e.g. AddVariable() or Batch::AddVariable().
+ */
+template <typename T> class TypedVariable {
+  Symbol label_;
+
+public:
+  typedef T Type;
+
+  explicit TypedVariable(const Symbol &label) : label_(label) {}
+  explicit TypedVariable(const std::string &label) : label_(label) {}
+
+  const Symbol &symbol(void) const { return (label_); }
+  std::string name(void) const { return (label_.str()); }
+  static constexpr const char *TypeName(void) { return (T::Name()); }
+  static constexpr std::size_t dim(void) { return (T::kDim); }
+
+  operator Variable(void) const {
+    return (Variable(label_, InternedType<T>()));
+  }
+};
+
+/*
+ * Factor types: the type name, the types of the variables it connects, and
+ * its measurements, in order.
+ */
+struct PriorPose2 {
+  static constexpr const char *Name(void) { return ("Prior"); }
+  typedef std::tuple<Pose2> Variables;
+  typedef std::tuple<FixedNormal<3>> Measurements;
+};
+struct Pose2Pose2 {
+  static constexpr const char *Name(void) { return ("Pose2Pose2"); }
+  typedef std::tuple<Pose2, Pose2> Variables;
+  typedef std::tuple<FixedNormal<3>> Measurements;
+};
+/*! \brief Bearing, then range. */
+struct Pose2Point2BearingRange {
+  static constexpr const char *Name(void) {
+    return ("Pose2Point2BearingRange");
+  }
+  typedef std::tuple<Pose2, Point2> Variables;
+  typedef std::tuple<FixedNormal<1>, FixedNormal<1>> Measurements;
+};
+/*! \brief Roll, pitch and depth. */
+struct PartialPriorRollPitchZ {
+  static constexpr const char *Name(void) {
+    return ("PartialPriorRollPitchZ");
+  }
+  typedef std::tuple<Pose3> Variables;
+  typedef std::tuple<FixedNormal<3>> Measurements;
+};
+/*! \brief Odometry in x, y and yaw. */
+struct PartialPose3XYYaw {
+  static constexpr const char *Name(void) { return ("PartialPose3XYYaw"); }
+  typedef std::tuple<Pose3, Pose3> Variables;
+  typedef std::tuple<FixedNormal<3>> Measurements;
+};
+/*! \brief Range, azimuth and elevation of a point seen from a pose. */
+struct Pose3Point3RAE {
+  static constexpr const char *Name(void) { return ("RangeAzimuthElevation"); }
+  typedef std::tuple<Pose3, Point3> Variables;
+  typedef std::tuple<FixedNormal<1>, FixedNormal<1>, FixedNormal<1>>
+      Measurements;
+};
+struct Point3Point3 {
+  static constexpr const char *Name(void) { return ("Point3Point3"); }
+  typedef std::tuple<Point3, Point3> Variables;
+  typedef std::tuple<FixedNormal<3>> Measurements;
+};
+
+/*!
+ * \class TypedFactor typed.hpp
+ * \brief A factor whose type is known at compile time, e.g.
+ * TypedFactor<Pose3Point3RAE>.
+ *
+ * It is constructed from its variables and then its measurements, and the
+ * number, types and dimensions of the arguments are checked by the compiler:
+ *
+ * \code
+ *   graff::TypedVariable<graff::Pose3> pose(graff::Symbol('x', 1));
+ *   graff::TypedVariable<graff::Point3> point(graff::Symbol('p', 1, 0));
+ *   graff::TypedFactor<graff::Pose3Point3RAE> rae(
+ *       pose, point, graff::FixedNormal<1>(r, 0.01),
+ *       graff::FixedNormal<1>(az, 0.0001), graff::FixedNormal<1>(el, 0.0001));
+ *   batch.AddFactor(rae);
+ * \endcode
+ *
+ * It converts to a Factor wherever one is expected (which copies the
+ * measurements into Normal objects), and can be streamed as is with Write().
+ * New factor types are declared like the ones above.
+ */
+template <typename F> class TypedFactor {
+public:
+  typedef typename F::Variables Variables;
+  typedef typename F::Measurements Measurements;
+  static const std::size_t kArity = std::tuple_size<Variables>::value;
+  static const std::size_t kMeasurements =
+      std::tuple_size<Measurements>::value;
+  static_assert(kArity > 0 && kMeasurements > 0,
+                "TypedFactor: a factor type needs variables and measurements");
+
+private:
+  std::array<Symbol, kArity> variables_;
+  Measurements measurements_;
+
+  // the type of constructor argument I
+  template <std::size_t I, bool variable = (I < kArity)> struct Argument {
+    typedef TypedVariable<typename std::tuple_element<I, Variables>::type>
+        type;
+  };
+  template <std::size_t I> struct Argument<I, false> {
+    typedef typename std::tuple_element<I - kArity, Measurements>::type type;
+  };
+
+  template <std::size_t I> using Index = std::integral_constant<std::size_t, I>;
+
+  template <std::size_t I> void Assign(void) {}
+  template <std::size_t I, typename... Rest>
+  void Assign(const typename Argument<I>::type &argument,
+              const Rest &... rest) {
+    Store(argument, Index<I>());
+    Assign<I + 1>(rest...);
+  }
+
+  template <typename T, std::size_t I>
+  void Store(const TypedVariable<T> &variable, Index<I>) {
+    variables_[I] = variable.symbol();
+  }
+  template <std::size_t N, std::size_t I>
+  void Store(const FixedNormal<N> &normal, Index<I>) {
+    std::get<I - kArity>(measurements_) = normal;
+  }
+
+  void Append(Factor &, Index<kMeasurements>) const {}
+  template <std::size_t I> void Append(Factor &factor, Index<I>) const {
+    factor.push_back(std::get<I>(measurements_).ToNormal());
+    Append(factor, Index<I + 1>());
+  }
+
+  void Write(Writer &, Index<kMeasurements>) const {}
+  template <std::size_t I> void Write(Writer &w, Index<I>) const {
+    std::get<I>(measurements_).Write(w);
+    Write(w, Index<I + 1>());
+  }
+
+public:
+  /*!
+   * \brief Constructor.
+   * \param [in] first, second, rest The variables (as TypedVariable of the
+   * factor's variable types), then the measurements, in order.
+   */
+  template <typename First, typename Second, typename... Rest>
+  TypedFactor(const First &first, const Second &second, const Rest &... rest) {
+    static_assert(2 + sizeof...(Rest) == kArity + kMeasurements,
+                  "TypedFactor: wrong number of variables or measurements");
+    Assign<0>(first, second, rest...);
+  }
+
+  static constexpr const char *TypeName(void) { return (F::Name()); }
+  const std::array<Symbol, kArity> &variables(void) const {
+    return (variables_);
+  }
+  const Measurements &measurements(void) const { return (measurements_); }
+
+  operator Factor(void) const {
+    Factor factor(InternedType<F>(),
+                  std::vector<Symbol>(variables_.begin(), variables_.end()));
+    Append(factor, Index<0>());
+    return (factor);
+  }
+
+  json ToJson(void) const { return (Factor(*this).ToJson()); }
+
+  /*! \brief Stream the factor, as Factor::Write() would. */
+  void Write(Writer &w) const {
+    w.BeginObject(3);
+    w.Key("factor");
+    w.BeginObject(1);
+    w.Key("measurement");
+    w.BeginArray(kMeasurements);
+    Write(w, Index<0>());
+    w.EndArray();
+    w.EndObject();
+    w.Key("factorType");
+    w.String(F::Name());
+    w.Key("variables");
+    w.BeginArray(kArity);
+    for (const Symbol &variable : variables_) {
+      variable.Write(w);
+    }
+    w.EndArray();
+    w.EndObject();
+  }
+};
+
+} // namespace graff
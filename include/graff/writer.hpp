@@ -0,0 +1,412 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <graff/encoding.hpp>
+
+namespace graff {
+
+/*!
+ * \class Writer writer.hpp
+ * \brief A streaming serializer that writes values straight into a reusable
+ * buffer, in any of the wire encodings, without building a json DOM.
+ *
+ * Objects and arrays are opened with the number of entries they will hold.
+ * When that number is not known up front (e.g. a batch that is cut at a size
+ * limit), the binary encodings reserve a 32-bit count that is patched when
+ * the container is closed. Clear() keeps the buffer capacity, so a writer
+ * that is reused does not allocate once it has grown to the message size.
+ */
+class Writer {
+public:
+  static const std::size_t kUnknown = static_cast<std::size_t>(-1);
+
+  /*! \brief A position to Rewind() to, within the current container. */
+  struct Mark {
+    std::size_t size;
+    uint32_t count;
+  };
+
+private:
+  struct Level {
+    bool object;
+    bool patch;         /*!< count must be patched at header */
+    std::size_t header; /*!< offset of the 32-bit count placeholder */
+    uint32_t count;     /*!< entries written so far */
+  };
+  static const int kMaxDepth = 32;
+
+  std::string out_;
+  Encoding encoding_;
+  Level levels_[kMaxDepth];
+  int depth_;
+  bool after_key_;
+  uint64_t model_references_; /*!< see SetModelReferences() */
+  bool covariance_forms_; /*!< see SetCovarianceForms() */
+
+  void Put(uint8_t byte) { out_ += static_cast<char>(byte); }
+
+  void PutBigEndian(uint64_t value, int bytes) {
+    for (int shift = 8 * (bytes - 1); shift >= 0; shift -= 8) {
+      Put(static_cast<uint8_t>((value >> shift) & 0xff));
+    }
+  }
+
+  // CBOR header: major type plus the shortest argument encoding
+  void PutCbor(uint8_t major, uint64_t n) {
+    major = static_cast<uint8_t>(major << 5);
+    if (n < 24) {
+      Put(major | static_cast<uint8_t>(n));
+    } else if (n < 0x100) {
+      Put(major | 24);
+      PutBigEndian(n, 1);
+    } else if (n < 0x10000) {
+      Put(major | 25);
+      PutBigEndian(n, 2);
+    } else if (n < 0x100000000ULL) {
+      Put(major | 26);
+      PutBigEndian(n, 4);
+    } else {
+      Put(major | 27);
+      PutBigEndian(n, 8);
+    }
+  }
+
+  // msgpack map/array header; fix is the fixmap/fixarray prefix
+  void PutMsgPackContainer(uint8_t fix, uint8_t tag16, uint8_t tag32,
+                           std::size_t n) {
+    if (n < 16) {
+      Put(fix | static_cast<uint8_t>(n));
+    } else if (n < 0x10000) {
+      Put(tag16);
+      PutBigEndian(n, 2);
+    } else {
+      Put(tag32);
+      PutBigEndian(n, 4);
+    }
+  }
+
+  // account for a new value (or key) in the enclosing container
+  void Separator(void) {
+    if (0 == depth_) {
+      return;
+    }
+    Level &level = levels_[depth_ - 1];
+    if (level.object && after_key_) {
+      after_key_ = false; // a value completes its key's entry
+      return;
+    }
+    if (Encoding::kJson == encoding_ && level.count > 0) {
+      Put(',');
+    }
+    ++level.count;
+  }
+
+  void Open(bool object, std::size_t n) {
+    Separator();
+    if (depth_ == kMaxDepth) {
+      throw std::length_error("Writer: nesting too deep");
+    }
+    Level &level = levels_[depth_++];
+    level.object = object;
+    level.patch = false;
+    level.header = 0;
+    level.count = 0;
+    switch (encoding_) {
+    case Encoding::kMsgPack:
+      if (kUnknown == n) {
+        Put(object ? 0xdf : 0xdd);
+        level.patch = true;
+        level.header = out_.size();
+        PutBigEndian(0, 4);
+      } else if (object) {
+        PutMsgPackContainer(0x80, 0xde, 0xdf, n);
+      } else {
+        PutMsgPackContainer(0x90, 0xdc, 0xdd, n);
+      }
+      break;
+    case Encoding::kCbor:
+      if (kUnknown == n) {
+        Put(object ? 0xba : 0x9a);
+        level.patch = true;
+        level.header = out_.size();
+        PutBigEndian(0, 4);
+      } else {
+        PutCbor(object ? 5 : 4, n);
+      }
+      break;
+    default:
+      Put(object ? '{' : '[');
+    }
+  }
+
+  void Close(void) {
+    Level &level = levels_[--depth_];
+    if (Encoding::kJson == encoding_) {
+      Put(level.object ? '}' : ']');
+    } else if (level.patch) {
+      for (int i = 0; i < 4; ++i) {
+        out_[level.header + i] =
+            static_cast<char>((level.count >> (8 * (3 - i))) & 0xff);
+      }
+    }
+  }
+
+  void PutString(const char *s, std::size_t n) {
+    switch (encoding_) {
+    case Encoding::kMsgPack:
+      if (n < 32) {
+        Put(0xa0 | static_cast<uint8_t>(n));
+      } else if (n < 0x100) {
+        Put(0xd9);
+        PutBigEndian(n, 1);
+      } else if (n < 0x10000) {
+        Put(0xda);
+        PutBigEndian(n, 2);
+      } else {
+        Put(0xdb);
+        PutBigEndian(n, 4);
+      }
+      out_.append(s, n);
+      break;
+    case Encoding::kCbor:
+      PutCbor(3, n);
+      out_.append(s, n);
+      break;
+    default:
+      Put('"');
+      for (std::size_t i = 0; i < n; ++i) {
+        const char c = s[i];
+        if ('"' == c || '\\' == c) {
+          Put('\\');
+          Put(c);
+        } else if ('\n' == c) {
+          out_ += "\\n";
+        } else if ('\t' == c) {
+          out_ += "\\t";
+        } else if ('\r' == c) {
+          out_ += "\\r";
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+          char escaped[8];
+          std::snprintf(escaped, sizeof(escaped), "\\u%04x",
+                        static_cast<unsigned>(c));
+          out_ += escaped;
+        } else {
+          Put(c);
+        }
+      }
+      Put('"');
+    }
+  }
+
+public:
+  explicit Writer(Encoding encoding = Encoding::kJson)
+      : encoding_(encoding), depth_(0), after_key_(false),
+        model_references_(0), covariance_forms_(false) {}
+
+  Encoding encoding(void) const { return (encoding_); }
+
+  /*!
+   * \brief Discard the contents (but not the capacity) and optionally switch
+   * encoding.
+   */
+  void Clear(void) {
+    out_.clear();
+    depth_ = 0;
+    after_key_ = false;
+    model_references_ = 0;
+    covariance_forms_ = false;
+  }
+  void Clear(Encoding encoding) {
+    Clear();
+    encoding_ = encoding;
+  }
+
+  /*!
+   * \brief Write measurements whose noise model comes from a registry (see
+   * NoiseModels::registry()), whose models the endpoint knows, as references
+   * to their model rather than in full; models of any other registry are
+   * still written in full. 0, the default and after Clear(), writes every
+   * measurement in full, so that what is written elsewhere (journals, dumps)
+   * stays self-contained.
+   */
+  void SetModelReferences(uint64_t registry) { model_references_ = registry; }
+  uint64_t model_references(void) const { return (model_references_); }
+
+  /*!
+   * \brief Whether structured covariances are written in their compact form,
+   * tagged with "covType" (see Normal), rather than as the dense n*n matrix
+   * every endpoint understands. Off by default, and after Clear().
+   */
+  void SetCovarianceForms(bool forms) { covariance_forms_ = forms; }
+  bool covariance_forms(void) const { return (covariance_forms_); }
+
+  const std::string &str(void) const { return (out_); }
+  const char *data(void) const { return (out_.data()); }
+  char *data(void) { return (&out_[0]); }
+  std::size_t size(void) const { return (out_.size()); }
+  void Reserve(std::size_t capacity) { out_.reserve(capacity); }
+
+  void BeginObject(std::size_t n = kUnknown) { Open(true, n); }
+  void EndObject(void) { Close(); }
+  void BeginArray(std::size_t n = kUnknown) { Open(false, n); }
+  void EndArray(void) { Close(); }
+
+  void Key(const char *key) { Key(key, std::strlen(key)); }
+  void Key(const std::string &key) { Key(key.data(), key.size()); }
+  void Key(const char *key, std::size_t n) {
+    Separator();
+    PutString(key, n);
+    if (Encoding::kJson == encoding_) {
+      Put(':');
+    }
+    after_key_ = true;
+  }
+
+  void String(const char *s) { String(s, std::strlen(s)); }
+  void String(const std::string &s) { String(s.data(), s.size()); }
+  void String(const char *s, std::size_t n) {
+    Separator();
+    PutString(s, n);
+  }
+
+  void Null(void) {
+    Separator();
+    switch (encoding_) {
+    case Encoding::kMsgPack:
+      Put(0xc0);
+      break;
+    case Encoding::kCbor:
+      Put(0xf6);
+      break;
+    default:
+      out_ += "null";
+    }
+  }
+
+  void Bool(bool value) {
+    Separator();
+    switch (encoding_) {
+    case Encoding::kMsgPack:
+      Put(value ? 0xc3 : 0xc2);
+      break;
+    case Encoding::kCbor:
+      Put(value ? 0xf5 : 0xf4);
+      break;
+    default:
+      out_ += (value ? "true" : "false");
+    }
+  }
+
+  void Int(int64_t value) {
+    Separator();
+    switch (encoding_) {
+    case Encoding::kMsgPack:
+      if (value >= -32 && value < 128) {
+        Put(static_cast<uint8_t>(value));
+      } else {
+        Put(0xd3);
+        PutBigEndian(static_cast<uint64_t>(value), 8);
+      }
+      break;
+    case Encoding::kCbor:
+      if (value >= 0) {
+        PutCbor(0, static_cast<uint64_t>(value));
+      } else {
+        PutCbor(1, static_cast<uint64_t>(-(value + 1)));
+      }
+      break;
+    default:
+      char buffer[24];
+      int n = std::snprintf(buffer, sizeof(buffer), "%lld",
+                            static_cast<long long>(value));
+      out_.append(buffer, n);
+    }
+  }
+
+  void Double(double value) {
+    Separator();
+    if (Encoding::kJson != encoding_) {
+      uint64_t bits;
+      std::memcpy(&bits, &value, sizeof(bits));
+      Put(Encoding::kMsgPack == encoding_ ? 0xcb : 0xfb);
+      PutBigEndian(bits, 8);
+      return;
+    }
+    if (!std::isfinite(value)) {
+      out_ += "null"; // as nlohmann::json does
+      return;
+    }
+    // same shortest round-trip formatting (Grisu2) as json::dump
+    char buffer[64];
+    char *end = nlohmann::detail::to_chars(buffer, buffer + sizeof(buffer),
+                                           value);
+    out_.append(buffer, end - buffer);
+  }
+
+  void Array(const std::vector<double> &values) {
+    Array(values.data(), values.size());
+  }
+
+  void Array(const double *values, std::size_t n) {
+    BeginArray(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      Double(values[i]);
+    }
+    EndArray();
+  }
+
+  void Array(const std::vector<std::string> &values) {
+    BeginArray(values.size());
+    for (const std::string &value : values) {
+      String(value);
+    }
+    EndArray();
+  }
+
+  /*!
+   * \brief Write a json object; this goes through the DOM, so it is only
+   * meant for values without a streaming writer.
+   */
+  void Value(const json &j) {
+    Separator();
+    switch (encoding_) {
+    case Encoding::kMsgPack:
+      json::to_msgpack(j, out_);
+      break;
+    case Encoding::kCbor:
+      json::to_cbor(j, out_);
+      break;
+    default:
+      out_ += j.dump();
+    }
+  }
+
+  /*!
+   * \brief Remember the current position in the innermost container.
+   */
+  Mark GetMark(void) const {
+    Mark mark = {out_.size(), depth_ > 0 ? levels_[depth_ - 1].count : 0};
+    return (mark);
+  }
+
+  /*!
+   * \brief Drop everything written since mark, which must have been taken in
+   * the current container, between two entries.
+   */
+  void Rewind(const Mark &mark) {
+    out_.resize(mark.size);
+    if (depth_ > 0) {
+      levels_[depth_ - 1].count = mark.count;
+    }
+    after_key_ = false;
+  }
+};
+
+} // namespace graff
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+#include <malloc.h>
+#endif
+
+// Helpers shared by the benchmarks.
+
+typedef std::chrono::steady_clock Clock;
+
+inline double Microseconds(const Clock::time_point &t0,
+                           const Clock::time_point &t1) {
+  return (std::chrono::duration<double, std::micro>(t1 - t0).count());
+}
+
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+// Defined before including this header, BENCHMARK_COUNT_ALLOCATIONS replaces
+// the global operator new and delete to count the heap allocations made by
+// the calling thread (not, e.g., by an in-process server) and the heap bytes
+// in use (glibc); the replacement is program-wide, so only one translation
+// unit may define it.
+
+static thread_local std::size_t allocations = 0;
+static thread_local std::size_t live = 0; /*!< heap bytes in use */
+
+void *operator new(std::size_t size) {
+  void *p = std::malloc(size);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  ++allocations;
+  live += malloc_usable_size(p);
+  return (p);
+}
+
+void operator delete(void *p) noexcept {
+  live -= (p ? malloc_usable_size(p) : 0);
+  std::free(p);
+}
+void operator delete(void *p, std::size_t) noexcept { operator delete(p); }
+#endif
@@ -0,0 +1,222 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <graff/compression.hpp>
+#include <graff/graff.hpp>
+#include <graff/mock_server.hpp>
+
+#include "benchmark.hpp"
+
+// Measures what shrinking the bulky messages buys: factors carrying
+// SampleWeights measurements, and estimate replies carrying kernel density
+// estimates. The first table gives the size of a factor once its samples are
+// reduced on the client (SampleWeights::Reduce) to a budget, and the time
+// that takes. The second gives the compression ratio and the CPU cost of each
+// compression on each encoding; the third sends the messages through the
+// in-process mock server and counts the bytes on the wire. Build with
+// GRAFF_USE_ZSTD and/or GRAFF_USE_LZ4 to compare compressions.
+//
+//   benchmark_compression [samples per factor] [factors] [repetitions]
+
+// a range factor whose measurement is a particle set, as a sonar or an
+// acoustic ranging front-end would produce
+graff::Factor MakeFactor(int i, std::size_t samples, std::mt19937 &rng) {
+  std::normal_distribution<double> range(25.0 + i, 0.5);
+  std::vector<double> s(samples), w(samples, 1.0 / samples);
+  for (double &sample : s) {
+    sample = range(rng);
+  }
+  graff::Factor f("Range", {"x" + std::to_string(i), "l1"});
+  f.push_back(graff::SampleWeights(s, w, 0.0));
+  return (f);
+}
+
+// a sonar range profile: intensities of evenly spaced range bins, with one
+// return over a noise floor; the endpoint is asked to drop the lower half
+graff::SampleWeights MakeProfile(std::size_t bins, std::mt19937 &rng) {
+  std::uniform_real_distribution<double> noise(0.0, 0.05);
+  std::vector<double> s(bins), w(bins);
+  for (std::size_t i = 0; i < bins; ++i) {
+    s[i] = 0.5 + 0.02 * i;
+    const double offset = (s[i] - 0.5 - 0.01 * bins) / 0.3;
+    w[i] = std::exp(-0.5 * offset * offset) + noise(rng);
+  }
+  return (graff::SampleWeights(s, w, 0.5));
+}
+
+// a getEstimates reply, with a kernel density estimate for each variable
+json MakeEstimates(std::size_t variables, std::size_t points,
+                   std::mt19937 &rng) {
+  std::normal_distribution<double> noise(0.0, 0.1);
+  json estimates = json::array();
+  for (std::size_t i = 0; i < variables; ++i) {
+    const std::size_t dim = 6;
+    std::vector<double> kde_points(points * dim);
+    for (double &x : kde_points) {
+      x = static_cast<double>(i) + noise(rng);
+    }
+    json estimate;
+    estimate["label"] = "x" + std::to_string(i);
+    estimate["version"] = 1;
+    estimate["mean"] = std::vector<double>(dim, static_cast<double>(i));
+    estimate["kde"]["dim"] = dim;
+    estimate["kde"]["points"] = kde_points;
+    estimate["kde"]["bandwidths"] = std::vector<double>(dim, 0.05);
+    estimates.push_back(estimate);
+  }
+  json reply;
+  reply["status"] = "OK";
+  reply["payload"]["version"] = 1;
+  reply["payload"]["estimates"] = estimates;
+  return (reply);
+}
+
+void Codecs(const std::string &name, const json &message, int repeats) {
+  for (graff::Encoding encoding :
+       {graff::Encoding::kJson, graff::Encoding::kMsgPack}) {
+    const std::string body = graff::Encode(message, encoding);
+    for (graff::Compression compression :
+         {graff::Compression::kLz4, graff::Compression::kZstd}) {
+      if (!graff::CompressionAvailable(compression)) {
+        continue;
+      }
+      std::string deflated, inflated;
+      double compress_us = 0.0, decompress_us = 0.0;
+      for (int r = 0; r < repeats; ++r) {
+        Clock::time_point t0 = Clock::now();
+        if (!graff::Compress(body.data(), body.size(), compression,
+                             deflated)) {
+          deflated = body; // incompressible, sent as is
+        }
+        Clock::time_point t1 = Clock::now();
+        if (deflated.size() < body.size()) {
+          graff::Decompress(deflated.data(), deflated.size(), compression,
+                            inflated);
+        }
+        Clock::time_point t2 = Clock::now();
+        compress_us += Microseconds(t0, t1);
+        decompress_us += Microseconds(t1, t2);
+      }
+      std::printf("%-10s %-8s %-6s %10zu %10zu %7.2f %12.1f %12.1f %9.0f\n",
+                  name.c_str(), graff::EncodingName(encoding).c_str(),
+                  graff::CompressionName(compression).c_str(), body.size(),
+                  deflated.size(),
+                  static_cast<double>(body.size()) / deflated.size(),
+                  compress_us / repeats, decompress_us / repeats,
+                  body.size() * repeats / compress_us);
+    }
+  }
+}
+
+int main(int argCount, char **argValues) {
+  const std::size_t samples =
+      (argCount > 1 ? std::strtoul(argValues[1], nullptr, 10) : 500);
+  const int factors = (argCount > 2 ? std::atoi(argValues[2]) : 50);
+  const int repeats = (argCount > 3 ? std::atoi(argValues[3]) : 20);
+
+  std::mt19937 rng(42);
+  const graff::SampleWeights profile = MakeProfile(samples * 4, rng);
+  std::printf("%-8s %8s %10s %12s\n", "budget", "samples", "bytes",
+              "reduce [us]");
+  for (std::size_t budget : {std::size_t(0), samples, samples / 4,
+                             samples / 16}) {
+    graff::SampleWeights reduced(profile);
+    double reduce_us = 0.0;
+    for (int r = 0; r < repeats; ++r) {
+      reduced = profile;
+      Clock::time_point t0 = Clock::now();
+      reduced.Reduce(budget);
+      reduce_us += Microseconds(t0, Clock::now());
+    }
+    graff::Factor f("Range", std::vector<std::string>{"x1", "l1"});
+    f.push_back(reduced);
+    std::printf("%-8zu %8zu %10zu %12.1f\n", budget, reduced.samples().size(),
+                f.ToJson().dump().size(), reduce_us / repeats);
+  }
+  graff::Factor raw("Range", std::vector<std::string>{"x1", "l1"});
+  raw.push_back(profile);
+  std::printf("%-8s %8zu %10zu %12s\n\n", "raw", profile.samples().size(),
+              raw.ToJson().dump().size(), "-");
+
+  std::vector<std::string> available = graff::AvailableCompressions();
+  if (available.empty()) {
+    std::cout << "No compression compiled in; rebuild with GRAFF_USE_ZSTD "
+                 "and/or GRAFF_USE_LZ4.\n";
+    return (0);
+  }
+
+  json request;
+  request["request"] = "addFactor";
+  request["payload"] = MakeFactor(1, samples, rng).ToJson();
+  std::printf("%-10s %-8s %-6s %10s %10s %7s %12s %12s %9s\n", "message",
+              "encoding", "codec", "bytes", "wire", "ratio",
+              "compress[us]", "inflate[us]", "MB/s");
+  Codecs("samples", request, repeats);
+  Codecs("kde", MakeEstimates(20, 100, rng), repeats);
+
+  // end to end: the same factors and KDE queries, with each compression
+  zmq::context_t context(1);
+  const std::string address("inproc://graff-compression");
+  graff::MockServer server(context, address);
+  std::thread server_thread([&server]() { server.Run(); });
+
+  std::printf("\n%-6s %12s %12s %12s %12s\n", "codec", "up [bytes]",
+              "down [bytes]", "factor [us]", "kde [us]");
+  graff::Robot robot("benchmark");
+  for (graff::Compression compression :
+       {graff::Compression::kNone, graff::Compression::kLz4,
+        graff::Compression::kZstd}) {
+    graff::Endpoint ep(context);
+    ep.Connect(address);
+    if (!ep.NegotiateCompression(compression)) {
+      continue;
+    }
+    graff::RegisterRobot(ep, robot);
+    graff::Session session("compression-" +
+                           graff::CompressionName(compression));
+    graff::RegisterSession(ep, robot, session);
+    for (int i = 0; i <= factors; ++i) {
+      graff::AddVariable(ep, session,
+                         graff::Variable("x" + std::to_string(i), "Pose3"));
+    }
+    graff::AddVariable(ep, session, graff::Variable("l1", "Point3"));
+    graff::RequestSolve(ep, session);
+    ep.ResetStats();
+
+    rng.seed(42);
+    Clock::time_point t0 = Clock::now();
+    for (int i = 1; i <= factors; ++i) {
+      graff::AddFactor(ep, session, MakeFactor(i, samples, rng));
+    }
+    Clock::time_point t1 = Clock::now();
+    for (int i = 1; i <= factors; ++i) {
+      graff::GetVarMAPKDE(ep, session, "x" + std::to_string(i));
+    }
+    Clock::time_point t2 = Clock::now();
+
+    uint64_t up = 0, down = 0;
+    for (const auto &entry : ep.Stats()) {
+      up += entry["bytes_sent"].get<uint64_t>();
+      down += entry["bytes_received"].get<uint64_t>();
+    }
+    std::printf("%-6s %12llu %12llu %12.1f %12.1f\n",
+                graff::CompressionName(compression).c_str(),
+                static_cast<unsigned long long>(up),
+                static_cast<unsigned long long>(down),
+                Microseconds(t0, t1) / factors, Microseconds(t1, t2) / factors);
+  }
+
+  graff::Endpoint ep(context);
+  ep.Connect(address);
+  graff::RequestShutdown(ep);
+  server_thread.join();
+  return (0);
+}
@@ -0,0 +1,141 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <graff/graff.hpp>
+
+// Compares the wire size and the encode/decode cost of each encoding on a
+// pose3-like workload (see src/examples/caesar/pose3): one pose with its
+// priors, odometry and 121 range-azimuth-elevation observations per batch.
+// Each batch is streamed with the framing of Endpoint::BeginRequest("batch")
+// and Batch::Submit, into a writer reused across batches.
+
+struct Pose {
+  std::vector<graff::Variable> variables;
+  std::vector<graff::Factor> factors;
+  std::vector<std::pair<bool, std::size_t>> order; // (is factor, index)
+
+  void Add(const graff::Variable &variable) {
+    order.push_back({false, variables.size()});
+    variables.push_back(variable);
+  }
+  void Add(const graff::Factor &factor) {
+    order.push_back({true, factors.size()});
+    factors.push_back(factor);
+  }
+};
+
+Pose MakePose(int pose) {
+  Pose requests;
+  std::string label = "x" + std::to_string(pose);
+  std::string prev_label = "x" + std::to_string(pose - 1);
+
+  requests.Add(graff::Variable(label, "Pose3"));
+
+  graff::Normal z_zpr({0.0, 0.0, 0.0},
+                      {0.0001, 0.0, 0.0, 0.0, 0.0001, 0.0, 0.0, 0.0, 0.0001});
+  graff::Factor zpr("PartialPriorRollPitchZ", label);
+  zpr.push_back(z_zpr);
+  requests.Add(zpr);
+
+  graff::Normal z_xyh({0.0, 1.0, 0.0},
+                      {0.01, 0.0, 0.0, 0.0, 0.01, 0.0, 0.0, 0.0, 0.0001});
+  graff::Factor odometry("PartialPose3XYYaw", {prev_label, label});
+  odometry.push_back(z_xyh);
+  requests.Add(odometry);
+
+  int point_id(0);
+  for (double z = -1.0; z <= 1.0; z += 0.2) {
+    for (double y = -1.0; y <= 1.0; y += 0.2) {
+      std::string pt = "p" + std::to_string(pose) + "_" +
+                       std::to_string(point_id++);
+      requests.Add(graff::Variable(pt, "Point3"));
+
+      graff::Normal z_az(atan2(y, 5.0), 0.0001);
+      graff::Normal z_el(atan2(z, sqrt(25.0 + y * y)), 0.0001);
+      graff::Normal z_r(sqrt(25.0 + y * y + z * z), 0.01);
+      graff::Factor rae("RangeAzimuthElevation", {label, pt});
+      rae.push_back({z_r, z_az, z_el});
+      requests.Add(rae);
+    }
+  }
+  return (requests);
+}
+
+// stream the pose as one "batch" request, as Batch::Submit does
+void WriteBatch(graff::Writer &w, const Pose &pose) {
+  w.BeginObject(2);
+  w.Key("payload");
+  w.BeginArray(pose.order.size());
+  for (const std::pair<bool, std::size_t> &entry : pose.order) {
+    w.BeginObject(2);
+    w.Key("payload");
+    if (entry.first) {
+      pose.factors[entry.second].Write(w);
+    } else {
+      pose.variables[entry.second].Write(w);
+    }
+    w.Key("request");
+    w.String(entry.first ? "addFactor" : "addVariable");
+    w.EndObject();
+  }
+  w.EndArray();
+  w.Key("request");
+  w.String("batch");
+  w.EndObject();
+}
+
+int main(int argCount, char **argValues) {
+  const int poses = (argCount > 1 ? std::atoi(argValues[1]) : 30);
+  const int repeats = (argCount > 2 ? std::atoi(argValues[2]) : 20);
+
+  std::vector<Pose> workload;
+  std::size_t count = 0;
+  for (int i = 1; i <= poses; ++i) {
+    workload.push_back(MakePose(i));
+    count += workload.back().order.size();
+  }
+  std::cout << poses << " poses, " << count << " requests, " << repeats
+            << " repetitions\n\n";
+
+  std::printf("%-10s %14s %12s %14s %14s\n", "encoding", "bytes/request",
+              "ratio", "encode [ns]", "decode [ns]");
+  typedef std::chrono::steady_clock clock;
+  double json_bytes = 0.0;
+  for (graff::Encoding encoding :
+       {graff::Encoding::kJson, graff::Encoding::kMsgPack,
+        graff::Encoding::kCbor}) {
+    std::size_t bytes = 0;
+    double encode_ns = 0.0, decode_ns = 0.0;
+    graff::Writer w;
+    for (int r = 0; r < repeats; ++r) {
+      for (const Pose &pose : workload) {
+        // one batch per pose, as the pose3 example does
+        clock::time_point t0 = clock::now();
+        w.Clear(encoding);
+        WriteBatch(w, pose);
+        clock::time_point t1 = clock::now();
+        json decoded = graff::Decode(w.data(), w.size(), encoding);
+        clock::time_point t2 = clock::now();
+
+        bytes += w.size();
+        encode_ns += std::chrono::duration<double, std::nano>(t1 - t0).count();
+        decode_ns += std::chrono::duration<double, std::nano>(t2 - t1).count();
+      }
+    }
+    double n = static_cast<double>(count) * repeats;
+    double per_request = bytes / n;
+    if (graff::Encoding::kJson == encoding) {
+      json_bytes = per_request;
+    }
+    std::printf("%-10s %14.1f %12.2f %14.1f %14.1f\n",
+                graff::EncodingName(encoding).c_str(), per_request,
+                json_bytes / per_request, encode_ns / n, decode_ns / n);
+  }
+  return (0);
+}
@@ -0,0 +1,100 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <graff/graff.hpp>
+#include <graff/kde.hpp>
+
+#include "benchmark.hpp"
+
+// Measures querying a Pose3 belief (a KDE reply, as GetVarMAPKDE() returns
+// it) locally: the density at many points, evaluated straight from the json
+// reply as one would by hand, and with graff::KDE on one thread and on all
+// of them; then the mean, the mode and a marginal.
+//
+//   benchmark_kde [kernels] [queries]
+
+// the density at x, walking the reply
+double JsonDensity(const json &kde, const double *x) {
+  const std::size_t dim = kde["dim"];
+  const json &points = kde["points"];
+  const json &bandwidths = kde["bandwidths"];
+  const std::size_t count = points.size() / dim;
+  double density = 0.0;
+  for (std::size_t i = 0; i < count; ++i) {
+    double e = 0.0, norm = 1.0;
+    for (std::size_t d = 0; d < dim; ++d) {
+      const double h = bandwidths[d];
+      const double z = (x[d] - points[i * dim + d].get<double>()) / h;
+      e += z * z;
+      norm *= std::sqrt(2.0 * 3.141592653589793) * h;
+    }
+    density += std::exp(-0.5 * e) / norm;
+  }
+  return (density / count);
+}
+
+int main(int argCount, char **argValues) {
+  const std::size_t kernels =
+      (argCount > 1 ? std::strtoul(argValues[1], nullptr, 10) : 200);
+  const std::size_t queries =
+      (argCount > 2 ? std::strtoul(argValues[2], nullptr, 10) : 10000);
+  const std::size_t dim = 6;
+
+  std::vector<double> points(kernels * dim), x(queries * dim);
+  for (std::size_t i = 0; i < points.size(); ++i) {
+    points[i] = 0.5 * std::sin(1.0 + static_cast<double>(i));
+  }
+  for (std::size_t i = 0; i < x.size(); ++i) {
+    x[i] = 0.5 * std::cos(0.3 * static_cast<double>(i));
+  }
+  json reply;
+  reply["dim"] = dim;
+  reply["points"] = points;
+  reply["bandwidths"] = std::vector<double>(dim, 0.1);
+  std::printf("%zu kernels in %zu dimensions, %zu queries\n\n", kernels, dim,
+              queries);
+
+  std::vector<double> by_hand(queries), one(queries), all(queries);
+  Clock::time_point t0 = Clock::now();
+  for (std::size_t j = 0; j < queries; ++j) {
+    by_hand[j] = JsonDensity(reply, x.data() + j * dim);
+  }
+  Clock::time_point t1 = Clock::now();
+  graff::KDE belief;
+  belief.FromJson(reply);
+  Clock::time_point t2 = Clock::now();
+  belief.Density(x.data(), queries, one.data(), 1);
+  Clock::time_point t3 = Clock::now();
+  belief.Density(x.data(), queries, all.data());
+  Clock::time_point t4 = Clock::now();
+  std::vector<double> mean = belief.Mean();
+  Clock::time_point t5 = Clock::now();
+  std::vector<double> mode = belief.Mode();
+  Clock::time_point t6 = Clock::now();
+  graff::KDE xy = belief.Marginal({0, 1});
+  Clock::time_point t7 = Clock::now();
+
+  double error = 0.0;
+  for (std::size_t j = 0; j < queries; ++j) {
+    error = std::fmax(error, std::fabs(by_hand[j] - all[j]) /
+                                 std::fmax(by_hand[j], 1e-300));
+  }
+  std::printf("%-22s %12s %12s\n", "", "total [us]", "query [ns]");
+  std::printf("%-22s %12.1f %12.1f\n", "density, json", Microseconds(t0, t1),
+              1e3 * Microseconds(t0, t1) / queries);
+  std::printf("%-22s %12.1f\n", "KDE::FromJson", Microseconds(t1, t2));
+  std::printf("%-22s %12.1f %12.1f\n", "density, 1 thread",
+              Microseconds(t2, t3), 1e3 * Microseconds(t2, t3) / queries);
+  std::printf("%-22s %12.1f %12.1f\n", "density, all threads",
+              Microseconds(t3, t4), 1e3 * Microseconds(t3, t4) / queries);
+  std::printf("%-22s %12.1f\n", "mean", Microseconds(t4, t5));
+  std::printf("%-22s %12.1f\n", "mode", Microseconds(t5, t6));
+  std::printf("%-22s %12.1f\n", "marginal", Microseconds(t6, t7));
+  std::printf("\nmax relative difference %.3g; mode density %.3g, mean "
+              "density %.3g, %zu-d marginal\n",
+              error, belief.Density(mode), belief.Density(mean), xy.dim());
+  return (0);
+}
@@ -0,0 +1,136 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <graff/graff.hpp>
+
+#define BENCHMARK_COUNT_ALLOCATIONS
+#include "benchmark.hpp"
+
+// Compares pose3-like survey factors (per pose: a roll-pitch-z prior, an
+// odometry factor and a ping of 121 range-azimuth-elevation factors) built
+// with a Normal per measurement and with shared noise models
+// (graff::NoiseModels): heap allocations to build them and heap bytes to
+// hold them (glibc), and bytes per factor on the wire in each encoding, with
+// the measurements in full and as model references.
+//
+//   benchmark_noise_models [poses]
+
+// the survey; with models, the measurements share them
+void Survey(int poses, graff::NoiseModels *models,
+            std::vector<graff::Factor> &factors) {
+  const graff::Normal zpr({0.0, 0.0, 0.0}, {0.0001, 0.0, 0.0, 0.0, 0.0001,
+                                            0.0, 0.0, 0.0, 0.0001});
+  const std::vector<double> xyh_var = {0.01, 0.0, 0.0, 0.0,   0.01,
+                                       0.0,  0.0, 0.0, 0.0001};
+  std::shared_ptr<const graff::NoiseModel> range, angle;
+  if (models) {
+    range = models->Add(graff::Normal(0.0, 0.01));
+    angle = models->Add(graff::Normal(0.0, 0.0001));
+  }
+  for (int i = 1; i <= poses; ++i) {
+    const graff::Symbol pose('x', i);
+    graff::Factor prior("PartialPriorRollPitchZ", pose);
+    prior.push_back(models ? models->Share(zpr) : graff::Measurement(zpr));
+    factors.push_back(std::move(prior));
+
+    const graff::Normal xyh({0.0, 1.0, 0.0}, xyh_var);
+    graff::Factor odometry(
+        "PartialPose3XYYaw",
+        std::vector<graff::Symbol>{graff::Symbol('x', i - 1), pose});
+    odometry.push_back(models ? models->Share(xyh) : graff::Measurement(xyh));
+    factors.push_back(std::move(odometry));
+
+    std::size_t k = 0;
+    for (double z = -1.0; z <= 1.0; z += 0.2) {
+      for (double y = -1.0; y <= 1.0; y += 0.2) {
+        const double rae[3] = {std::sqrt(25.0 + y * y + z * z),
+                               std::atan2(y, 5.0),
+                               std::atan2(z, std::sqrt(25.0 + y * y))};
+        graff::Factor f(
+            "RangeAzimuthElevation",
+            std::vector<graff::Symbol>{pose, graff::Symbol('p', i, k++)});
+        if (models) {
+          f.push_back(graff::Measurement(&rae[0], 1, range));
+          f.push_back(graff::Measurement(&rae[1], 1, angle));
+          f.push_back(graff::Measurement(&rae[2], 1, angle));
+        } else {
+          f.push_back(graff::Normal(rae[0], 0.01));
+          f.push_back(graff::Normal(rae[1], 0.0001));
+          f.push_back(graff::Normal(rae[2], 0.0001));
+        }
+        factors.push_back(std::move(f));
+      }
+    }
+  }
+}
+
+int main(int argCount, char **argValues) {
+  const int poses = (argCount > 1 ? std::atoi(argValues[1]) : 30);
+
+  std::vector<graff::Factor> full, shared;
+  graff::NoiseModels models;
+  full.reserve(poses * 123);
+  shared.reserve(poses * 123);
+  std::size_t before = allocations, live_before = live;
+  Survey(poses, nullptr, full);
+  const double n = static_cast<double>(full.size());
+  const double full_allocs = (allocations - before) / n;
+  const double full_bytes = (live - live_before) / n;
+  before = allocations;
+  live_before = live;
+  Survey(poses, &models, shared);
+  const double shared_allocs = (allocations - before) / n;
+  const double shared_bytes = (live - live_before) / n;
+
+  // the endpoint only knows the ids of this registry's models: a model of
+  // another one must be written in full
+  {
+    graff::NoiseModels other;
+    graff::Writer w;
+    w.SetModelReferences(models.registry());
+    other.Share(graff::Normal(1.0, 0.01)).Write(w);
+    if (std::string::npos != w.str().find("\"model\"")) {
+      std::fprintf(stderr, "foreign noise model written as a reference\n");
+      return (1);
+    }
+  }
+
+  std::printf("%d poses, %zu factors, %zu noise models\n\n", poses,
+              full.size(), models.size());
+  std::printf("%-22s %14s %14s\n", "measurements", "allocs/factor",
+              "heap B/factor");
+  std::printf("%-22s %14.1f %14.1f\n", "Normal", full_allocs, full_bytes);
+  std::printf("%-22s %14.1f %14.1f\n", "NoiseModels", shared_allocs,
+              shared_bytes);
+
+  std::printf("\n%-10s %16s %16s %8s\n", "encoding", "full [B/factor]",
+              "refs [B/factor]", "ratio");
+  for (graff::Encoding encoding :
+       {graff::Encoding::kJson, graff::Encoding::kMsgPack,
+        graff::Encoding::kCbor}) {
+    graff::Writer w(encoding);
+    std::size_t in_full = 0, by_reference = 0;
+    for (const graff::Factor &f : full) {
+      w.Clear();
+      f.Write(w);
+      in_full += w.size();
+    }
+    w.Clear();
+    models.WritePending(w); // sent once
+    by_reference += w.size();
+    for (const graff::Factor &f : shared) {
+      w.Clear();
+      w.SetModelReferences(models.registry());
+      f.Write(w);
+      by_reference += w.size();
+    }
+    std::printf("%-10s %16.1f %16.1f %8.2f\n",
+                graff::EncodingName(encoding).c_str(), in_full / n,
+                by_reference / n, static_cast<double>(in_full) / by_reference);
+  }
+  return (0);
+}
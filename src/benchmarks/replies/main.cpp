@@ -0,0 +1,83 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <graff/graff.hpp>
+
+// Compares decoding a large estimates reply (the mean of every pose and
+// landmark of a pose3-like survey, as GetVarsMAP() returns it) into an
+// EstimateArray through a json DOM, and reading it straight from the message
+// with graff::Reader, in each encoding.
+//
+//   benchmark_replies [variables] [repetitions]
+
+typedef std::chrono::steady_clock Clock;
+
+int main(int argCount, char **argValues) {
+  const std::size_t variables =
+      (argCount > 1 ? std::strtoul(argValues[1], nullptr, 10) : 10000);
+  const int repeats = (argCount > 2 ? std::atoi(argValues[2]) : 20);
+
+  // one pose in 122 variables, the rest landmarks
+  graff::EstimateArray estimates(graff::EstimateField::kMean);
+  estimates.SetVersion(1);
+  std::vector<double> mean(6);
+  for (std::size_t i = 0; i < variables; ++i) {
+    const std::size_t dim = (0 == i % 122 ? 6 : 3);
+    for (std::size_t k = 0; k < dim; ++k) {
+      mean[k] = 0.001 * static_cast<double>(i * 7 + k);
+    }
+    const std::string label = (0 == i % 122 ? "x" : "p") + std::to_string(i);
+    estimates.Append(label, dim, mean.data(), dim);
+  }
+  json reply;
+  reply["status"] = "OK";
+  reply["payload"] = estimates.ToJson();
+  std::printf("%zu variables, %d repetitions\n\n", variables, repeats);
+
+  std::printf("%-10s %12s %12s %12s %8s\n", "encoding", "bytes", "DOM [us]",
+              "Reader [us]", "ratio");
+  for (graff::Encoding encoding :
+       {graff::Encoding::kJson, graff::Encoding::kMsgPack,
+        graff::Encoding::kCbor}) {
+    const std::string bytes = graff::Encode(reply, encoding);
+    const zmq::message_t body(bytes.data(), bytes.size());
+    graff::WireFormat format;
+    format.encoding = encoding;
+    const std::string name = format.Tag();
+    const zmq::message_t tag(name.data(), name.size());
+    const zmq::message_t *tag_frame =
+        (graff::Encoding::kJson == encoding ? nullptr : &tag);
+
+    graff::EstimateArray dom, direct;
+    std::size_t checksum = 0;
+    Clock::time_point t0 = Clock::now();
+    for (int r = 0; r < repeats; ++r) {
+      json decoded = graff::DecodeReply(body, tag_frame);
+      checksum += (check(decoded) && dom.FromJson(decoded["payload"]));
+    }
+    Clock::time_point t1 = Clock::now();
+    const graff::PayloadReader read = [&direct](graff::Reader &reader) {
+      return (direct.Read(reader));
+    };
+    for (int r = 0; r < repeats; ++r) {
+      json decoded = graff::ReadReply(body, tag_frame, read);
+      checksum += (check(decoded) && !decoded.count("payload"));
+    }
+    Clock::time_point t2 = Clock::now();
+
+    const double dom_us =
+        std::chrono::duration<double, std::micro>(t1 - t0).count() / repeats;
+    const double direct_us =
+        std::chrono::duration<double, std::micro>(t2 - t1).count() / repeats;
+    std::printf("%-10s %12zu %12.1f %12.1f %8.2f%s\n",
+                graff::EncodingName(encoding).c_str(), bytes.size(), dom_us,
+                direct_us, dom_us / direct_us,
+                (checksum == 2u * repeats && dom.data() == direct.data()
+                     ? ""
+                     : "  (mismatch)"));
+  }
+  return (0);
+}
@@ -0,0 +1,215 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <graff/graff.hpp>
+#include <graff/mock_server.hpp>
+
+#define BENCHMARK_COUNT_ALLOCATIONS
+#include "benchmark.hpp"
+
+// Compares the DOM-based request path (ToJson + dump) with the streaming
+// Writer used by Endpoint::BeginRequest/EndRequest, counting heap allocations
+// per request. It then submits factors to an in-process mock server and
+// checks that, once the buffers have grown, the send side of the submit path
+// (serializing and the zero-copy send) does not allocate; the reply is still
+// decoded into a json object and, with AddFactor, recorded in the session,
+// which do. Exits with 1 if the send side allocates. It also counts the
+// allocations made when building elements from label strings versus symbols.
+
+int main(int argCount, char **argValues) {
+  const int repeats = (argCount > 1 ? std::atoi(argValues[1]) : 1000);
+
+  // one ping of the pose3 example: 121 points, each observed by a
+  // range-azimuth-elevation factor
+  std::vector<graff::Variable> points;
+  std::vector<graff::Factor> factors;
+  for (double z = -1.0; z <= 1.0; z += 0.2) {
+    for (double y = -1.0; y <= 1.0; y += 0.2) {
+      std::string pt = "p1_" + std::to_string(points.size());
+      points.push_back(graff::Variable(pt, "Point3"));
+      graff::Factor rae("RangeAzimuthElevation",
+                        std::vector<std::string>({"x1", pt}));
+      rae.push_back(graff::Normal(sqrt(25.0 + y * y + z * z), 0.01));
+      rae.push_back(graff::Normal(atan2(y, 5.0), 0.0001));
+      rae.push_back(graff::Normal(atan2(z, sqrt(25.0 + y * y)), 0.0001));
+      factors.push_back(rae);
+    }
+  }
+  const double n = static_cast<double>(repeats) * factors.size();
+
+  typedef std::chrono::steady_clock clock;
+  std::printf("%-22s %14s %14s %14s\n", "path", "allocs/request",
+              "bytes/request", "time [ns]");
+
+  // DOM path, as in AddFactor before streaming
+  {
+    std::size_t bytes = 0;
+    allocations = 0;
+    clock::time_point t0 = clock::now();
+    for (int r = 0; r < repeats; ++r) {
+      for (const graff::Factor &f : factors) {
+        json request;
+        request["request"] = "addFactor";
+        request["payload"] = f.ToJson();
+        std::string request_str = request.dump(0);
+        bytes += request_str.size();
+      }
+    }
+    clock::time_point t1 = clock::now();
+    std::printf("%-22s %14.2f %14.1f %14.1f\n", "json dom + dump",
+                allocations / n, bytes / n,
+                std::chrono::duration<double, std::nano>(t1 - t0).count() / n);
+  }
+
+  // streaming path, with the same framing as Endpoint::BeginRequest
+  for (graff::Encoding encoding :
+       {graff::Encoding::kJson, graff::Encoding::kMsgPack,
+        graff::Encoding::kCbor}) {
+    graff::Writer w(encoding);
+    std::size_t bytes = 0;
+    for (int warmup = 0; warmup < 2; ++warmup) {
+      for (const graff::Factor &f : factors) {
+        w.Clear();
+        w.BeginObject(2);
+        w.Key("payload");
+        f.Write(w);
+        w.Key("request");
+        w.String("addFactor");
+        w.EndObject();
+      }
+    }
+    allocations = 0;
+    clock::time_point t0 = clock::now();
+    for (int r = 0; r < repeats; ++r) {
+      for (const graff::Factor &f : factors) {
+        w.Clear();
+        w.BeginObject(2);
+        w.Key("payload");
+        f.Write(w);
+        w.Key("request");
+        w.String("addFactor");
+        w.EndObject();
+        bytes += w.size();
+      }
+    }
+    clock::time_point t1 = clock::now();
+    std::string label = "writer (" + graff::EncodingName(encoding) + ")";
+    std::printf("%-22s %14.2f %14.1f %14.1f\n", label.c_str(),
+                allocations / n, bytes / n,
+                std::chrono::duration<double, std::nano>(t1 - t0).count() / n);
+  }
+
+  // the submit path against the mock server: the send side is what is
+  // counted from BeginRequest() to EndRequest(), less decoding the reply
+  bool allocates = false;
+  {
+    // round trips are slower than serializing: fewer of them
+    const int submits = (repeats + 99) / 100;
+    const double m = static_cast<double>(submits) * factors.size();
+    zmq::context_t context(1);
+    graff::MockServer server(context, "inproc://benchmark-serialization");
+    std::thread serve([&server]() { server.Run(); });
+    graff::Endpoint ep(context);
+    ep.Connect("inproc://benchmark-serialization");
+    graff::Session session("benchmark");
+    graff::Robot robot("benchmark");
+    graff::RegisterSession(ep, robot, session);
+    graff::AddVariable(ep, session, graff::Variable("x1", "Pose3"));
+    for (const graff::Variable &point : points) {
+      graff::AddVariable(ep, session, point);
+    }
+
+    std::printf("\n%-22s %14s %14s %14s %14s\n", "allocs/request",
+                "serialize", "send", "decode reply", "AddFactor");
+    for (graff::Encoding encoding :
+         {graff::Encoding::kJson, graff::Encoding::kMsgPack,
+          graff::Encoding::kCbor}) {
+      ep.SetEncoding(encoding);
+      for (int warmup = 0; warmup < 2; ++warmup) {
+        for (const graff::Factor &f : factors) {
+          f.Write(ep.BeginRequest("addFactor"));
+          ep.EndRequest();
+        }
+      }
+      std::size_t serialize = 0, send = 0, decode = 0, add = 0;
+      for (int r = 0; r < submits; ++r) {
+        for (const graff::Factor &f : factors) {
+          const std::size_t begun = allocations;
+          f.Write(ep.BeginRequest("addFactor"));
+          const std::size_t written = allocations;
+          json reply = ep.EndRequest();
+          const std::size_t replied = allocations;
+          // decode the same reply again, to take it out of the count
+          const std::string body = graff::Encode(reply, encoding);
+          const std::size_t encoded = allocations;
+          reply = graff::Decode(body.data(), body.size(), encoding);
+          const std::size_t decoding = allocations - encoded;
+          serialize += written - begun;
+          send += (replied - written > decoding ? replied - written - decoding
+                                                : 0);
+          decode += decoding;
+        }
+      }
+      for (int r = 0; r < submits; ++r) {
+        for (const graff::Factor &f : factors) {
+          const std::size_t before = allocations;
+          graff::AddFactor(ep, session, f);
+          add += allocations - before;
+        }
+      }
+      std::string label = "endpoint (" + graff::EncodingName(encoding) + ")";
+      std::printf("%-22s %14.2f %14.2f %14.2f %14.2f\n", label.c_str(),
+                  serialize / m, send / m, decode / m, add / m);
+      allocates = allocates || serialize > 0 || send > 0;
+    }
+    graff::RequestShutdown(ep);
+    serve.join();
+  }
+  if (allocates) {
+    std::printf("the send side of the submit path allocates\n");
+  }
+
+  // building the point variables and their factors from formatted label
+  // strings, or from symbols (which are packed, so nothing is formatted)
+  std::printf("\n%-22s %14s %14s\n", "labels", "allocs/point",
+              "time [ns]");
+  for (int symbolic = 0; symbolic < 2; ++symbolic) {
+    std::size_t built = 0;
+    allocations = 0;
+    clock::time_point t0 = clock::now();
+    for (int r = 0; r < repeats; ++r) {
+      for (std::size_t i = 0; i < points.size(); ++i) {
+        if (symbolic) {
+          graff::Symbol pt('p', 1, i);
+          graff::Variable point(pt, "Point3");
+          graff::Factor rae("RangeAzimuthElevation",
+                            std::vector<graff::Symbol>({graff::Symbol('x', 1),
+                                                        pt}));
+          built += point.symbol().key() != rae.variables()[1].key();
+        } else {
+          std::string pt = "p1_" + std::to_string(i);
+          graff::Variable point(pt, "Point3");
+          graff::Factor rae("RangeAzimuthElevation",
+                            std::vector<std::string>({"x1", pt}));
+          built += point.symbol().key() != rae.variables()[1].key();
+        }
+      }
+    }
+    clock::time_point t1 = clock::now();
+    std::printf("%-22s %14.2f %14.1f\n",
+                symbolic ? "symbols" : "strings", allocations / n,
+                std::chrono::duration<double, std::nano>(t1 - t0).count() / n);
+    if (built) {
+      std::printf("label mismatch\n");
+    }
+  }
+  std::printf("sizeof(Variable) %zu, sizeof(Factor) %zu\n",
+              sizeof(graff::Variable), sizeof(graff::Factor));
+  return (allocates ? 1 : 0);
+}
@@ -0,0 +1,106 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <graff/snapshot.hpp>
+
+// Compares saving and reloading a session as a pretty-printed
+// Session::ToJson() dump with a binary Snapshot, on a pose3-like graph (see
+// src/examples/caesar/pose3): each pose has priors, odometry and 121
+// range-azimuth-elevation observations of new points.
+
+int main(int argCount, char **argValues) {
+  const int poses = (argCount > 1 ? std::atoi(argValues[1]) : 300);
+  const std::string json_path("benchmark_snapshot.json");
+  const std::string snapshot_path("benchmark_snapshot.snap");
+
+  graff::Session session("benchmark");
+  for (int idx = 0; idx <= poses; ++idx) {
+    graff::Symbol label('x', idx);
+    session.AddVariable(graff::Variable(label, "Pose3"));
+    graff::Factor zpr("PartialPriorRollPitchZ", label);
+    zpr.push_back(graff::Normal({0.0, 0.0, 0.0}, {0.0001, 0.0001, 0.0001},
+                                graff::Normal::Covariance::kDiagonal));
+    session.AddFactor(zpr);
+    if (idx > 0) {
+      graff::Factor odometry("PartialPose3XYYaw",
+                             {graff::Symbol('x', idx - 1), label});
+      odometry.push_back(graff::Normal({0.0, 1.0, 0.0}, {0.01, 0.01, 0.0001},
+                                       graff::Normal::Covariance::kDiagonal));
+      session.AddFactor(odometry);
+    }
+    int point_id(0);
+    for (double z = -1.0; z <= 1.0; z += 0.2) {
+      for (double y = -1.0; y <= 1.0; y += 0.2) {
+        graff::Symbol pt('p', idx, point_id++);
+        session.AddVariable(graff::Variable(pt, "Point3"));
+        graff::Factor rae("RangeAzimuthElevation", {label, pt});
+        for (double mean : {sqrt(25.0 + y * y + z * z), atan2(y, 5.0),
+                            atan2(z, sqrt(25.0 + y * y))}) {
+          rae.push_back(graff::Normal(mean, 0.0001));
+        }
+        session.AddFactor(rae);
+      }
+    }
+  }
+  std::printf("%zu variables, %zu factors\n", session.NumVariables(),
+              session.NumFactors());
+
+  typedef std::chrono::steady_clock clock;
+  auto ms = [](clock::time_point t0, clock::time_point t1) {
+    return (std::chrono::duration<double, std::milli>(t1 - t0).count());
+  };
+  std::printf("%-10s %12s %12s %12s %12s\n", "format", "size [kB]",
+              "save [ms]", "open [ms]", "load [ms]");
+
+  // pretty-printed json dump, as the examples used to write
+  {
+    clock::time_point t0 = clock::now();
+    {
+      std::ofstream o(json_path);
+      o << std::setw(4) << session.ToJson() << std::endl;
+    }
+    clock::time_point t1 = clock::now();
+    std::ifstream i(json_path);
+    std::stringstream contents;
+    contents << i.rdbuf();
+    json j = json::parse(contents.str());
+    clock::time_point t2 = clock::now();
+    std::printf("%-10s %12.1f %12.2f %12.2f %12s\n", "json",
+                contents.str().size() / 1e3, ms(t0, t1), ms(t1, t2), "-");
+  }
+
+  // snapshot: opening maps the file, loading rebuilds a session
+  {
+    clock::time_point t0 = clock::now();
+    graff::Snapshot::Write(session, snapshot_path);
+    clock::time_point t1 = clock::now();
+    graff::Snapshot snapshot(snapshot_path);
+    std::size_t observed = 0;
+    for (std::size_t i = 0; i < snapshot.NumFactors(); ++i) {
+      observed += snapshot.GetFactor(i).NumVariables();
+    }
+    clock::time_point t2 = clock::now();
+    graff::Session loaded;
+    snapshot.Load(loaded);
+    clock::time_point t3 = clock::now();
+    std::ifstream i(snapshot_path, std::ios::binary | std::ios::ate);
+    std::printf("%-10s %12.1f %12.2f %12.2f %12.2f\n", "snapshot",
+                static_cast<double>(i.tellg()) / 1e3, ms(t0, t1), ms(t1, t2),
+                ms(t2, t3));
+    if (loaded.NumFactors() != session.NumFactors() ||
+        observed != 2 * session.NumFactors() - poses - 1) {
+      std::printf("snapshot mismatch\n");
+      return (1);
+    }
+  }
+  std::remove(json_path.c_str());
+  std::remove(snapshot_path.c_str());
+  return (0);
+}
@@ -0,0 +1,82 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <graff/graff.hpp>
+#include <graff/sonar.hpp>
+
+#include "benchmark.hpp"
+
+// Measures turning multibeam pings into RangeAzimuthElevation factors: the
+// conversion one return at a time with std::atan2 (as the pose3 example used
+// to), the conversion a ping at a time with graff::SonarScan, and building
+// the factors into a batch. Also reports the largest difference between the
+// two conversions.
+//
+//   benchmark_sonar [returns per ping] [pings]
+
+int main(int argCount, char **argValues) {
+  const std::size_t returns =
+      (argCount > 1 ? std::strtoul(argValues[1], nullptr, 10) : 512);
+  const int pings = (argCount > 2 ? std::atoi(argValues[2]) : 200);
+
+  // a forward-looking sonar: returns 2 to 30 m ahead, over a 120 x 20 deg fan
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<double> range(2.0, 30.0);
+  std::uniform_real_distribution<double> azimuth(-1.05, 1.05);
+  std::uniform_real_distribution<double> elevation(-0.17, 0.17);
+  std::vector<double> xyz(3 * returns);
+  for (std::size_t i = 0; i < returns; ++i) {
+    const double r = range(rng), az = azimuth(rng), el = elevation(rng);
+    xyz[3 * i] = r * std::cos(el) * std::cos(az);
+    xyz[3 * i + 1] = r * std::cos(el) * std::sin(az);
+    xyz[3 * i + 2] = r * std::sin(el);
+  }
+
+  std::vector<double> r(returns), az(returns), el(returns);
+  Clock::time_point t0 = Clock::now();
+  for (int p = 0; p < pings; ++p) {
+    for (std::size_t i = 0; i < returns; ++i) {
+      const double x = xyz[3 * i], y = xyz[3 * i + 1], z = xyz[3 * i + 2];
+      r[i] = std::sqrt(x * x + y * y + z * z);
+      az[i] = std::atan2(y, x);
+      el[i] = std::atan2(z, std::sqrt(x * x + y * y));
+    }
+  }
+  Clock::time_point t1 = Clock::now();
+  graff::SonarScan scan;
+  for (int p = 0; p < pings; ++p) {
+    scan.Convert(xyz.data(), returns);
+  }
+  Clock::time_point t2 = Clock::now();
+  const graff::SonarScan::Noise noise = {0.01, 0.0001, 0.0001};
+  std::size_t elements = 0;
+  for (int p = 0; p < pings; ++p) {
+    graff::Batch batch;
+    scan.AddTo(batch, graff::Symbol('x', p), 'p', p, noise);
+    elements += batch.size();
+  }
+  Clock::time_point t3 = Clock::now();
+
+  double error = 0.0;
+  for (std::size_t i = 0; i < returns; ++i) {
+    error = std::fmax(error, std::fabs(r[i] - scan.range()[i]));
+    error = std::fmax(error, std::fabs(az[i] - scan.azimuth()[i]));
+    error = std::fmax(error, std::fabs(el[i] - scan.elevation()[i]));
+  }
+
+  std::printf("%-16s %12s %12s\n", "", "ping [us]", "return [ns]");
+  std::printf("%-16s %12.1f %12.1f\n", "std::atan2",
+              Microseconds(t0, t1) / pings,
+              1e3 * Microseconds(t0, t1) / pings / returns);
+  std::printf("%-16s %12.1f %12.1f\n", "SonarScan",
+              Microseconds(t1, t2) / pings,
+              1e3 * Microseconds(t1, t2) / pings / returns);
+  std::printf("%-16s %12.1f %12.1f\n", "AddTo", Microseconds(t2, t3) / pings,
+              1e3 * Microseconds(t2, t3) / pings / returns);
+  std::printf("\n%zu elements, max difference %.3g\n", elements, error);
+  return (0);
+}
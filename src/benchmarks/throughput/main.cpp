@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <graff/graff.hpp>
+#include <graff/mock_server.hpp>
+#include <graff/submitter.hpp>
+
+#include "benchmark.hpp"
+
+// Drives an endpoint with the graph of the pose3 example (a vertical
+// lawn-mower survey, 121 range-azimuth-elevation observations per pose) and
+// reports request rates and latencies for each submission strategy. Without
+// an address, the mock server runs in-process over inproc://.
+//
+//   benchmark_throughput [legs] [poses per leg] [address]
+
+struct Pose {
+  std::vector<graff::Variable> variables;
+  std::vector<graff::Factor> factors;
+};
+
+struct Survey {
+  std::vector<Pose> poses;
+};
+
+void MakeSurvey(int legs, int poses_per_leg, Survey &survey) {
+  double direction(1.0);
+  Pose first;
+  first.variables.push_back(graff::Variable("x0", "Pose3"));
+  graff::Factor prior0("Prior", "x0");
+  prior0.push_back(graff::Normal(
+      {0.0, 0.0, 0.0}, {0.01, 0.0, 0.0, 0.0, 0.01, 0.0, 0.0, 0.0, 0.01}));
+  first.factors.push_back(prior0);
+  survey.poses.push_back(first);
+
+  for (int i = 0; i < legs; ++i) {
+    direction *= -1.0;
+    for (int j = 0; j < poses_per_leg; ++j) {
+      int idx = i * poses_per_leg + j + 1;
+      Pose pose;
+      std::string label = "x" + std::to_string(idx);
+      std::string prev_label = "x" + std::to_string(idx - 1);
+      pose.variables.push_back(graff::Variable(label, "Pose3"));
+
+      graff::Factor zpr("PartialPriorRollPitchZ", label);
+      zpr.push_back(graff::Normal(
+          {0.0, 0.0, 0.0},
+          {0.0001, 0.0, 0.0, 0.0, 0.0001, 0.0, 0.0, 0.0, 0.0001}));
+      pose.factors.push_back(zpr);
+
+      graff::Factor odometry("PartialPose3XYYaw",
+                             std::vector<std::string>({prev_label, label}));
+      odometry.push_back(graff::Normal(
+          {0.0, (0 == j ? 0.0 : direction), 0.0},
+          {0.01, 0.0, 0.0, 0.0, 0.01, 0.0, 0.0, 0.0, 0.0001}));
+      pose.factors.push_back(odometry);
+
+      int point_id(0);
+      for (double z = -1.0; z <= 1.0; z += 0.2) {
+        for (double y = -1.0; y <= 1.0; y += 0.2) {
+          std::string pt =
+              "p" + std::to_string(idx) + "_" + std::to_string(point_id++);
+          pose.variables.push_back(graff::Variable(pt, "Point3"));
+          graff::Factor rae("RangeAzimuthElevation",
+                            std::vector<std::string>({label, pt}));
+          rae.push_back(graff::Normal(sqrt(25.0 + y * y + z * z), 0.01));
+          rae.push_back(graff::Normal(atan2(y, 5.0), 0.0001));
+          rae.push_back(graff::Normal(atan2(z, sqrt(25.0 + y * y)), 0.0001));
+          pose.factors.push_back(rae);
+        }
+      }
+      survey.poses.push_back(pose);
+    }
+  }
+}
+
+double Percentile(std::vector<double> samples, double p) {
+  if (samples.empty()) {
+    return (0.0);
+  }
+  std::size_t k = static_cast<std::size_t>(p * (samples.size() - 1));
+  std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+  return (samples[k]);
+}
+
+struct Result {
+  std::size_t requests;
+  std::size_t elements;
+  double seconds;
+  std::vector<double> latencies; // per wire request, in microseconds
+};
+
+void Report(const std::string &mode, const Result &r, double bytes_per_factor) {
+  std::printf("%-10s %9zu %9zu %12.0f %12.0f %10.1f %10.1f %12.1f\n",
+              mode.c_str(), r.requests, r.elements, r.elements / r.seconds,
+              r.requests / r.seconds, Percentile(r.latencies, 0.5),
+              Percentile(r.latencies, 0.99), bytes_per_factor);
+}
+
+// one round trip per element
+Result Lockstep(graff::Endpoint &ep, graff::Session &session,
+                const Survey &survey) {
+  Result r = {0, 0, 0.0, {}};
+  Clock::time_point start = Clock::now();
+  for (const Pose &pose : survey.poses) {
+    for (const graff::Variable &v : pose.variables) {
+      Clock::time_point t0 = Clock::now();
+      graff::AddVariable(ep, session, v);
+      r.latencies.push_back(Microseconds(t0, Clock::now()));
+    }
+    for (const graff::Factor &f : pose.factors) {
+      Clock::time_point t0 = Clock::now();
+      graff::AddFactor(ep, session, f);
+      r.latencies.push_back(Microseconds(t0, Clock::now()));
+    }
+    r.elements += pose.variables.size() + pose.factors.size();
+  }
+  r.seconds = Microseconds(start, Clock::now()) * 1e-6;
+  r.requests = r.latencies.size();
+  return (r);
+}
+
+// one batch per pose
+Result Batched(graff::Endpoint &ep, graff::Session &session,
+               const Survey &survey) {
+  Result r = {0, 0, 0.0, {}};
+  graff::Batch batch;
+  Clock::time_point start = Clock::now();
+  for (const Pose &pose : survey.poses) {
+    for (const graff::Variable &v : pose.variables) {
+      batch.AddVariable(v);
+    }
+    for (const graff::Factor &f : pose.factors) {
+      batch.AddFactor(f);
+    }
+    r.elements += batch.size();
+    Clock::time_point t0 = Clock::now();
+    batch.Submit(ep, session);
+    r.latencies.push_back(Microseconds(t0, Clock::now()));
+  }
+  r.seconds = Microseconds(start, Clock::now()) * 1e-6;
+  r.requests = r.latencies.size();
+  return (r);
+}
+
+// many single-element requests in flight; the replies, handled within
+// Wait(), add the accepted elements to the session as the other modes do
+Result Pipelined(graff::AsyncEndpoint &ep, graff::Session &session,
+                 const Survey &survey) {
+  Result r = {0, 0, 0.0, {}};
+  std::vector<double> &latencies = r.latencies;
+  Clock::time_point start = Clock::now();
+  for (const Pose &pose : survey.poses) {
+    for (const graff::Variable &v : pose.variables) {
+      Clock::time_point t0 = Clock::now();
+      v.Write(ep.BeginRequest("addVariable"));
+      ep.EndRequest([t0, &latencies, &session, &v](const json &reply) {
+        latencies.push_back(Microseconds(t0, Clock::now()));
+        if (check(reply)) {
+          session.AddVariable(v);
+        }
+      });
+    }
+    // factors need their variables to exist on the endpoint
+    ep.Wait();
+    for (const graff::Factor &f : pose.factors) {
+      Clock::time_point t0 = Clock::now();
+      f.Write(ep.BeginRequest("addFactor"));
+      ep.EndRequest([t0, &latencies, &session, &f](const json &reply) {
+        latencies.push_back(Microseconds(t0, Clock::now()));
+        if (check(reply)) {
+          session.AddFactor(f, graff::ReplyLabel(reply));
+        }
+      });
+    }
+    r.elements += pose.variables.size() + pose.factors.size();
+  }
+  ep.Wait();
+  r.seconds = Microseconds(start, Clock::now()) * 1e-6;
+  r.requests = r.latencies.size();
+  return (r);
+}
+
+// a navigation and a sonar thread pushing into a Submitter; the latencies
+// are those of the pushes
+Result Queued(graff::Endpoint &ep, graff::Session &session,
+              const Survey &survey) {
+  Result r = {0, 0, 0.0, {}};
+  std::vector<double> nav_latencies, sonar_latencies;
+  std::atomic<std::size_t> navigated(0); // poses pushed by the nav thread
+  graff::Submitter submitter(ep, session, 1 << 16,
+                             graff::Submitter::Overflow::kBlock);
+  Clock::time_point start = Clock::now();
+  std::thread nav([&]() {
+    for (const Pose &pose : survey.poses) {
+      Clock::time_point t0 = Clock::now();
+      submitter.AddVariable(pose.variables.front());
+      nav_latencies.push_back(Microseconds(t0, Clock::now()));
+      for (const graff::Factor &f : pose.factors) {
+        if ("RangeAzimuthElevation" != f.Type()) {
+          t0 = Clock::now();
+          submitter.AddFactor(f);
+          nav_latencies.push_back(Microseconds(t0, Clock::now()));
+        }
+      }
+      ++navigated;
+    }
+  });
+  std::thread sonar([&]() {
+    for (std::size_t i = 0; i < survey.poses.size(); ++i) {
+      // observations refer to the pose, which must be queued first
+      while (navigated.load() <= i) {
+        std::this_thread::yield();
+      }
+      const Pose &pose = survey.poses[i];
+      for (std::size_t j = 1; j < pose.variables.size(); ++j) {
+        Clock::time_point t0 = Clock::now();
+        submitter.AddVariable(pose.variables[j]);
+        sonar_latencies.push_back(Microseconds(t0, Clock::now()));
+      }
+      for (const graff::Factor &f : pose.factors) {
+        if ("RangeAzimuthElevation" == f.Type()) {
+          Clock::time_point t0 = Clock::now();
+          submitter.AddFactor(f);
+          sonar_latencies.push_back(Microseconds(t0, Clock::now()));
+        }
+      }
+    }
+  });
+  nav.join();
+  sonar.join();
+  submitter.Flush();
+  r.seconds = Microseconds(start, Clock::now()) * 1e-6;
+  r.requests = submitter.requests();
+  r.elements = submitter.submitted();
+  r.latencies = nav_latencies;
+  r.latencies.insert(r.latencies.end(), sonar_latencies.begin(),
+                     sonar_latencies.end());
+  return (r);
+}
+
+int main(int argCount, char **argValues) {
+  const int legs = (argCount > 1 ? std::atoi(argValues[1]) : 3);
+  const int poses_per_leg = (argCount > 2 ? std::atoi(argValues[2]) : 10);
+  const bool embedded = (argCount <= 3);
+  const std::string address(embedded ? "inproc://graff-benchmark"
+                                     : argValues[3]);
+
+  Survey survey;
+  MakeSurvey(legs, poses_per_leg, survey);
+
+  zmq::context_t context(1);
+  std::unique_ptr<graff::MockServer> server;
+  std::thread server_thread;
+  if (embedded) {
+    server.reset(new graff::MockServer(context, address));
+    server_thread = std::thread([&server]() { server->Run(); });
+  }
+
+  graff::Endpoint ep(context);
+  ep.Connect(address);
+  graff::AsyncEndpoint aep(context, 256);
+  aep.Connect(address);
+  graff::Robot robot("benchmark");
+  graff::RegisterRobot(ep, robot);
+
+  std::printf("%zu poses against %s\n\n", survey.poses.size(),
+              address.c_str());
+  std::printf("%-10s %9s %9s %12s %12s %10s %10s %12s\n", "mode", "requests",
+              "elements", "elements/s", "requests/s", "p50 [us]", "p99 [us]",
+              "bytes/factor");
+
+  const char *modes[] = {"lockstep", "batch", "pipelined", "queued"};
+  for (const char *mode : modes) {
+    graff::Session session(std::string("benchmark-") + mode);
+    graff::RegisterSession(ep, robot, session);
+    uint64_t bytes = (server ? server->bytes_received() : 0);
+    uint64_t factors = (server ? server->factors() : 0);
+
+    Result r;
+    if (std::string("lockstep") == mode) {
+      r = Lockstep(ep, session, survey);
+    } else if (std::string("batch") == mode) {
+      r = Batched(ep, session, survey);
+    } else if (std::string("pipelined") == mode) {
+      r = Pipelined(aep, session, survey);
+    } else {
+      r = Queued(ep, session, survey);
+    }
+
+    // includes the variables' bytes, which are sent along with the factors
+    double bytes_per_factor = 0.0;
+    if (server && server->factors() > factors) {
+      bytes_per_factor = static_cast<double>(server->bytes_received() - bytes) /
+                         (server->factors() - factors);
+    }
+    Report(mode, r, bytes_per_factor);
+  }
+
+  // where the time of the synchronous endpoint went, by request type
+  std::printf("\n%-14s %9s %7s %14s %14s %12s %12s\n", "request", "count",
+              "errors", "rtt p50 [us]", "rtt p99 [us]", "encode [us]",
+              "decode [us]");
+  const json stats = ep.Stats();
+  for (auto it = stats.begin(); it != stats.end(); ++it) {
+    const json &s = it.value();
+    std::printf("%-14s %9llu %7llu %14.1f %14.1f %12.2f %12.2f\n",
+                it.key().c_str(), s["count"].get<unsigned long long>(),
+                s["errors"].get<unsigned long long>(),
+                s["round_trip"]["p50_us"].get<double>(),
+                s["round_trip"]["p99_us"].get<double>(),
+                s["serialize"]["mean_us"].get<double>(),
+                s["parse"]["mean_us"].get<double>());
+  }
+
+  graff::RequestShutdown(ep);
+  if (server_thread.joinable()) {
+    server_thread.join();
+  }
+  return (0);
+}
@@ -1,11 +1,9 @@
-#include <chrono>
-#include <fstream>
 #include <iostream>
 #include <string>
-#include <thread>
 #include <vector>
 
-#include <graff/graff.hpp>
+#include <graff/journal.hpp>
+#include <graff/typed.hpp>
 
 int main(int argCount, char **argValues) {
   graff::Endpoint ep;
@@ -14,9 +12,20 @@ int main(int argCount, char **argValues) {
   ep.Connect("tcp://127.0.0.1:5555");
   std::cout << "connected!" << std::endl;
 
+  // diagonal and isotropic covariances are sent compact, if understood
+  ep.NegotiateCovarianceForms();
+
   graff::Robot robot("krakenoid");
   graff::Session session("first dive");
 
+  // solve progress and estimates are pushed on the events channel, if the
+  // endpoint publishes one; otherwise WaitForSolve() polls
+  ep.Subscribe(session.name());
+
+  // journal the elements as the endpoint accepts them
+  graff::Journal journal("hexagonal.jsonl");
+  session.SetObserver(&journal);
+
   json reply;
   std::cout << "Registering robot " << robot.Name();
   reply = graff::RegisterRobot(ep, robot);
@@ -29,63 +38,49 @@ int main(int argCount, char **argValues) {
     std::cout << " - success!\n";
   }
 
+  // variable and factor types are checked at compile time
+  typedef graff::TypedVariable<graff::Pose2> Pose;
+  const graff::FixedNormal<3> step = graff::FixedNormal<3>::Isotropic(
+      {10.0, 0.0, PI / 3.0}, 0.01); // odometry measurement
   for (int i = 0; i < 6; ++i) {
-    std::string idx = "x" + std::to_string(i);
-    graff::Variable pose(idx, "Pose2");
+    Pose pose(graff::Symbol('x', i));
     reply = graff::AddVariable(ep, session, pose);
 
     if (i > 0) {
-      std::string prev_idx = "x" + std::to_string(i - 1);
-      std::vector<double> mu = {10.0, 0.0, PI / 3.0};
-      std::vector<double> sig = {0.01, 0.0, 0.0, 0.0, 0.01,
-                                 0.0,  0.0, 0.0, 0.01};
-      graff::Normal *z = new graff::Normal(mu, sig);
-      std::vector<std::string> nodes = {prev_idx, idx};
-      graff::Factor odometry("Pose2Pose2", nodes);
-      odometry.push_back(z); // measurement
+      Pose prev(graff::Symbol('x', i - 1));
+      graff::TypedFactor<graff::Pose2Pose2> odometry(prev, pose, step);
       reply = graff::AddFactor(ep, session, odometry);
     }
   }
 
   // add prior on first node
-  std::vector<double> mean = {0.0, 0.0, 0.0};
-  std::vector<double> cov = {0.01, 0.0, 0.0, 0.0, 0.01, 0.0, 0.0, 0.0, 0.01};
-  graff::Normal *p0 = new graff::Normal(mean, cov);
-  graff::Factor prior0("Prior"); //, "x0", p0);
-  prior0.push_back("x0");
-  prior0.push_back(p0);
+  Pose x0(graff::Symbol('x', 0));
+  graff::TypedFactor<graff::PriorPose2> prior0(
+      x0, graff::FixedNormal<3>::Isotropic({0.0, 0.0, 0.0}, 0.01));
   reply = graff::AddFactor(ep, session, prior0);
 
   // add landmark
-  graff::Variable l1("l1", "Point2");
+  graff::TypedVariable<graff::Point2> l1("l1");
   graff::AddVariable(ep, session, l1);
 
-  // add first landmark observation
-  graff::Normal *zb1 = new graff::Normal(0, 0.1);
-  graff::Normal *zr1 = new graff::Normal(10, 1.0);
-  graff::Factor f1("Pose2Point2BearingRange",
-                   std::vector<std::string>({"x0", "l1"}));
-  f1.push_back(zb1);
-  f1.push_back(zr1);
+  // add first landmark observation (bearing, range)
+  graff::TypedFactor<graff::Pose2Point2BearingRange> f1(
+      x0, l1, graff::FixedNormal<1>(0, 0.1), graff::FixedNormal<1>(10, 1.0));
   reply = graff::AddFactor(ep, session, f1);
 
   // add second landmark observation
-  graff::Normal *zb2 = new graff::Normal(0, 0.1);
-  graff::Normal *zr2 = new graff::Normal(20, 1.0);
-  graff::Factor f2("Pose2Point2BearingRange",
-                   std::vector<std::string>({"x6", "l1"}));
-  f2.push_back(zb2);
-  f2.push_back(zr2);
+  graff::TypedFactor<graff::Pose2Point2BearingRange> f2(
+      Pose(graff::Symbol('x', 6)), l1, graff::FixedNormal<1>(0, 0.1),
+      graff::FixedNormal<1>(20, 1.0));
   reply = graff::AddFactor(ep, session, f2);
 
-  // save session to disk
-  json js = session.ToJson();
-  std::ofstream o("hexagonal.json");
-  o << std::setw(4) << js << std::endl;
-
   reply = graff::RequestSolve(ep, session);
 
-  std::this_thread::sleep_for(std::chrono::seconds(10));
+  // wait until the endpoint reports the solve finished
+  reply = graff::WaitForSolve(ep, session, 60000);
+  if (check(reply)) {
+    std::cout << "Solve " << reply["version"] << " finished\n";
+  }
 
   return (0);
 }
@@ -1,11 +1,10 @@
-#include <chrono>
-#include <fstream>
 #include <iostream>
 #include <string>
-#include <thread>
+#include <utility>
 #include <vector>
 
-#include <graff/graff.hpp>
+#include <graff/journal.hpp>
+#include <graff/sonar.hpp>
 
 int main(int argCount, char **argValues) {
   graff::Endpoint ep;
@@ -14,11 +13,22 @@ int main(int argCount, char **argValues) {
   ep.Connect("tcp://127.0.0.1:5555");
   std::cout << "connected!" << std::endl;
 
+  // diagonal and isotropic covariances are sent compact, if understood
+  ep.NegotiateCovarianceForms();
+
   ToggleMockMode(ep); // not sure it is working.
 
   graff::Robot robot("krakenoid3000");
   graff::Session session("first dive");
 
+  // solve progress and estimates are pushed on the events channel, if the
+  // endpoint publishes one; otherwise WaitForSolve() polls
+  ep.Subscribe(session.name());
+
+  // journal the elements as the endpoint accepts them
+  graff::Journal journal("first_dive.jsonl");
+  session.SetObserver(&journal);
+
   json reply;
   std::cout << "Registering robot " << robot.Name();
   reply = graff::RegisterRobot(ep, robot);
@@ -31,6 +41,11 @@ int main(int argCount, char **argValues) {
     std::cout << " - success!\n";
   }
 
+  // the priors, odometry and sonar returns repeat a few noise models: keep
+  // each once, and send it once if the endpoint accepts model references
+  graff::NoiseModels &models = session.noise_models();
+  graff::NegotiateNoiseModels(ep, session);
+
   double direction(1.0), depth(0.0);
 
   graff::Variable pose("x0", "Pose3");
@@ -38,12 +53,16 @@ int main(int argCount, char **argValues) {
 
   std::vector<double> mean = {0.0, 0.0, 0.0};
   std::vector<double> cov = {0.01, 0.0, 0.0, 0.0, 0.01, 0.0, 0.0, 0.0, 0.01};
-  graff::Normal *p0 = new graff::Normal(mean, cov);
   graff::Factor prior0("Prior", "x0");
-  prior0.push_back(p0);
+  prior0.push_back(graff::Normal(mean, cov));
   reply = graff::AddFactor(ep, session, prior0);
 
-  // vertical lawn-mower, each leg is at constant depth
+  // vertical lawn-mower, each leg is at constant depth; each pose and its
+  // observations are sent to the endpoint as a single batch
+  graff::Batch batch;
+  graff::SonarScan scan;
+  const graff::SonarScan::Noise noise = {0.01, 0.0001, 0.0001};
+  std::vector<double> xyz;
   for (int i = 0; i < 3; ++i) {
     direction *= -1.0; //
     depth += 1.0;      // increase direction by 1m after each leg
@@ -51,77 +70,65 @@ int main(int argCount, char **argValues) {
       int idx = i * 10 + j + 1;
 
       // add pose
-      std::string label = "x" + std::to_string(idx);
+      graff::Symbol label('x', idx);
       graff::Variable pose(label, "Pose3");
-      reply = graff::AddVariable(ep, session, pose);
+      batch.AddVariable(pose);
 
       // add ZPR prior
       std::vector<double> mean = {0.0, 0.0, 0.0};
       std::vector<double> var = {0.0001, 0.0, 0.0, 0.0,   0.0001,
                                  0.0,    0.0, 0.0, 0.0001};
-      graff::Normal *z_zpr = new graff::Normal(mean, var);
       graff::Factor zpr("PartialPriorRollPitchZ", label);
-      zpr.push_back(z_zpr);
-      reply = graff::AddFactor(ep, session, zpr);
+      zpr.push_back(models.Share(graff::Normal(mean, var)));
+      batch.AddFactor(std::move(zpr));
 
       // add odometry (XYH measurement)
-      std::string prev_label = "x" + std::to_string(idx - 1);
+      graff::Symbol prev_label('x', idx - 1);
       var = {0.01, 0.0, 0.0, 0.0, 0.01, 0.0, 0.0, 0.0, 0.0001};
       if (0 == j) {
         mean = {0.0, 0.0, 0.0}; // dive
       } else {
         mean = {0.0, direction * 1.0, 0.0}; // move sideways
       }
-      graff::Normal *z_xyh = new graff::Normal(mean, var);
       graff::Factor odometry("PartialPose3XYYaw", {prev_label, label});
-      odometry.push_back(z_xyh);
-      reply = graff::AddFactor(ep, session, odometry);
+      odometry.push_back(models.Share(graff::Normal(mean, var)));
+      batch.AddFactor(std::move(odometry));
 
-      // add range measurements (121 total)
-      int point_id(0);
+      // add range measurements (121 total), converted a ping at a time
+      xyz.clear();
       for (double z = -1.0; z <= 1.0; z += 0.2) {
         for (double y = -1.0; y <= 1.0; y += 0.2) {
-          std::string pt =
-              "p" + std::to_string(idx) + "_" + std::to_string(point_id);
-          graff::Variable point(pt, "Point3");
-          reply = graff::AddVariable(ep, session, point);
-
-          double az, el, r;
-          az = atan2(y, 5.0);
-          el = atan2(z, sqrt(pow(5.0, 2) + pow(y, 2)));
-          r = sqrt(pow(5.0, 2) + pow(y, 2) + pow(z, 2));
-          graff::Normal *z_az = new graff::Normal(az, 0.0001);
-          graff::Normal *z_el = new graff::Normal(el, 0.0001);
-          graff::Normal *z_r = new graff::Normal(r, 0.01);
-          graff::Factor range_measurement("RangeAzimuthElevation", {label, pt});
-          range_measurement.push_back({z_r, z_az, z_el});
-          reply = graff::AddFactor(ep, session, range_measurement);
-          point_id++;
+          xyz.insert(xyz.end(), {5.0, y, z});
         }
       }
+      scan.Convert(xyz.data(), xyz.size() / 3);
+      scan.AddTo(batch, label, 'p', idx, noise, models);
 
       // add a match constraint
-      graff::Normal *z_match = new graff::Normal(
-          {0.0, 0.0, 0.0}, {0.01, 0.0, 0.0, 0.0, 0.01, 0.0, 0.0, 0.0, .01});
-      std::string pt_a = "p" + std::to_string(idx - 1) + "_60";
-      std::string pt_b = "p" + std::to_string(idx) + "_55";
+      graff::Symbol pt_a('p', idx - 1, 60);
+      graff::Symbol pt_b('p', idx, 55);
       graff::Factor match("Point3Point3", {pt_a, pt_b});
-      match.push_back(z_match);
-      reply = graff::AddFactor(ep, session, match);
+      match.push_back(models.Share(graff::Normal(
+          {0.0, 0.0, 0.0}, {0.01, 0.0, 0.0, 0.0, 0.01, 0.0, 0.0, 0.0, .01})));
+      batch.AddFactor(std::move(match));
+
+      reply = batch.Submit(ep, session);
     }
   }
 
-  // save session to disk
-  json js = session.ToJson();
-  std::ofstream o("pretty.json");
-  o << std::setw(4) << js << std::endl;
-
   // set ready
   reply = RequestSolve(ep, session);
 
-  std::this_thread::sleep_for(std::chrono::seconds(10));
-
-  // TODO: get estimates back
+  // wait until the endpoint reports the solve finished; estimates pushed
+  // with it are already cached, otherwise get them all in one request
+  reply = graff::WaitForSolve(ep, session, 60000);
+  if (!session.EstimatesFresh()) {
+    reply = graff::UpdateSession(ep, session);
+  }
+  if (session.EstimatesFresh()) {
+    std::cout << "Final pose estimate: "
+              << graff::GetVarMAPMean(ep, session, "x30")["payload"] << "\n";
+  }
 
   // we're done here.
   RequestShutdown(ep);
@@ -0,0 +1,21 @@
+#include <iostream>
+#include <string>
+
+#include <graff/mock_server.hpp>
+
+// A stand-in for the Caesar endpoint: serves the graff request protocol until
+// it receives a "shutdown" request.
+int main(int argCount, char **argValues) {
+  std::string address(argCount > 1 ? argValues[1] : "tcp://127.0.0.1:5555");
+  std::string events(argCount > 2 ? argValues[2] : "tcp://127.0.0.1:5556");
+
+  zmq::context_t context(1);
+  graff::MockServer server(context, address, events);
+  std::cout << "Mock server listening on " << address
+            << ", publishing events on " << events << std::endl;
+  server.Run();
+  std::cout << "Served " << server.requests() << " requests ("
+            << server.bytes_received() << " bytes in, " << server.bytes_sent()
+            << " bytes out)" << std::endl;
+  return (0);
+}
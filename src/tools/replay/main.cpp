@@ -0,0 +1,38 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include <graff/journal.hpp>
+
+// Resubmits a session journal to the endpoint, in batches, e.g. to restore a
+// session after a crash or to re-solve a recorded mission.
+int main(int argCount, char **argValues) {
+  if (argCount < 2) {
+    std::cerr << "usage: " << argValues[0]
+              << " journal [address] [session] [batch size]" << std::endl;
+    return (1);
+  }
+  std::string path(argValues[1]);
+  std::string address(argCount > 2 ? argValues[2] : "tcp://127.0.0.1:5555");
+  graff::Session session(argCount > 3 ? argValues[3] : "replay");
+  std::size_t batch_size = (argCount > 4 ? std::stoul(argValues[4]) : 1024);
+
+  graff::Endpoint ep;
+  ep.Connect(address);
+  json reply = graff::RegisterSession(ep, graff::Robot("replay"), session);
+  if (!check(reply)) {
+    std::cerr << "Could not register session " << session.name() << std::endl;
+    return (1);
+  }
+
+  typedef std::chrono::steady_clock clock;
+  clock::time_point t0 = clock::now();
+  reply = graff::ReplayJournal(path, ep, session, batch_size);
+  double seconds = std::chrono::duration<double>(clock::now() - t0).count();
+
+  std::cout << "Replayed " << reply["payload"] << " records in " << seconds
+            << " s (" << reply["payload"].get<double>() / seconds
+            << " records/s), " << reply["failed"].size() << " rejected"
+            << std::endl;
+  return (check(reply) ? 0 : 1);
+}